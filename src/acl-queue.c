@@ -9,8 +9,13 @@
 
 #include "acl-queue.h"
 
+#include <assert.h>
 #include <stdbool.h>
+#include <ctype.h>
+#include <limits.h>
+#include <string.h>
 #include <errno.h>
+#include <arpa/inet.h>
 
 #include "xfunc.h"
 #include "pathmatch.h"
@@ -37,64 +42,539 @@ static inline unsigned acl_check(enum acl_action defaction,
 	return acl_default(defaction, match_ptr);
 }
 
+/*
+ * Compiled path queue:
+ * Literal patterns and literal directories followed by a slash and two
+ * stars, i.e. what pathmatch_expand() generates for the common WILD3_SUFFIX
+ * patterns, are kept in a prefix trie and the rest are matched one by one
+ * with pathmatch(). Every pattern is identified by its
+ * position in the queue so that the last matching pattern still decides.
+ */
+struct acl_trie {
+	unsigned char c;
+	int literal; /* last pattern which is exactly the key, -1 if none */
+	int prefix; /* last pattern which is the key followed by **, -1 if none */
+	struct acl_trie *child;
+	struct acl_trie *next;
+};
+
+/*
+ * Compiled socket queue:
+ * IPv4 and IPv6 patterns are kept in a binary trie on the address bits, one
+ * per family, where each pattern sits at the depth of its netmask. The port
+ * ranges of the patterns ending at a node are split into disjoint segments
+ * which remember the last pattern covering them, so that a lookup costs one
+ * binary search per prefix of the address. UNIX socket patterns are matched
+ * one by one with pathmatch().
+ */
+struct acl_port_range {
+	int index;
+	unsigned min, max;
+	struct acl_port_range *next;
+};
+
+struct acl_lpm {
+	struct acl_lpm *child[2];
+	struct acl_port_range *ranges; /* until acl_lpm_finish() */
+	size_t seg_count;
+	unsigned *seg_start; /* sorted, seg_start[0] is 0 */
+	int *seg_match; /* last pattern covering the segment, -1 if none */
+};
+
+struct acl_compiled {
+	bool case_sensitive;
+	struct acl_node **nodes;
+	struct acl_trie root;
+	size_t glob_count;
+	int *globs; /* in queue order */
+
+	struct acl_lpm inet;
+#if SYDBOX_HAVE_IPV6
+	struct acl_lpm inet6;
+#endif
+	size_t saun_count[2];
+	int *saun[2]; /* non-abstract and abstract, in queue order */
+};
+
+static bool acl_is_literal(const char *s, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		switch (s[i]) {
+		case '*':
+		case '?':
+		case '[':
+		case '\\':
+			return false;
+		default:
+			break;
+		}
+	}
+	return true;
+}
+
+static struct acl_trie *acl_trie_insert(struct acl_trie *t, const char *key,
+					size_t len)
+{
+	size_t i;
+	struct acl_trie *n;
+
+	for (i = 0; i < len; i++) {
+		for (n = t->child; n; n = n->next)
+			if (n->c == (unsigned char)key[i])
+				break;
+		if (!n) {
+			n = xmalloc(sizeof(struct acl_trie));
+			n->c = key[i];
+			n->literal = n->prefix = -1;
+			n->child = NULL;
+			n->next = t->child;
+			t->child = n;
+		}
+		t = n;
+	}
+	return t;
+}
+
+static void acl_trie_free(struct acl_trie *t)
+{
+	struct acl_trie *n, *next;
+
+	for (n = t->child; n; n = next) {
+		next = n->next;
+		acl_trie_free(n);
+		free(n);
+	}
+}
+
+static struct acl_compiled *acl_compile(const aclq_t *aclq)
+{
+	int i;
+	size_t len, count;
+	const char *pattern;
+	struct acl_node *node;
+	struct acl_trie *t;
+	struct acl_compiled *c;
+
+	count = 0;
+	ACLQ_FOREACH(node, aclq)
+		count++;
+
+	c = xcalloc(1, sizeof(struct acl_compiled));
+	c->case_sensitive = pathmatch_get_case();
+	c->nodes = xmalloc(sizeof(struct acl_node *) * count);
+	c->globs = xmalloc(sizeof(int) * count);
+	c->root.literal = c->root.prefix = -1;
+
+	i = 0;
+	ACLQ_FOREACH(node, aclq) {
+		pattern = node->match;
+		len = strlen(pattern);
+		c->nodes[i] = node;
+
+		if (acl_is_literal(pattern, len)) {
+			t = acl_trie_insert(&c->root, pattern, len);
+			t->literal = i;
+		} else if (len >= 3 && streq(pattern + len - 3, "/**") &&
+			   acl_is_literal(pattern, len - 2)) {
+			/* keep the slash in the key, the bare directory must not match */
+			t = acl_trie_insert(&c->root, pattern, len - 2);
+			t->prefix = i;
+		} else {
+			c->globs[c->glob_count++] = i;
+		}
+		i++;
+	}
+
+	return c;
+}
+
+static int acl_port_cmp(const void *a, const void *b)
+{
+	unsigned x = *(const unsigned *)a;
+	unsigned y = *(const unsigned *)b;
+
+	return (x > y) - (x < y);
+}
+
+static size_t acl_port_segment(const struct acl_lpm *t, unsigned port)
+{
+	size_t lo, hi, mid;
+
+	/* last segment starting at or before port */
+	lo = 0;
+	hi = t->seg_count;
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (t->seg_start[mid] <= port)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void acl_lpm_insert(struct acl_lpm *t, const unsigned char *addr,
+			   unsigned bits, unsigned netmask, int index,
+			   unsigned pmin, unsigned pmax)
+{
+	unsigned i, bit;
+	struct acl_port_range *r;
+
+	if (pmin > pmax)
+		return; /* empty port range, matches nothing */
+	if (netmask > bits)
+		netmask = bits;
+
+	for (i = 0; i < netmask; i++) {
+		bit = (addr[i / 8] >> (7 - i % 8)) & 1;
+		if (!t->child[bit])
+			t->child[bit] = xcalloc(1, sizeof(struct acl_lpm));
+		t = t->child[bit];
+	}
+
+	/* kept newest first, acl_lpm_finish() reverses the order */
+	r = xmalloc(sizeof(struct acl_port_range));
+	r->index = index;
+	r->min = pmin;
+	r->max = pmax;
+	r->next = t->ranges;
+	t->ranges = r;
+}
+
+static void acl_lpm_finish(struct acl_lpm *t)
+{
+	unsigned i;
+	size_t n, k, j;
+	struct acl_port_range *r, *next, *rev;
+
+	for (i = 0; i < 2; i++)
+		if (t->child[i])
+			acl_lpm_finish(t->child[i]);
+	if (!t->ranges)
+		return;
+
+	/* queue order, so that later patterns overwrite earlier ones */
+	n = 0;
+	rev = NULL;
+	for (r = t->ranges; r; r = next) {
+		next = r->next;
+		r->next = rev;
+		rev = r;
+		n++;
+	}
+	t->ranges = NULL;
+
+	/* segment boundaries */
+	t->seg_start = xmalloc(sizeof(unsigned) * (2 * n + 1));
+	k = 0;
+	t->seg_start[k++] = 0;
+	for (r = rev; r; r = r->next) {
+		t->seg_start[k++] = r->min;
+		if (r->max < UINT_MAX)
+			t->seg_start[k++] = r->max + 1;
+	}
+	qsort(t->seg_start, k, sizeof(unsigned), acl_port_cmp);
+	for (i = 1, j = 1; j < k; j++) {
+		if (t->seg_start[j] != t->seg_start[i - 1])
+			t->seg_start[i++] = t->seg_start[j];
+	}
+	t->seg_count = i;
+
+	t->seg_match = xmalloc(sizeof(int) * t->seg_count);
+	for (j = 0; j < t->seg_count; j++)
+		t->seg_match[j] = -1;
+	for (r = rev; r; r = next) {
+		next = r->next;
+		for (j = acl_port_segment(t, r->min);
+		     j < t->seg_count && t->seg_start[j] <= r->max; j++)
+			t->seg_match[j] = r->index;
+		free(r);
+	}
+}
+
+static int acl_lpm_match(const struct acl_lpm *t, const unsigned char *addr,
+			 unsigned bits, unsigned port)
+{
+	int best, m;
+	unsigned i;
+
+	/* Every prefix of the address on the way down may have a pattern. */
+	best = -1;
+	for (i = 0; t; i++) {
+		if (t->seg_count) {
+			m = t->seg_match[acl_port_segment(t, port)];
+			if (m > best)
+				best = m;
+		}
+		if (i == bits)
+			break;
+		t = t->child[(addr[i / 8] >> (7 - i % 8)) & 1];
+	}
+	return best;
+}
+
+static void acl_lpm_free(struct acl_lpm *t)
+{
+	unsigned i;
+	struct acl_port_range *r, *next;
+
+	for (i = 0; i < 2; i++) {
+		if (t->child[i]) {
+			acl_lpm_free(t->child[i]);
+			free(t->child[i]);
+		}
+	}
+	for (r = t->ranges; r; r = next) {
+		next = r->next;
+		free(r);
+	}
+	free(t->seg_start);
+	free(t->seg_match);
+}
+
+static struct acl_compiled *acl_compile_sock(const aclq_t *aclq)
+{
+	int i, k;
+	size_t count;
+	struct sockmatch *m;
+	struct acl_node *node;
+	struct acl_compiled *c;
+
+	count = 0;
+	ACLQ_FOREACH(node, aclq)
+		count++;
+
+	c = xcalloc(1, sizeof(struct acl_compiled));
+	c->case_sensitive = pathmatch_get_case();
+	c->nodes = xmalloc(sizeof(struct acl_node *) * count);
+	c->saun[0] = xmalloc(sizeof(int) * count);
+	c->saun[1] = xmalloc(sizeof(int) * count);
+	c->root.literal = c->root.prefix = -1;
+
+	i = 0;
+	ACLQ_FOREACH(node, aclq) {
+		m = node->match;
+		c->nodes[i] = node;
+
+		switch (m->family) {
+		case AF_UNIX:
+			k = m->addr.sa_un.abstract ? 1 : 0;
+			c->saun[k][c->saun_count[k]++] = i;
+			break;
+		case AF_INET:
+			acl_lpm_insert(&c->inet,
+				       (const unsigned char *)&m->addr.sa_in.addr,
+				       32, m->addr.sa_in.netmask, i,
+				       m->addr.sa_in.port[0],
+				       m->addr.sa_in.port[1]);
+			break;
+#if SYDBOX_HAVE_IPV6
+		case AF_INET6:
+			acl_lpm_insert(&c->inet6,
+				       (const unsigned char *)&m->addr.sa6.addr,
+				       128, m->addr.sa6.netmask, i,
+				       m->addr.sa6.port[0],
+				       m->addr.sa6.port[1]);
+			break;
+#endif
+		default:
+			break;
+		}
+		i++;
+	}
+
+	acl_lpm_finish(&c->inet);
+#if SYDBOX_HAVE_IPV6
+	acl_lpm_finish(&c->inet6);
+#endif
+	return c;
+}
+
+void acl_uncompile(aclq_t *aclq)
+{
+	struct acl_compiled *c;
+
+	if (!aclq || !aclq->compiled)
+		return;
+
+	c = aclq->compiled;
+	acl_trie_free(&c->root);
+	acl_lpm_free(&c->inet);
+#if SYDBOX_HAVE_IPV6
+	acl_lpm_free(&c->inet6);
+#endif
+	free(c->nodes);
+	free(c->globs);
+	free(c->saun[0]);
+	free(c->saun[1]);
+	free(c);
+	aclq->compiled = NULL;
+}
+
+/* Compile up front, for queues matched by more than one thread. */
+void acl_compile_pathq(aclq_t *aclq)
+{
+	if (!ACLQ_EMPTY(aclq) && !aclq->compiled)
+		aclq->compiled = acl_compile(aclq);
+}
+
+void acl_compile_sockq(aclq_t *aclq)
+{
+	if (!ACLQ_EMPTY(aclq) && !aclq->compiled)
+		aclq->compiled = acl_compile_sock(aclq);
+}
+
+static struct acl_node *acl_compiled_match(const struct acl_compiled *c,
+					   const char *path)
+{
+	int best;
+	size_t i;
+	unsigned char ch;
+	const char *p;
+	const struct acl_trie *t, *n;
+
+	/* Walk the trie, the path is lowered like iwildmatch() does. */
+	best = -1;
+	t = &c->root;
+	for (p = path;; p++) {
+		if (t->prefix > best)
+			best = t->prefix;
+		if (*p == '\0') {
+			if (t->literal > best)
+				best = t->literal;
+			break;
+		}
+		ch = *p;
+		if (!c->case_sensitive && ch < 0x80 && isupper(ch))
+			ch = tolower(ch);
+		for (n = t->child; n; n = n->next)
+			if (n->c == ch)
+				break;
+		if (!n)
+			break;
+		t = n;
+	}
+
+	/* Try the remaining patterns, last to first, until one beats the trie */
+	for (i = c->glob_count; i > 0; i--) {
+		if (c->globs[i - 1] < best)
+			break;
+		if (pathmatch(c->nodes[c->globs[i - 1]]->match, path)) {
+			best = c->globs[i - 1];
+			break;
+		}
+	}
+
+	return best >= 0 ? c->nodes[best] : NULL;
+}
+
 unsigned acl_pathmatch(enum acl_action defaction, const aclq_t *aclq,
 		       const void *needle, struct acl_node **match)
 {
-	struct acl_node *node, *node_match;
+	aclq_t *q;
 	const char *path = needle;
 
-	if (!aclq || !needle)
+	if (!aclq || !needle || ACLQ_EMPTY(aclq))
 		return acl_default(defaction, match);
 
+	/* The compiled form is a cache, we're allowed to update it. */
+	q = (aclq_t *)aclq;
+	if (q->compiled && q->compiled->case_sensitive != pathmatch_get_case())
+		acl_uncompile(q);
+	if (!q->compiled)
+		q->compiled = acl_compile(q);
+
 	/* The last matching pattern decides */
-	node_match = NULL;
-	ACLQ_FOREACH(node, aclq) {
-		if (pathmatch(node->match, path))
-			node_match = node;
+	return acl_check(defaction, acl_compiled_match(q->compiled, path), match);
+}
+
+/* Try the UNIX socket patterns, last to first, until one beats best. */
+static int acl_saun_match(const struct acl_compiled *c, bool abstract,
+			  const char *path, int best)
+{
+	size_t i;
+	int k = abstract ? 1 : 0;
+	const struct sockmatch *m;
+
+	for (i = c->saun_count[k]; i > 0; i--) {
+		if (c->saun[k][i - 1] < best)
+			break;
+		m = c->nodes[c->saun[k][i - 1]]->match;
+		if (pathmatch(m->addr.sa_un.path, path))
+			return c->saun[k][i - 1];
 	}
+	return best;
+}
 
-	return acl_check(defaction, node_match, match);
+static const struct acl_compiled *acl_sock_compiled(const aclq_t *aclq)
+{
+	aclq_t *q;
+
+	/* The compiled form is a cache, we're allowed to update it. */
+	q = (aclq_t *)aclq;
+	if (!q->compiled)
+		q->compiled = acl_compile_sock(q);
+	return q->compiled;
 }
 
 unsigned acl_sockmatch(enum acl_action defaction, const aclq_t *aclq,
 		       const void *needle, struct acl_node **match)
 {
-	struct acl_node *node, *node_match;
+	int best;
+	const struct acl_compiled *c;
 	const struct pink_sockaddr *psa = needle;
 
-	if (!aclq || !needle)
+	if (!aclq || !needle || ACLQ_EMPTY(aclq))
 		return acl_default(defaction, match);
 
-	/* The last matching pattern decides */
-	node_match = NULL;
-	ACLQ_FOREACH(node, aclq) {
-		if (sockmatch(node->match, psa))
-			node_match = node;
+	/* The last matching pattern decides, see sockmatch() */
+	c = acl_sock_compiled(aclq);
+	switch (psa->family) {
+	case AF_UNIX:
+		if (!path_abstract(psa->u.sa_un.sun_path))
+			/* This needs path resolving, see acl_sockmatch_saun() */
+			best = -1;
+		else
+			best = acl_saun_match(c, true,
+					      psa->u.sa_un.sun_path + 1, -1);
+		break;
+	case AF_INET:
+		best = acl_lpm_match(&c->inet,
+				     (const unsigned char *)&psa->u.sa_in.sin_addr,
+				     32, ntohs(psa->u.sa_in.sin_port));
+		break;
+#if SYDBOX_HAVE_IPV6
+	case AF_INET6:
+		best = acl_lpm_match(&c->inet6,
+				     (const unsigned char *)&psa->u.sa6.sin6_addr,
+				     128, ntohs(psa->u.sa6.sin6_port));
+		break;
+#endif
+	default:
+		best = -1;
+		break;
 	}
 
-	return acl_check(defaction, node_match, match);
+	return acl_check(defaction, best >= 0 ? c->nodes[best] : NULL, match);
 }
 
 unsigned acl_sockmatch_saun(enum acl_action defaction, const aclq_t *aclq,
 			    const void *needle, struct acl_node **match)
 {
-	struct acl_node *node, *node_match;
+	int best;
+	const struct acl_compiled *c;
 	const char *abspath = needle;
 
-	if (!aclq || !needle)
+	if (!aclq || !needle || ACLQ_EMPTY(aclq))
 		return acl_default(defaction, match);
 
 	/* The last matching pattern decides */
-	node_match = NULL;
-	ACLQ_FOREACH(node, aclq) {
-		struct sockmatch *m = node->match;
-		if (m->family != AF_UNIX || m->addr.sa_un.abstract)
-			continue;
-		if (pathmatch(m->addr.sa_un.path, abspath))
-			node_match = node;
-	}
+	c = acl_sock_compiled(aclq);
+	best = acl_saun_match(c, false, abspath, -1);
 
-	return acl_check(defaction, node_match, match);
+	return acl_check(defaction, best >= 0 ? c->nodes[best] : NULL, match);
 }
 
 bool acl_match_path(enum acl_action defaction, const aclq_t *aclq,
@@ -167,6 +647,7 @@ int acl_append_pathmatch(enum acl_action action, const char *pattern, aclq_t *ac
 		node->match = xstrdup(list[c]);
 		ACLQ_INSERT_TAIL(aclq, node);
 	}
+	acl_uncompile(aclq);
 
 	for (; f >= 0; f--)
 		free(list[f]);
@@ -197,6 +678,7 @@ int acl_remove_pathmatch(enum acl_action action, const char *pattern, aclq_t *ac
 			}
 		}
 	}
+	acl_uncompile(aclq);
 
 	for (; f >= 0; f--)
 		free(list[f]);
@@ -238,6 +720,7 @@ int acl_append_sockmatch(enum acl_action action, const char *pattern, aclq_t *ac
 	}
 
 out:
+	acl_uncompile(aclq);
 	for (; f >= 0; f--)
 		free(list[f]);
 	free(list);
@@ -270,6 +753,7 @@ int acl_remove_sockmatch(enum acl_action action, const char *pattern, aclq_t *ac
 			}
 		}
 	}
+	acl_uncompile(aclq);
 
 	for (; f > 0; f--)
 		free(list[f]);
@@ -277,3 +761,45 @@ int acl_remove_sockmatch(enum acl_action action, const char *pattern, aclq_t *ac
 
 	return 0;
 }
+
+/*
+ * Add an automatic entry, e.g. the address of a successful bind(2), unless
+ * an equal entry is there already. Takes ownership of match. The entry
+ * stays until every reference is dropped with acl_release_sockmatch().
+ */
+struct acl_node *acl_retain_sockmatch(enum acl_action action,
+				      struct sockmatch *match, aclq_t *aclq)
+{
+	struct acl_node *node;
+
+	ACLQ_FOREACH(node, aclq) {
+		if (node->action == action && sockmatch_equal(node->match, match)) {
+			free_sockmatch(match);
+			node->refcnt++;
+			return node;
+		}
+	}
+
+	node = xcalloc(1, sizeof(struct acl_node));
+	node->action = action;
+	node->match = match;
+	node->refcnt = 1;
+	ACLQ_INSERT_TAIL(aclq, node);
+	acl_uncompile(aclq);
+	return node;
+}
+
+/* Returns true if the last reference was dropped and the entry removed. */
+bool acl_release_sockmatch(struct acl_node *node, aclq_t *aclq)
+{
+	assert(node->refcnt > 0);
+
+	if (--node->refcnt > 0)
+		return false;
+
+	ACLQ_REMOVE(aclq, node);
+	acl_uncompile(aclq);
+	free_sockmatch(node->match);
+	free(node);
+	return true;
+}
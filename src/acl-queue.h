@@ -36,9 +36,22 @@ DEFINE_STRING_TABLE_LOOKUP(acl_action, int)
 struct acl_node {
 	enum acl_action action;
 	void *match;
+	unsigned refcnt; /* sockets holding an automatic entry */
 	TAILQ_ENTRY(acl_node) link;
 };
-TAILQ_HEAD(acl_queue, acl_node);
+struct acl_compiled;
+struct acl_queue {
+	struct acl_node *tqh_first;	/* first element */
+	struct acl_node **tqh_last;	/* addr of last next element */
+
+	/*
+	 * Queues are compiled on first match, path queues into a prefix trie
+	 * and socket queues into per family prefix trees, and the compiled
+	 * form is thrown away when the queue is edited, see acl_pathmatch()
+	 * and acl_sockmatch().
+	 */
+	struct acl_compiled *compiled;
+};
 typedef struct acl_queue aclq_t;
 
 unsigned acl_pathmatch(enum acl_action defaction, const aclq_t *aclq,
@@ -57,6 +70,12 @@ int acl_append_pathmatch(enum acl_action action, const char *pattern, aclq_t *ac
 int acl_remove_pathmatch(enum acl_action action, const char *pattern, aclq_t *aclq);
 int acl_append_sockmatch(enum acl_action action, const char *pattern, aclq_t *aclq);
 int acl_remove_sockmatch(enum acl_action action, const char *pattern, aclq_t *aclq);
+struct acl_node *acl_retain_sockmatch(enum acl_action action,
+				      struct sockmatch *match, aclq_t *aclq);
+bool acl_release_sockmatch(struct acl_node *node, aclq_t *aclq);
+void acl_uncompile(aclq_t *aclq);
+void acl_compile_pathq(aclq_t *aclq);
+void acl_compile_sockq(aclq_t *aclq);
 
 #define ACLQ_FIRST	TAILQ_FIRST
 #define ACLQ_END	TAILQ_END
@@ -72,7 +91,11 @@ int acl_remove_sockmatch(enum acl_action action, const char *pattern, aclq_t *ac
 	TAILQ_FOREACH_REVERSE((var), (head), acl_node, link)
 #define ACLQ_FOREACH_REVERSE_SAFE(var, head, tvar) \
 	TAILQ_FOREACH_REVERSE_SAFE((var), (head), acl_node, link, (tvar))
-#define ACLQ_INIT	TAILQ_INIT
+#define ACLQ_INIT(head) \
+	do { \
+		TAILQ_INIT((head)); \
+		(head)->compiled = NULL; \
+	} while (0)
 #define ACLQ_INSERT_HEAD(head, elm) \
 	TAILQ_INSERT_HEAD((head), (elm), link)
 #define ACLQ_INSERT_TAIL(head, elm) \
@@ -92,11 +115,13 @@ int acl_remove_sockmatch(enum acl_action action, const char *pattern, aclq_t *ac
 			(newvar)->match = (copymatch)(var->match); \
 			ACLQ_INSERT_TAIL((newhead), (newvar)); \
 		} \
+		acl_uncompile((newhead)); \
 	} while (0)
 
 #define ACLQ_FREE(var, head, freematch) \
 	do { \
 		struct acl_node *tvar; \
+		acl_uncompile((head)); \
 		ACLQ_FOREACH_SAFE((var), (head), tvar) { \
 			ACLQ_REMOVE((head), (var)); \
 			if ((var)->match) \
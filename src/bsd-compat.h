@@ -8,12 +8,19 @@
 #ifndef BSD_COMPAT_H
 #define BSD_COMPAT_H
 
+#include <stdbool.h>
+
 #define RPATH_EXIST		0 /* all components must exist */
 #define RPATH_NOLAST		1 /* all but last component must exist */
 #define RPATH_NOFOLLOW		4 /* do not expand symbolic links */
+#define RPATH_MODIFY		8 /* last component is about to change */
+#define RPATH_MODIFY_TREE	16 /* ...and everything below it */
+#define RPATH_NOCACHE		32 /* bypass the resolution cache, thread safe */
 #define RPATH_MASK		(RPATH_EXIST|RPATH_NOLAST)
 
 int realpath_mode(const char * restrict path, unsigned mode, char **buf);
+void realpath_cache_drop(const char *path, bool tree);
+void realpath_cache_free(void);
 
 size_t strlcat(char * restrict dst, const char * restrict src, size_t siz);
 size_t strlcpy(char * restrict dst, const char * restrict src, size_t siz);
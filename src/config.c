@@ -39,15 +39,23 @@ void config_init(void)
 	/* set sane defaults for configuration */
 	sydbox->config.follow_fork = true;
 	sydbox->config.exit_kill = false;
+	sydbox->config.sandbox_lock = false;
+	sydbox->config.magic_stat = true;
 	sydbox->config.use_seccomp = false;
 	sydbox->config.use_seize = false;
+	sydbox->config.use_notify = false;
+	sydbox->config.use_fd_cache = false;
 	sydbox->config.use_toolong_hack = false;
+	sydbox->config.worker_threads = 0;
+	sydbox->config.tracer_threads = 1;
 	sydbox->config.whitelist_per_process_directories = true;
 	sydbox->config.whitelist_successful_bind = true;
 	sydbox->config.whitelist_unsupported_socket_families = true;
 	sydbox->config.violation_decision = VIOLATION_DENY;
 	sydbox->config.violation_exit_code = -1;
 	sydbox->config.box_static.magic_lock = LOCK_UNSET;
+	sydbox->config.box_static.refcnt = 1; /* never freed */
+	sydbox->config.box_static.version = syd_counter_inc(sydbox->sandbox_version);
 
 	/* initialize access control lists */
 	sydbox->config.hh_proc_pid_auto = NULL;
@@ -71,6 +79,20 @@ void config_done(void)
 	sydbox->config.magic_core_allow = true;
 }
 
+/*
+ * Prepare the global lists to be matched by more than one tracer thread.
+ * They are not edited after startup then, see magic_cast().
+ */
+void config_share(void)
+{
+	acl_compile_pathq(&sydbox->config.exec_kill_if_match);
+	acl_compile_pathq(&sydbox->config.exec_resume_if_match);
+	acl_compile_pathq(&sydbox->config.filter_exec);
+	acl_compile_pathq(&sydbox->config.filter_read);
+	acl_compile_pathq(&sydbox->config.filter_write);
+	acl_compile_sockq(&sydbox->config.filter_network);
+}
+
 void config_parse_file(const char *filename)
 {
 	int r;
@@ -607,13 +607,17 @@ static void dump_sandbox(const sandbox_t *box)
 		J(write)"%s,"
 		J(network)"%s,"
 		J(magic_lock)"%u,"
-		J(magic_lock_name)"\"%s\"",
+		J(magic_lock_name)"\"%s\","
+		J(refcnt)"%u,"
+		J(version)"%lu",
 		J_BOOL(box->sandbox_exec),
 		J_BOOL(box->sandbox_read),
 		J_BOOL(box->sandbox_write),
 		J_BOOL(box->sandbox_network),
 		box->magic_lock,
-		lock_state_to_string(box->magic_lock));
+		lock_state_to_string(box->magic_lock),
+		box->refcnt,
+		box->version);
 
 	fprintf(fp, ","J(exec_whitelist)"");
 	dump_aclq(&box->acl_exec, dump_quoted);
@@ -803,20 +807,26 @@ void dump(enum dump what, ...)
 
 		fprintf(fp, "}");
 	} else if (what == DUMP_WAIT) {
+		static unsigned long last_syscalls;
 		pid_t pid = va_arg(ap, pid_t);
 		int status = va_arg(ap, int);
 		int wait_errno = va_arg(ap, int);
+		unsigned long loop_syscalls = va_arg(ap, unsigned long);
 
+		/* syscalls: waits and resumes since the last wait */
 		fprintf(fp, "{"
 			J(id)"%llu,"
 			J(time)"%llu,"
 			J(event)"%u,"
 			J(event_name)"\"%s\","
 			J(pid)"%d,"
-			J(process_count)"%d",
+			J(process_count)"%d,"
+			J(syscalls)"%lu",
 			id++, (unsigned long long)now,
 			DUMP_WAIT, "wait",
-			pid, process_count());
+			pid, process_count(),
+			loop_syscalls - last_syscalls);
+		last_syscalls = loop_syscalls;
 
 		fprintf(fp, ","J(status));
 		if (wait_errno == 0)
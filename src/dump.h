@@ -31,7 +31,7 @@ enum dump {
 	DUMP_FLUSH,
 	DUMP_ASSERT, /* assertion failed */
 	DUMP_INTERRUPT, /* interrupted */
-	DUMP_WAIT, /* waitpid(2) */
+	DUMP_WAIT, /* waitpid(2), with the number of waits and resumes so far */
 	DUMP_PINK, /* calls to pinktrace */
 	DUMP_THREAD_NEW, /* new_thread() */
 	DUMP_THREAD_FREE, /* free_process() */
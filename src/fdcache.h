@@ -0,0 +1,108 @@
+/*
+ * sydbox/fdcache.h
+ *
+ * save/query paths of file descriptors
+ *
+ * Copyright (c) 2013 Ali Polatel <alip@exherbo.org>
+ * Released under the terms of the 3-clause BSD license
+ */
+
+#ifndef FDCACHE_H
+#define FDCACHE_H 1
+
+#include <stdlib.h>
+#include <time.h>
+#include "sydconf.h"
+#include "xfunc.h"
+#include "sydhash.h"
+
+struct fdcache {
+	int fd;
+	char *path;
+	unsigned long generation;
+	time_t stamp;
+	UT_hash_handle hh;
+};
+
+static inline void fdcache_del(struct fdcache **map, struct fdcache *f)
+{
+	HASH_DEL(*map, f);
+	free(f->path);
+	free(f);
+}
+
+static inline void fdcache_add(struct fdcache **map, int fd, const char *path,
+			       unsigned long generation, time_t now)
+{
+	struct fdcache *f;
+
+	HASH_FIND_INT(*map, &fd, f);
+	if (f)
+		fdcache_del(map, f);
+
+	f = xmalloc(sizeof(struct fdcache));
+	f->fd = fd;
+	f->path = xstrdup(path);
+	f->generation = generation;
+	f->stamp = now;
+	HASH_ADD_INT(*map, fd, f);
+}
+
+static inline const char *fdcache_find(struct fdcache **map, int fd,
+				       unsigned long generation, time_t now)
+{
+	struct fdcache *f;
+
+	if (!*map)
+		return NULL;
+
+	HASH_FIND_INT(*map, &fd, f);
+	if (!f)
+		return NULL;
+	if (f->generation != generation ||
+	    now - f->stamp >= SYDBOX_FD_CACHE_TTL) {
+		fdcache_del(map, f);
+		return NULL;
+	}
+	return f->path;
+}
+
+static inline void fdcache_remove(struct fdcache **map, int fd)
+{
+	struct fdcache *f;
+
+	if (!*map)
+		return;
+
+	HASH_FIND_INT(*map, &fd, f);
+	if (f)
+		fdcache_del(map, f);
+}
+
+static inline void fdcache_remove_range(struct fdcache **map,
+					unsigned first, unsigned last)
+{
+	struct fdcache *e, *t;
+
+	if (!*map)
+		return;
+
+	HASH_ITER(hh, *map, e, t) {
+		if ((unsigned)e->fd >= first && (unsigned)e->fd <= last)
+			fdcache_del(map, e);
+	}
+}
+
+static inline void fdcache_destroy(struct fdcache **map)
+{
+	struct fdcache *e, *t;
+
+	if (!*map)
+		return;
+
+	HASH_ITER(hh, *map, e, t)
+		fdcache_del(map, e);
+	HASH_CLEAR(hh, *map);
+}
+
+#endif
@@ -6,7 +6,7 @@
 from __future__ import print_function
 
 import os, sys, shlex
-import re, subprocess, timeit, warnings
+import re, subprocess, tempfile, timeit, warnings
 
 SYDBOX_OPTIONS = list()
 
@@ -25,6 +25,27 @@ def test():
         try: os.stat("/dev/sydbox/1")
         except: pass
 """),
+        ("read and write /dev/null (untraced)",
+"""
+def test():
+    fd = os.open("/dev/null", os.O_RDWR)
+    for i in range(@LOOP_COUNT@):
+        os.read(fd, 1)
+        os.write(fd, b"1")
+    os.close(fd)
+""", False, 100000), # no threads, filter cost per system call
+        ("fork storm with 2000 whitelist rules",
+"""
+def test():
+    for i in range(2000):
+        try: os.stat("/dev/sydbox/whitelist/write+/kingbee/%d/***" % i)
+        except: pass
+    for i in range(@LOOP_COUNT@):
+        pid = os.fork()
+        if pid == 0:
+            os._exit(0)
+        os.waitpid(pid, 0)
+""", False, 2000), # no threads, cost of sharing the sandbox per fork
         ("fork and kill parent",
 """
 def test():
@@ -208,13 +229,47 @@ def find_strace():
         if os.environ['STRACE'] != '1':
             STRACE_OPTS.extend(shlex.split(os.environ['STRACE']))
 
+PTRACE_COUNT = None
+def find_ptrace_count():
+    global PTRACE_COUNT
+
+    if 'PTRACE_COUNT' in os.environ and os.environ['PTRACE_COUNT'] != '0':
+        PTRACE_COUNT = which("strace")
+        if PTRACE_COUNT is None:
+            warnings.warn("strace not found, can not count ptrace calls", RuntimeWarning)
+
+    if PTRACE_COUNT is not None:
+        print("counting ptrace calls with `%s'" % PTRACE_COUNT)
+
+def count_ptrace(expr, syd_opts):
+    """ Count ptrace(2) calls of sydbox per ptrace stop (i.e. wait4(2) returning a pid) """
+    fd, out = tempfile.mkstemp(prefix="kingbee-")
+    os.close(fd)
+    eval_ext(expr, syd=SYDBOX, syd_opts=syd_opts,
+             wrap=[PTRACE_COUNT, "-c", "-o", out, "-e", "trace=ptrace,wait4"])
+
+    calls = dict()
+    with open(out) as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) < 5 or fields[-1] not in ("ptrace", "wait4"):
+                continue
+            errors = int(fields[4]) if len(fields) == 6 else 0
+            calls[fields[-1]] = (int(fields[3]), errors)
+    os.unlink(out)
+
+    ptrace_calls = calls.get("ptrace", (0, 0))[0]
+    stops = calls.get("wait4", (0, 0))[0] - calls.get("wait4", (0, 0))[1]
+    return ptrace_calls, stops
+
 def eval_ext(expr,
              syd=None, syd_opts=[],
              gdb=None, gdb_opts=[],
              strace=None, strace_opts=[],
-             valgrind=None, valgrind_opts=[]):
+             valgrind=None, valgrind_opts=[],
+             wrap=[]):
     """ Call python to evaluate an expr, optionally under sydbox """
-    args = list()
+    args = list(wrap)
 
     if gdb is not None or valgrind is not None:
         args.append('libtool')
@@ -318,6 +373,11 @@ def run_test(name, expr, loops=100, threaded=True):
                                                                choice[0],
                                                                choice[1],
                                                                t))
+        if PTRACE_COUNT is not None:
+            calls, stops = count_ptrace(expr_loop, [opt_seize, opt_seccomp])
+            print("\t%d: sydbox [seize:%d, seccomp:%d]: %d ptrace calls in %d stops: %.2f per stop" %
+                    (test_no, choice[0], choice[1], calls, stops,
+                     float(calls) / stops if stops else 0.0))
         if STRACE is not None:
             print("\t%d: under strace" % (test_no))
             eval_ext(expr_once, syd=SYDBOX, syd_opts=[opt_seize, opt_seccomp],
@@ -339,6 +399,7 @@ def main(argv):
     find_sydbox()
     find_gdb()
     find_strace()
+    find_ptrace_count()
     find_valgrind()
 
     match = None
@@ -92,6 +92,11 @@ int magic_cmd_exec(const void *val, syd_process_t *current)
 	pid_t childpid;
 	int err_no, status;
 
+	if ((r = update_cwd(current)) < 0) {
+		r = deny(current, -r);
+		goto out;
+	}
+
 	childpid = fork();
 	if (childpid < 0) {
 		err_no = execve_errno(errno);
@@ -17,6 +17,7 @@
 int magic_set_match_case_sensitive(const void *val, syd_process_t *current)
 {
 	pathmatch_set_case(PTR_TO_BOOL(val));
+	box_cache_flush();
 	return 0;
 }
 
@@ -20,6 +20,22 @@ enum sandbox_type {
 	SANDBOX_NETWORK,
 };
 
+static unsigned sandbox_type_flag(enum sandbox_type t)
+{
+	switch (t) {
+	case SANDBOX_EXEC:
+		return SYD_SANDBOX_EXEC;
+	case SANDBOX_READ:
+		return SYD_SANDBOX_READ;
+	case SANDBOX_WRITE:
+		return SYD_SANDBOX_WRITE;
+	case SANDBOX_NETWORK:
+		return SYD_SANDBOX_NETWORK;
+	default:
+		assert_not_reached();
+	}
+}
+
 static int magic_query_sandbox(enum sandbox_type t, syd_process_t *current)
 {
 	enum sandbox_mode mode;
@@ -54,8 +70,10 @@ static int magic_set_sandbox(enum sandbox_type t, const char *str, syd_process_t
 	r = sandbox_mode_from_string(str);
 	if (r < 0)
 		return MAGIC_RET_INVALID_VALUE;
+	if (r != SANDBOX_OFF && sydbox->sandbox_locked & sandbox_type_flag(t))
+		return MAGIC_RET_NOPERM;
 
-	box = box_current(current);
+	box = box_unshare(current);
 	switch (t) {
 	case SANDBOX_EXEC:
 		box->sandbox_exec = r;
@@ -77,6 +77,39 @@ int magic_query_trace_use_seize(syd_process_t *current)
 #endif
 }
 
+int magic_set_trace_use_notify(const void *val, syd_process_t *current)
+{
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+	sydbox->config.use_notify = PTR_TO_BOOL(val);
+#else
+	say("seccomp user notification not supported, ignoring magic");
+#endif
+	return MAGIC_RET_OK;
+}
+
+int magic_query_trace_use_notify(syd_process_t *current)
+{
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+	return sydbox->config.use_notify;
+#else
+	return MAGIC_RET_NOT_SUPPORTED;
+#endif
+}
+
+int magic_set_trace_use_fd_cache(const void *val, syd_process_t *current)
+{
+	/* The system calls to trap are decided before the first execve(2). */
+	if (current)
+		return MAGIC_RET_INVALID_OPERATION;
+	sydbox->config.use_fd_cache = PTR_TO_BOOL(val);
+	return MAGIC_RET_OK;
+}
+
+int magic_query_trace_use_fd_cache(syd_process_t *current)
+{
+	return MAGIC_BOOL(sydbox->config.use_fd_cache);
+}
+
 int magic_set_trace_use_toolong_hack(const void *val, syd_process_t *current)
 {
 	sydbox->config.use_toolong_hack = PTR_TO_BOOL(val);
@@ -88,11 +121,37 @@ int magic_query_trace_use_toolong_hack(syd_process_t *current)
 	return sydbox->config.use_toolong_hack;
 }
 
+int magic_set_trace_worker_threads(const void *val, syd_process_t *current)
+{
+	int count = PTR_TO_INT(val);
+
+	/* The workers are started before the first execve(2). */
+	if (current)
+		return MAGIC_RET_INVALID_OPERATION;
+	if (count < 0 || count > SYDBOX_WORKER_THREADS_MAX)
+		return MAGIC_RET_INVALID_VALUE;
+	sydbox->config.worker_threads = count;
+	return MAGIC_RET_OK;
+}
+
+int magic_set_trace_tracer_threads(const void *val, syd_process_t *current)
+{
+	int count = PTR_TO_INT(val);
+
+	/* The tracers are started before the first execve(2). */
+	if (current)
+		return MAGIC_RET_INVALID_OPERATION;
+	if (count < 1 || count > SYDBOX_TRACER_THREADS_MAX)
+		return MAGIC_RET_INVALID_VALUE;
+	sydbox->config.tracer_threads = count;
+	return MAGIC_RET_OK;
+}
+
 int magic_set_trace_magic_lock(const void *val, syd_process_t *current)
 {
 	int l;
 	const char *str = val;
-	sandbox_t *box = box_current(current);
+	sandbox_t *box = box_unshare(current);
 
 	l = lock_state_from_string(str);
 	if (l < 0)
@@ -101,3 +160,25 @@ int magic_set_trace_magic_lock(const void *val, syd_process_t *current)
 	box->magic_lock = (enum lock_state)l;
 	return MAGIC_RET_OK;
 }
+
+int magic_set_trace_sandbox_lock(const void *val, syd_process_t *current)
+{
+	sydbox->config.sandbox_lock = PTR_TO_BOOL(val);
+	return MAGIC_RET_OK;
+}
+
+int magic_query_trace_sandbox_lock(syd_process_t *current)
+{
+	return MAGIC_BOOL(sydbox->config.sandbox_lock);
+}
+
+int magic_set_trace_magic_stat(const void *val, syd_process_t *current)
+{
+	sydbox->config.magic_stat = PTR_TO_BOOL(val);
+	return MAGIC_RET_OK;
+}
+
+int magic_query_trace_magic_stat(syd_process_t *current)
+{
+	return MAGIC_BOOL(sydbox->config.magic_stat);
+}
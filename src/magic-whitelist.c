@@ -16,6 +16,7 @@
 int magic_set_whitelist_ppd(const void *val, syd_process_t *current)
 {
 	sydbox->config.whitelist_per_process_directories = PTR_TO_BOOL(val);
+	box_cache_flush();
 	return MAGIC_RET_OK;
 }
 
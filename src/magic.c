@@ -276,6 +276,22 @@ static const struct key key_table[] = {
 		.type   = MAGIC_TYPE_STRING,
 		.set    = magic_set_trace_magic_lock,
 	},
+	[MAGIC_KEY_CORE_TRACE_SANDBOX_LOCK] = {
+		.name   = "sandbox_lock",
+		.lname  = "core.trace.sandbox_lock",
+		.parent = MAGIC_KEY_CORE_TRACE,
+		.type   = MAGIC_TYPE_BOOLEAN,
+		.set    = magic_set_trace_sandbox_lock,
+		.query  = magic_query_trace_sandbox_lock,
+	},
+	[MAGIC_KEY_CORE_TRACE_MAGIC_STAT] = {
+		.name   = "magic_stat",
+		.lname  = "core.trace.magic_stat",
+		.parent = MAGIC_KEY_CORE_TRACE,
+		.type   = MAGIC_TYPE_BOOLEAN,
+		.set    = magic_set_trace_magic_stat,
+		.query  = magic_query_trace_magic_stat,
+	},
 	[MAGIC_KEY_CORE_TRACE_USE_SECCOMP] = {
 		.name   = "use_seccomp",
 		.lname  = "core.trace.use_seccomp",
@@ -292,6 +308,22 @@ static const struct key key_table[] = {
 		.set    = magic_set_trace_use_seize,
 		.query  = magic_query_trace_use_seize,
 	},
+	[MAGIC_KEY_CORE_TRACE_USE_NOTIFY] = {
+		.name   = "use_notify",
+		.lname  = "core.trace.use_notify",
+		.parent = MAGIC_KEY_CORE_TRACE,
+		.type   = MAGIC_TYPE_BOOLEAN,
+		.set    = magic_set_trace_use_notify,
+		.query  = magic_query_trace_use_notify,
+	},
+	[MAGIC_KEY_CORE_TRACE_USE_FD_CACHE] = {
+		.name   = "use_fd_cache",
+		.lname  = "core.trace.use_fd_cache",
+		.parent = MAGIC_KEY_CORE_TRACE,
+		.type   = MAGIC_TYPE_BOOLEAN,
+		.set    = magic_set_trace_use_fd_cache,
+		.query  = magic_query_trace_use_fd_cache,
+	},
 	[MAGIC_KEY_CORE_TRACE_USE_TOOLONG_HACK] = {
 		.name   = "use_toolong_hack",
 		.lname  = "core.trace.use_toolong_hack",
@@ -300,6 +332,20 @@ static const struct key key_table[] = {
 		.set    = magic_set_trace_use_toolong_hack,
 		.query  = magic_query_trace_use_toolong_hack,
 	},
+	[MAGIC_KEY_CORE_TRACE_WORKER_THREADS] = {
+		.name   = "worker_threads",
+		.lname  = "core.trace.worker_threads",
+		.parent = MAGIC_KEY_CORE_TRACE,
+		.type   = MAGIC_TYPE_INTEGER,
+		.set    = magic_set_trace_worker_threads,
+	},
+	[MAGIC_KEY_CORE_TRACE_TRACER_THREADS] = {
+		.name   = "tracer_threads",
+		.lname  = "core.trace.tracer_threads",
+		.parent = MAGIC_KEY_CORE_TRACE,
+		.type   = MAGIC_TYPE_INTEGER,
+		.set    = magic_set_trace_tracer_threads,
+	},
 
 	[MAGIC_KEY_EXEC_KILL_IF_MATCH] = {
 		.name   = "kill_if_match",
@@ -591,6 +637,22 @@ static int magic_ok(struct key entry, enum magic_op op)
 	return MAGIC_RET_OK;
 }
 
+/* Does the key edit the sandbox of the process rather than a global setting? */
+static bool magic_per_process(enum magic_key key)
+{
+	enum magic_key k;
+
+	if (key == MAGIC_KEY_CORE_TRACE_MAGIC_LOCK)
+		return true;
+	for (k = key; k != MAGIC_KEY_NONE; k = key_table[k].parent) {
+		if (k == MAGIC_KEY_CORE_SANDBOX ||
+		    k == MAGIC_KEY_WHITELIST ||
+		    k == MAGIC_KEY_BLACKLIST)
+			return true;
+	}
+	return false;
+}
+
 int magic_cast(syd_process_t *current, enum magic_op op, enum magic_key key, const void *val)
 {
 	int r;
@@ -604,6 +666,12 @@ int magic_cast(syd_process_t *current, enum magic_op op, enum magic_key key, con
 	if (r != MAGIC_RET_OK)
 		return r;
 
+	/* Global settings are read without locks by the tracer threads. */
+	if (current && multi_tracer() &&
+	    op != MAGIC_OP_QUERY && op != MAGIC_OP_EXEC &&
+	    !magic_per_process(key))
+		return MAGIC_RET_INVALID_OPERATION;
+
 	switch (op) {
 	case MAGIC_OP_SET:
 		return entry.set(val, current);
@@ -94,16 +94,61 @@ int kill_one(syd_process_t *node, int fatal_sig)
 	return r;
 }
 
+/* Children kept stopped until the clone event of their parent, see trace() */
+static void kill_early_children(syd_tracer_t *t)
+{
+	unsigned i;
+	void *status;
+
+	pidmap_iter(&t->early_children, i, status)
+		pink_trace_kill(pidmap_pid_at(&t->early_children, i), 0, SIGKILL);
+}
+
+/*
+ * With more than one tracer thread the first caller kills the processes of
+ * all threads and exits without cleaning up, other threads block here.
+ */
+static void kill_all_tracers(int fatal_sig)
+{
+	static bool killing;
+	unsigned i, j;
+	syd_tracer_t *t;
+	syd_process_t *node;
+
+	if (__atomic_test_and_set(&killing, __ATOMIC_ACQ_REL)) {
+		for (;;)
+			pause();
+	}
+
+	for (i = 0; i < sydbox->tracer_count; i++) {
+		t = &sydbox->tracers[i];
+		if (t != tracer)
+			tracer_lock(t);
+		pidmap_iter(&t->proctab, j, node)
+			kill_one(node, fatal_sig);
+		kill_early_children(t);
+		if (t != tracer)
+			tracer_unlock(t);
+	}
+	exit(fatal_sig);
+}
+
 void kill_all(int fatal_sig)
 {
-	syd_process_t *node, *tmp;
+	unsigned i;
+	syd_process_t *node;
 
 	if (!sydbox)
 		return;
+	if (multi_tracer())
+		kill_all_tracers(fatal_sig);
 
-	process_iter(node, tmp) {
-		if (kill_one(node, fatal_sig) == -ESRCH)
-			remove_process_node(node);
+	if (tracer) { /* not before startup */
+		process_iter(node, i) {
+			if (kill_one(node, fatal_sig) == -ESRCH)
+				remove_process_node(node);
+		}
+		kill_early_children(tracer);
 	}
 	cleanup();
 	exit(fatal_sig);
@@ -178,7 +223,7 @@ int violation(syd_process_t *current, const char *fmt, ...)
 {
 	va_list ap;
 
-	sydbox->violation = true;
+	__atomic_store_n(&sydbox->violation, true, __ATOMIC_RELAXED);
 
 	va_start(ap, fmt);
 	report(current, fmt, ap);
@@ -10,12 +10,14 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
+#include <time.h>
 #include "pink.h"
 #include "xfunc.h"
 
 #include <syd.h>
 
-/* Decode the path at the given index and place it in buf.
+/* Decode the path at the given index and place it in buf, which is to be
+ * freed with scratch_free().
  * Handles panic()
  * Returns:
  * -errno : Negated errno indicating error code
@@ -43,13 +45,69 @@ int path_decode(syd_process_t *current, unsigned arg_index, char **buf)
 		}
 		return -errno;
 	}
-	*buf = xstrdup(path);
+	*buf = scratch_strdup(path);
 	return 0;
 }
 
+/* Decode the paths at the given indexes with a single bulk read, for system
+ * calls with more than one path argument. buf[i] is NULL if the argument is
+ * NULL (or could not be read).
+ * Handles panic()
+ * Returns:
+ * -errno : Negated errno indicating error code
+ *  0     : Successful run
+ */
+int path_decode_many(syd_process_t *current, const unsigned *arg_index,
+		     char **buf, unsigned count)
+{
+	int r;
+	unsigned i;
+	long addr[PATH_DECODE_MAX];
+	ssize_t count_read[PATH_DECODE_MAX];
+	char path[PATH_DECODE_MAX][SYDBOX_PATH_MAX];
+	char *dest[PATH_DECODE_MAX];
+
+	assert(current);
+	assert(buf);
+	BUG_ON(count <= PATH_DECODE_MAX);
+
+	if (!count)
+		return 0;
+	for (i = 0; i < count; i++) {
+		buf[i] = NULL;
+		if ((r = syd_read_argument(current, arg_index[i], &addr[i])) < 0)
+			return r;
+		dest[i] = path[i];
+	}
+
+	/* syd_read_strings() handles panic() and partial reads */
+	if ((r = syd_read_strings(current, addr, dest, SYDBOX_PATH_MAX,
+				  count_read, count)) < 0)
+		return r;
+	for (i = 0; i < count; i++) {
+		if (count_read[i] >= 0)
+			buf[i] = scratch_strdup(path[i]);
+	}
+	return 0;
+}
+
+static time_t fdcache_now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) < 0)
+		return 0;
+	return ts.tv_sec;
+}
+
 /*
  * Resolve the prefix of an at-suffixed function.
  * Handles panic()
+ * The path of the directory file descriptor is placed in buf, NULL for
+ * AT_FDCWD, to be freed with scratch_free(). With core/trace/use_fd_cache
+ * the paths are remembered in the file descriptor table of the process
+ * until the descriptor is closed or replaced so that most `at' suffixed
+ * calls need no readlink of /proc.
  * Returns:
  * -errno : Negated errno indicating error code
  *  0     : Successful run
@@ -57,26 +115,48 @@ int path_decode(syd_process_t *current, unsigned arg_index, char **buf)
 int path_prefix(syd_process_t *current, unsigned arg_index, char **buf)
 {
 	int r, fd;
+	bool cache;
+	time_t now = 0;
+	unsigned long generation = 0;
+	const char *cached;
 	char *prefix = NULL;
 
 	if ((r = syd_read_argument_int(current, arg_index, &fd)) < 0)
 		return r;
 
-	r = 0;
 	if (fd == AT_FDCWD) {
 		*buf = NULL;
+		return 0;
 	} else if (fd < 0) {
 		*buf = NULL;
-		r = -EBADF;
-	} else {
-		if ((r = syd_proc_fd_path(current->pid, fd, &prefix)) < 0) {
-			say("readlink /proc/%u/fd/%d failed (errno:%d %s)",
-			    current->pid, fd, -r, strerror(-r));
-			if (r == -ENOENT)
-				r = -EBADF; /* correct errno */
-		} else {
-			*buf = prefix;
+		return -EBADF;
+	}
+
+	cache = sydbox->config.use_fd_cache && !P_FDCACHE_OFF(current);
+	if (cache) {
+		now = fdcache_now();
+		/* read before the lookup, renames may happen meanwhile */
+		generation = syd_counter_get(sydbox->fd_cache_generation);
+		cached = fdcache_find(&P_FDCACHE(current), fd, generation, now);
+		if (cached) {
+			tracer->fd_cache_hit++;
+			*buf = scratch_strdup(cached);
+			return 0;
 		}
+		tracer->fd_cache_miss++;
+	}
+
+	if ((r = syd_proc_fd_path(current->pid, fd, &prefix)) < 0) {
+		say("readlink /proc/%u/fd/%d failed (errno:%d %s)",
+		    current->pid, fd, -r, strerror(-r));
+		if (r == -ENOENT)
+			r = -EBADF; /* correct errno */
+	} else {
+		/* fds may be closed or replaced meanwhile, see fdcache_busy() */
+		if (cache && prefix[0] == '/' && !P_FDCACHE_BUSY(current))
+			fdcache_add(&P_FDCACHE(current), fd, prefix,
+				    generation, now);
+		*buf = prefix;
 	}
 
 	return r;
@@ -10,7 +10,12 @@
 
 #include "sydbox.h"
 
+/* Maximum number of paths decoded at once */
+#define PATH_DECODE_MAX 2
+
 int path_decode(syd_process_t *current, unsigned arg_index, char **buf);
+int path_decode_many(syd_process_t *current, const unsigned *arg_index,
+		     char **buf, unsigned count);
 int path_prefix(syd_process_t *current, unsigned arg_index, char **buf);
 
 #endif
@@ -0,0 +1,149 @@
+/*
+ * sydbox/pidmap.c
+ *
+ * Open addressing hash table keyed by process ID
+ *
+ * Copyright (c) 2015 Ali Polatel <alip@exherbo.org>
+ * Released under the terms of the 3-clause BSD license
+ */
+
+#include "pidmap.h"
+
+#include <stdlib.h>
+#include "xfunc.h"
+
+/*
+ * Linear probing over an array of (pid, pointer) pairs: a lookup walks
+ * adjacent slots and only touches the value it returns. Removed entries
+ * leave a mark behind so that removing entries while iterating is safe,
+ * the marks are dropped when the table is rebuilt on insert. The table is
+ * at most three quarters full, counting the marks, and it never shrinks.
+ */
+#define PIDMAP_MIN_SIZE 64
+
+static inline unsigned pidmap_hash(pid_t pid, unsigned mask)
+{
+	unsigned h = (unsigned)pid * 2654435761U;
+
+	return (h ^ (h >> 16)) & mask;
+}
+
+static void pidmap_rebuild(struct pidmap *map, unsigned size)
+{
+	unsigned i, j, mask, old_size;
+	struct pidmap_slot *old;
+
+	old = map->slot;
+	old_size = map->size;
+
+	map->slot = xcalloc(size, sizeof(struct pidmap_slot));
+	map->size = size;
+	map->used = map->count;
+
+	mask = size - 1;
+	for (i = 0; i < old_size; i++) {
+		if (old[i].pid <= 0)
+			continue;
+		for (j = pidmap_hash(old[i].pid, mask);
+		     map->slot[j].pid != 0;
+		     j = (j + 1) & mask)
+			;
+		map->slot[j] = old[i];
+	}
+	free(old);
+}
+
+void pidmap_free(struct pidmap *map)
+{
+	if (map->slot)
+		free(map->slot);
+	map->slot = NULL;
+	map->size = map->count = map->used = 0;
+}
+
+static struct pidmap_slot *pidmap_lookup(const struct pidmap *map, pid_t pid)
+{
+	unsigned i, mask;
+
+	if (!map->size)
+		return NULL;
+
+	mask = map->size - 1;
+	for (i = pidmap_hash(pid, mask); map->slot[i].pid != 0; i = (i + 1) & mask) {
+		if (map->slot[i].pid == pid)
+			return &map->slot[i];
+	}
+	return NULL;
+}
+
+void *pidmap_find(const struct pidmap *map, pid_t pid)
+{
+	struct pidmap_slot *slot;
+
+	slot = pidmap_lookup(map, pid);
+	return slot ? slot->ptr : NULL;
+}
+
+/* Adds an entry or replaces the value of an existing one */
+void pidmap_set(struct pidmap *map, pid_t pid, void *ptr)
+{
+	unsigned i, mask, size;
+	struct pidmap_slot *slot, *dead;
+
+	if ((slot = pidmap_lookup(map, pid))) {
+		slot->ptr = ptr;
+		return;
+	}
+
+	if ((map->used + 1) * 4 > map->size * 3) {
+		if (!map->size)
+			size = PIDMAP_MIN_SIZE;
+		else if ((map->count + 1) * 2 > map->size)
+			size = map->size * 2;
+		else
+			size = map->size; /* just drop the marks */
+		pidmap_rebuild(map, size);
+	}
+
+	dead = NULL;
+	mask = map->size - 1;
+	for (i = pidmap_hash(pid, mask); map->slot[i].pid != 0; i = (i + 1) & mask) {
+		if (map->slot[i].pid == PIDMAP_DELETED) {
+			dead = &map->slot[i];
+			break;
+		}
+	}
+	if (dead) {
+		slot = dead;
+	} else {
+		slot = &map->slot[i];
+		map->used++;
+	}
+	slot->pid = pid;
+	slot->ptr = ptr;
+	map->count++;
+}
+
+/* Removes the entry and returns its value, NULL if there is none */
+void *pidmap_del(struct pidmap *map, pid_t pid)
+{
+	void *ptr;
+	unsigned next;
+	struct pidmap_slot *slot;
+
+	if (!(slot = pidmap_lookup(map, pid)))
+		return NULL;
+
+	ptr = slot->ptr;
+	next = ((slot - map->slot) + 1) & (map->size - 1);
+	if (map->slot[next].pid == 0) {
+		/* end of the probe sequence, no mark needed */
+		slot->pid = 0;
+		map->used--;
+	} else {
+		slot->pid = PIDMAP_DELETED;
+	}
+	slot->ptr = NULL;
+	map->count--;
+	return ptr;
+}
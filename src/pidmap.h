@@ -0,0 +1,54 @@
+/*
+ * sydbox/pidmap.h
+ *
+ * Open addressing hash table keyed by process ID
+ *
+ * Copyright (c) 2015 Ali Polatel <alip@exherbo.org>
+ * Released under the terms of the 3-clause BSD license
+ */
+
+#ifndef PIDMAP_H
+#define PIDMAP_H 1
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct pidmap_slot {
+	pid_t pid; /* 0 if empty, PIDMAP_DELETED if removed */
+	void *ptr;
+};
+#define PIDMAP_DELETED (-1)
+
+struct pidmap {
+	struct pidmap_slot *slot;
+	unsigned size; /* power of two, zero until the first insert */
+	unsigned count; /* entries */
+	unsigned used; /* entries and deleted slots */
+};
+
+void pidmap_free(struct pidmap *map);
+void *pidmap_find(const struct pidmap *map, pid_t pid);
+void pidmap_set(struct pidmap *map, pid_t pid, void *ptr);
+void *pidmap_del(struct pidmap *map, pid_t pid);
+
+/* Value of slot i, NULL if the slot is not in use */
+static inline void *pidmap_at(const struct pidmap *map, unsigned i)
+{
+	return map->slot[i].pid > 0 ? map->slot[i].ptr : NULL;
+}
+
+/* Key of slot i, only meaningful if pidmap_at() is not NULL */
+static inline pid_t pidmap_pid_at(const struct pidmap *map, unsigned i)
+{
+	return map->slot[i].pid;
+}
+
+/*
+ * Iterates over the values, removing entries meanwhile is fine, adding
+ * them is not as the table may be rebuilt.
+ */
+#define pidmap_iter(map, i, p) \
+	for ((i) = 0; (i) < (map)->size; (i)++) \
+		if (((p) = pidmap_at((map), (i))) == NULL) {} else
+
+#endif
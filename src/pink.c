@@ -11,7 +11,11 @@
 #include "pink.h"
 #include "syd.h"
 #include <errno.h>
+#include <stdint.h>
 #include <string.h>
+#include <sys/ptrace.h>
+#include <sys/uio.h>
+#include "seccomp.h"
 
 #define SYD_RETURN_IF_KILLED(current) do { \
 	if (current->flags & SYD_KILLED) { \
@@ -30,6 +34,160 @@ static int syd_check(syd_process_t *current, int retval, const char *func_name,
 }
 #define SYD_CHECK(current, retval) syd_check((current), (retval), __func__, __LINE__)
 
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+/*
+ * seccomp user notification support:
+ * The tracee is not in a ptrace-stop while its notification is served.
+ * System call arguments come from the notification, tracee memory is
+ * accessed with process_vm_readv(2) and the decision is recorded in the
+ * pending response rather than being written to the registers.
+ */
+#define SYD_NOTIFY_ARG(n) ((long)sydbox->notify_req->data.args[(n)])
+
+/*
+ * Check whether the notification is still valid after reading tracee memory.
+ * The tracee may have been interrupted by a signal or killed meanwhile, in
+ * which case its pid may have been reused.
+ */
+static int syd_notify_check(void)
+{
+	if (seccomp_notify_id_valid(sydbox->notify_fd,
+				    sydbox->notify_req->id) < 0)
+		return -ESRCH;
+	return 0;
+}
+#endif
+
+/*
+ * Bulk tracee memory access:
+ * process_vm_readv(2) and process_vm_writev(2) transfer whole buffers, or
+ * several of them, with a single system call where PTRACE_PEEKDATA needs
+ * one per word. If the kernel does not support them (ENOSYS) or refuses
+ * access (EPERM) we fall back to pinktrace which peeks and pokes.
+ */
+#define SYD_VM_CHUNK 4096 /* do not cross page boundaries */
+#define SYD_VM_BATCH 4 /* maximum number of strings read at once */
+
+static bool syd_vm_unsupported;
+
+static ssize_t syd_vm_data(pid_t pid, long addr, char *buf, size_t len,
+			   bool write)
+{
+#ifdef HAVE_PROCESS_VM_READV
+	ssize_t r;
+	struct iovec local, remote;
+
+	if (syd_vm_unsupported)
+		return -ENOSYS;
+
+	local.iov_base = buf;
+	local.iov_len = len;
+	remote.iov_base = (void *)addr;
+	remote.iov_len = len;
+
+	r = write ? process_vm_writev(pid, &local, 1, &remote, 1, 0)
+		  : process_vm_readv(pid, &local, 1, &remote, 1, 0);
+	if (r < 0) {
+		if (errno == ENOSYS)
+			syd_vm_unsupported = true;
+		return -errno;
+	}
+	return r;
+#else
+	return -ENOSYS;
+#endif
+}
+
+/*
+ * Read count NUL-terminated strings of at most len bytes each.
+ * Every round reads the next chunk of all unfinished strings with a single
+ * process_vm_readv(2). The chunks end at page boundaries so a transfer
+ * stops exactly at the first string which faults; the strings after it are
+ * retried in the next round.
+ * On return rlen[i] is the length of the i'th string, or -EFAULT.
+ * Partial reads are truncated and terminated.
+ */
+static int syd_vm_read_strings(pid_t pid, const long *addr, char **dest,
+			       size_t len, ssize_t *rlen, unsigned count)
+{
+#ifdef HAVE_PROCESS_VM_READV
+	unsigned i, j, n;
+	unsigned idx[SYD_VM_BATCH];
+	bool done[SYD_VM_BATCH];
+	size_t chunk;
+	ssize_t r;
+	char *nul;
+	struct iovec local[SYD_VM_BATCH], remote[SYD_VM_BATCH];
+
+	BUG_ON(count <= SYD_VM_BATCH);
+	BUG_ON(len > 0);
+
+	if (syd_vm_unsupported)
+		return -ENOSYS;
+
+	for (i = 0; i < count; i++) {
+		rlen[i] = 0;
+		done[i] = false;
+	}
+
+	for (;;) {
+		n = 0;
+		for (i = 0; i < count; i++) {
+			if (done[i])
+				continue;
+			chunk = SYD_VM_CHUNK - ((unsigned long)(addr[i] + rlen[i]) % SYD_VM_CHUNK);
+			if (chunk > len - rlen[i])
+				chunk = len - rlen[i];
+			local[n].iov_base = dest[i] + rlen[i];
+			local[n].iov_len = chunk;
+			remote[n].iov_base = (void *)(addr[i] + rlen[i]);
+			remote[n].iov_len = chunk;
+			idx[n++] = i;
+		}
+		if (n == 0)
+			return 0;
+
+		r = process_vm_readv(pid, local, n, remote, n, 0);
+		if (r < 0) {
+			if (errno != EFAULT) {
+				if (errno == ENOSYS)
+					syd_vm_unsupported = true;
+				return -errno;
+			}
+			r = 0; /* the first string faulted */
+		}
+
+		for (j = 0; j < n; j++) {
+			i = idx[j];
+			chunk = (size_t)r < local[j].iov_len ? (size_t)r : local[j].iov_len;
+			nul = memchr(local[j].iov_base, '\0', chunk);
+			if (nul) {
+				rlen[i] = nul - dest[i];
+				done[i] = true;
+			} else {
+				rlen[i] += chunk;
+				if (chunk < local[j].iov_len) {
+					/* fault */
+					done[i] = true;
+					if (rlen[i] == 0)
+						rlen[i] = -EFAULT;
+					else
+						dest[i][rlen[i]] = '\0';
+				} else if ((size_t)rlen[i] == len) {
+					done[i] = true;
+					dest[i][--rlen[i]] = '\0';
+				}
+			}
+			if ((size_t)r < local[j].iov_len)
+				break; /* the rest were not transferred */
+			r -= local[j].iov_len;
+		}
+	}
+#else
+	return -ENOSYS;
+#endif
+}
+
 int syd_trace_step(syd_process_t *current, int sig)
 {
 	int r;
@@ -41,6 +199,7 @@ int syd_trace_step(syd_process_t *current, int sig)
 	       ? sydbox->trace_step
 	       : current->trace_step;
 
+	tracer->loop_syscalls++;
 	switch (step) {
 	case SYD_STEP_SYSCALL:
 		r = pink_trace_syscall(current->pid, sig);
@@ -61,6 +220,7 @@ int syd_trace_listen(syd_process_t *current)
 
 	SYD_RETURN_IF_KILLED(current);
 
+	tracer->loop_syscalls++;
 	r = pink_trace_listen(current->pid);
 
 	return SYD_CHECK(current, r);
@@ -125,15 +285,143 @@ int syd_trace_geteventmsg(syd_process_t *current, unsigned long *data)
 	return SYD_CHECK(current, r);
 }
 
+/*
+ * PTRACE_GET_SYSCALL_INFO (Linux-5.3) returns the system call number and
+ * arguments at entry (or seccomp) stops and the return value at exit stops
+ * with a single small copy. The full register set is only fetched when
+ * registers are to be written, or where the system call information does
+ * not suffice, see syd_regset_load().
+ */
+#ifndef PTRACE_GET_SYSCALL_INFO
+# define PTRACE_GET_SYSCALL_INFO	0x420e
+# define PTRACE_SYSCALL_INFO_NONE	0
+# define PTRACE_SYSCALL_INFO_ENTRY	1
+# define PTRACE_SYSCALL_INFO_EXIT	2
+# define PTRACE_SYSCALL_INFO_SECCOMP	3
+#endif
+#define SYD_X32_SYSCALL_BIT 0x40000000
+
+struct syd_ptrace_syscall_info {
+	uint8_t op;
+	uint8_t pad[3];
+	uint32_t arch;
+	uint64_t instruction_pointer;
+	uint64_t stack_pointer;
+	union {
+		struct {
+			uint64_t nr;
+			uint64_t args[6];
+		} entry;
+		struct {
+			int64_t rval;
+			uint8_t is_error;
+		} exit;
+		struct {
+			uint64_t nr;
+			uint64_t args[6];
+			uint32_t ret_data;
+		} seccomp;
+	} u;
+};
+
+static bool syd_syscall_info_unsupported;
+
+/* Returns the ABI or -1 if the registers must be read with pinktrace. */
+static short syd_syscall_info_abi(uint32_t arch, uint64_t nr)
+{
+#if defined(__x86_64__)
+	if (arch == AUDIT_ARCH_I386)
+		return PINK_ABI_I386;
+	if (arch == AUDIT_ARCH_X86_64 && !(nr & SYD_X32_SYSCALL_BIT))
+		return PINK_ABI_X86_64;
+#elif defined(__i386__)
+	if (arch == AUDIT_ARCH_I386)
+		return PINK_ABI_DEFAULT;
+#endif
+	return -1;
+}
+
+/*
+ * Fill current->syscall_info, returns:
+ * 1: success
+ * 0: unusable, fall back to the register set
+ * -errno: failure
+ */
+static int syd_syscall_info_fill(syd_process_t *current)
+{
+	unsigned i;
+	short abi;
+	struct syd_ptrace_syscall_info info;
+
+	if (syd_syscall_info_unsupported)
+		return 0;
+
+	if (ptrace(PTRACE_GET_SYSCALL_INFO, current->pid,
+		   (void *)sizeof(info), &info) < 0) {
+		if (errno == ESRCH)
+			return -ESRCH;
+		/* EIO: Linux<5.3 */
+		syd_syscall_info_unsupported = true;
+		return 0;
+	}
+
+	switch (info.op) {
+	case PTRACE_SYSCALL_INFO_ENTRY:
+	case PTRACE_SYSCALL_INFO_SECCOMP:
+		/* entry and seccomp have the same layout for nr and args */
+		abi = syd_syscall_info_abi(info.arch, info.u.entry.nr);
+		if (abi < 0)
+			return 0;
+		current->abi = abi;
+		current->syscall_info.nr = (long)info.u.entry.nr;
+		for (i = 0; i < PINK_MAX_ARGS; i++)
+			current->syscall_info.args[i] = (long)info.u.entry.args[i];
+		current->flags |= SYD_SYSCALL_INFO;
+		return 1;
+	case PTRACE_SYSCALL_INFO_EXIT:
+		/* nr and args are kept from the entry */
+		if (!(current->flags & SYD_SYSCALL_INFO))
+			return 0;
+		current->syscall_info.rval = (long)info.u.exit.rval;
+		current->syscall_info.is_error = !!info.u.exit.is_error;
+		return 1;
+	default:
+		return 0;
+	}
+}
+
 int syd_regset_fill(syd_process_t *current)
 {
 	int r;
 
 	assert(current);
 
+	current->flags &= ~SYD_REGSET;
+	r = syd_syscall_info_fill(current);
+	if (r > 0)
+		return 0;
+	else if (r < 0)
+		return SYD_CHECK(current, r);
+
+	current->flags &= ~SYD_SYSCALL_INFO;
+	return syd_regset_load(current);
+}
+
+/* Fetch the full register set unless it is up to date. */
+int syd_regset_load(syd_process_t *current)
+{
+	int r;
+
+	assert(current);
+
+	if (current->flags & SYD_REGSET)
+		return 0;
+
 	r = pink_regset_fill(current->pid, current->regset);
 	if (r == 0) {
-		pink_read_abi(current->pid, current->regset, &current->abi);
+		if (!(current->flags & SYD_SYSCALL_INFO))
+			pink_read_abi(current->pid, current->regset, &current->abi);
+		current->flags |= SYD_REGSET;
 		return 0;
 	}
 	return SYD_CHECK(current, r);
@@ -146,6 +434,16 @@ int syd_read_syscall(syd_process_t *current, long *sysnum)
 	SYD_RETURN_IF_KILLED(current);
 	BUG_ON(sysnum);
 
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+	if (notifying(current)) {
+		*sysnum = sydbox->notify_req->data.nr;
+		return 0;
+	}
+#endif
+	if (!(current->flags & SYD_REGSET)) {
+		*sysnum = current->syscall_info.nr;
+		return 0;
+	}
 	r = pink_read_syscall(current->pid, current->regset, sysnum);
 
 	return SYD_CHECK(current, r);
@@ -157,6 +455,18 @@ int syd_read_retval(syd_process_t *current, long *retval, int *error)
 
 	SYD_RETURN_IF_KILLED(current);
 
+	if (!(current->flags & SYD_REGSET)) {
+		if (current->syscall_info.is_error) {
+			*retval = -1;
+			if (error)
+				*error = -current->syscall_info.rval;
+		} else {
+			*retval = current->syscall_info.rval;
+			if (error)
+				*error = 0;
+		}
+		return 0;
+	}
 	r = pink_read_retval(current->pid, current->regset, retval, error);
 
 	return SYD_CHECK(current, r);
@@ -169,6 +479,18 @@ int syd_read_argument(syd_process_t *current, unsigned arg_index, long *argval)
 	SYD_RETURN_IF_KILLED(current);
 	BUG_ON(argval);
 
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+	if (notifying(current)) {
+		BUG_ON(arg_index < PINK_MAX_ARGS);
+		*argval = SYD_NOTIFY_ARG(arg_index);
+		return 0;
+	}
+#endif
+	if (!(current->flags & SYD_REGSET)) {
+		BUG_ON(arg_index < PINK_MAX_ARGS);
+		*argval = current->syscall_info.args[arg_index];
+		return 0;
+	}
 	r = pink_read_argument(current->pid, current->regset, arg_index, argval);
 
 	return SYD_CHECK(current, r);
@@ -182,6 +504,18 @@ int syd_read_argument_int(syd_process_t *current, unsigned arg_index, int *argva
 	SYD_RETURN_IF_KILLED(current);
 	BUG_ON(argval);
 
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+	if (notifying(current)) {
+		BUG_ON(arg_index < PINK_MAX_ARGS);
+		*argval = (int)SYD_NOTIFY_ARG(arg_index);
+		return 0;
+	}
+#endif
+	if (!(current->flags & SYD_REGSET)) {
+		BUG_ON(arg_index < PINK_MAX_ARGS);
+		*argval = (int)current->syscall_info.args[arg_index];
+		return 0;
+	}
 	r = pink_read_argument(current->pid, current->regset, arg_index, &arg_l);
 	if (r == 0) {
 		*argval = (int)arg_l;
@@ -190,24 +524,88 @@ int syd_read_argument_int(syd_process_t *current, unsigned arg_index, int *argva
 	return SYD_CHECK(current, r);
 }
 
-ssize_t syd_read_string(syd_process_t *current, long addr, char *dest, size_t len)
+int syd_read_strings(syd_process_t *current, const long *addr, char **dest,
+		     size_t len, ssize_t *rlen, unsigned count)
 {
 	int r;
-	ssize_t rlen;
+	unsigned i;
+
+	for (i = 0; i < count; i++) {
+		dest[i][0] = '\0';
+		rlen[i] = 0;
+	}
 
 	SYD_RETURN_IF_KILLED(current);
 
-	errno = 0;
-	rlen = pink_read_string(current->pid, current->regset, addr, dest, len);
-	if (rlen < 0 && errno == EFAULT) { /* NULL pointer? */
-		return -1;
-	} else if (rlen >= 0 && (size_t)rlen <= len) { /* partial read? */
+	r = syd_vm_read_strings(current->pid, addr, dest, len, rlen, count);
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+	if (notifying(current))
+		return r < 0 ? r : syd_notify_check();
+#endif
+	if (r != -ENOSYS && r != -EPERM)
+		return SYD_CHECK(current, r);
+
+	for (i = 0; i < count; i++) {
 		errno = 0;
-		dest[rlen] = '\0';
+		rlen[i] = pink_read_string(current->pid, current->regset,
+					   addr[i], dest[i], len);
+		if (rlen[i] < 0 && errno == EFAULT) { /* NULL pointer? */
+			rlen[i] = -EFAULT;
+			continue;
+		} else if (rlen[i] >= 0 && (size_t)rlen[i] <= len) { /* partial read? */
+			errno = 0;
+			if ((size_t)rlen[i] == len)
+				rlen[i]--;
+			dest[i][rlen[i]] = '\0';
+		}
+		if ((r = SYD_CHECK(current, -errno)) < 0)
+			return r;
 	}
+	return 0;
+}
+
+ssize_t syd_read_string(syd_process_t *current, long addr, char *dest, size_t len)
+{
+	int r;
+	ssize_t rlen;
 
-	r = SYD_CHECK(current, -errno);
-	return r == 0 ? rlen : r;
+	r = syd_read_strings(current, &addr, &dest, len, &rlen, 1);
+	if (r < 0) {
+		errno = -r;
+		return r;
+	} else if (rlen < 0) {
+		errno = -rlen;
+		return -1;
+	}
+	return rlen;
+}
+
+ssize_t syd_read_vm_data(syd_process_t *current, long addr, char *dest, size_t len)
+{
+	int r;
+	ssize_t rlen;
+
+	SYD_RETURN_IF_KILLED(current);
+
+	rlen = syd_vm_data(current->pid, addr, dest, len, false);
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+	if (notifying(current)) {
+		if (rlen < 0)
+			return rlen;
+		r = syd_notify_check();
+		return r == 0 ? rlen : r;
+	}
+#endif
+	if (rlen == -ENOSYS || rlen == -EPERM) {
+		rlen = pink_read_vm_data(current->pid, current->regset,
+					 addr, dest, len);
+		if (rlen < 0)
+			rlen = -errno;
+	}
+	if (rlen >= 0)
+		return rlen;
+	r = SYD_CHECK(current, rlen);
+	return r;
 }
 
 int syd_read_socket_argument(syd_process_t *current, bool decode_socketcall,
@@ -218,6 +616,23 @@ int syd_read_socket_argument(syd_process_t *current, bool decode_socketcall,
 	SYD_RETURN_IF_KILLED(current);
 	BUG_ON(argval);
 
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+	if (notifying(current)) {
+		/* socketcall() has an exit handler and is never notified. */
+		BUG_ON(!decode_socketcall);
+		BUG_ON(arg_index < PINK_MAX_ARGS);
+		*argval = (unsigned long)SYD_NOTIFY_ARG(arg_index);
+		return 0;
+	}
+#endif
+	if (!decode_socketcall && !(current->flags & SYD_REGSET)) {
+		BUG_ON(arg_index < PINK_MAX_ARGS);
+		*argval = (unsigned long)current->syscall_info.args[arg_index];
+		return 0;
+	}
+	/* socketcall() arguments are decoded by pinktrace */
+	if ((r = syd_regset_load(current)) < 0)
+		return r;
 	r = pink_read_socket_argument(current->pid, current->regset,
 				      decode_socketcall,
 				      arg_index, argval);
@@ -231,6 +646,19 @@ int syd_read_socket_subcall(syd_process_t *current, bool decode_socketcall,
 
 	SYD_RETURN_IF_KILLED(current);
 
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+	if (notifying(current)) {
+		BUG_ON(!decode_socketcall);
+		*subcall = sydbox->notify_req->data.nr;
+		return 0;
+	}
+#endif
+	if (!(current->flags & SYD_REGSET)) {
+		/* socketcall(call, args) */
+		*subcall = decode_socketcall ? current->syscall_info.args[0]
+					     : current->syscall_info.nr;
+		return 0;
+	}
 	r = pink_read_socket_subcall(current->pid, current->regset,
 				     decode_socketcall, subcall);
 	return SYD_CHECK(current, r);
@@ -241,14 +669,41 @@ int syd_read_socket_address(syd_process_t *current, bool decode_socketcall,
 			    struct pink_sockaddr *sockaddr)
 {
 	int r;
+	ssize_t rlen;
+	unsigned long fd_l, addr, addrlen;
 
 	SYD_RETURN_IF_KILLED(current);
 	BUG_ON(sockaddr);
 
-	r = pink_read_socket_address(current->pid, current->regset,
-				     decode_socketcall,
-				     arg_index, fd, sockaddr);
-	return SYD_CHECK(current, r);
+	if (fd) {
+		r = syd_read_socket_argument(current, decode_socketcall, 0, &fd_l);
+		if (r < 0)
+			return r;
+		*fd = (int)fd_l;
+	}
+	r = syd_read_socket_argument(current, decode_socketcall, arg_index, &addr);
+	if (r < 0)
+		return r;
+	r = syd_read_socket_argument(current, decode_socketcall, arg_index + 1,
+				     &addrlen);
+	if (r < 0)
+		return r;
+
+	if (addr == 0) {
+		sockaddr->family = -1;
+		sockaddr->length = 0;
+		return 0;
+	}
+	if (addrlen > sizeof(sockaddr->u))
+		addrlen = sizeof(sockaddr->u);
+
+	memset(&sockaddr->u, 0, sizeof(sockaddr->u));
+	rlen = syd_read_vm_data(current, addr, (char *)&sockaddr->u, addrlen);
+	if (rlen < 0)
+		return rlen;
+	sockaddr->family = sockaddr->u.sa.sa_family;
+	sockaddr->length = addrlen;
+	return 0;
 }
 
 int syd_write_syscall(syd_process_t *current, long sysnum)
@@ -257,6 +712,15 @@ int syd_write_syscall(syd_process_t *current, long sysnum)
 
 	SYD_RETURN_IF_KILLED(current);
 
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+	if (notifying(current)) {
+		/* The system call can not be changed, only skipped. */
+		sydbox->notify_resp->flags &= ~SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+		return 0;
+	}
+#endif
+	if ((r = syd_regset_load(current)) < 0)
+		return r;
 	r = pink_write_syscall(current->pid, current->regset, sysnum);
 
 	return SYD_CHECK(current, r);
@@ -268,7 +732,33 @@ int syd_write_retval(syd_process_t *current, long retval, int error)
 
 	SYD_RETURN_IF_KILLED(current);
 
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+	if (notifying(current)) {
+		sydbox->notify_resp->val = retval;
+		sydbox->notify_resp->error = error ? -error : 0;
+		return 0;
+	}
+#endif
+	if ((r = syd_regset_load(current)) < 0)
+		return r;
 	r = pink_write_retval(current->pid, current->regset, retval, error);
 
 	return SYD_CHECK(current, r);
 }
+
+ssize_t syd_write_vm_data(syd_process_t *current, long addr, const char *src, size_t len)
+{
+	ssize_t r;
+
+	SYD_RETURN_IF_KILLED(current);
+
+	r = syd_vm_data(current->pid, addr, (char *)src, len, true);
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+	if (notifying(current))
+		return r;
+#endif
+	/* PTRACE_POKEDATA may also write to read-only mappings. */
+	if (r == -ENOSYS || r == -EPERM || r == -EFAULT)
+		return pink_write_vm_data(current->pid, current->regset, addr, src, len);
+	return r;
+}
@@ -0,0 +1,81 @@
+/*
+ * sydbox/pool.h
+ *
+ * Free lists of process records and their shared data
+ *
+ * Copyright (c) 2015 Ali Polatel <alip@exherbo.org>
+ * Released under the terms of the 3-clause BSD license
+ */
+
+#ifndef POOL_H
+#define POOL_H 1
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include "sydconf.h"
+
+/*
+ * Objects of one type given back when a process is buried, kept for the
+ * next process of the same tracer thread rather than returned to the heap.
+ * The free list is linked through the first word of the objects, at most
+ * SYDBOX_POOL_MAX objects are kept. A NULL pool, e.g. after the tracers
+ * are gone, is always empty and always full.
+ */
+struct syd_pool {
+	void *head;
+	unsigned count;
+
+	/* Statistics */
+	unsigned long reused;
+	unsigned long allocated;
+};
+
+/* Returns an object off the free list, NULL if the caller is to allocate */
+static inline void *pool_get(struct syd_pool *pool)
+{
+	void *ptr;
+
+	if (!pool)
+		return NULL;
+	if (!pool->head) {
+		pool->allocated++;
+		return NULL;
+	}
+
+	ptr = pool->head;
+	pool->head = *(void **)ptr;
+	pool->count--;
+	pool->reused++;
+	return ptr;
+}
+
+/* Returns false if the free list is full and the caller is to free ptr */
+static inline bool pool_put(struct syd_pool *pool, void *ptr)
+{
+	if (!pool || pool->count >= SYDBOX_POOL_MAX)
+		return false;
+
+	*(void **)ptr = pool->head;
+	pool->head = ptr;
+	pool->count++;
+	return true;
+}
+
+static inline void pool_free(struct syd_pool *pool, void *ptr)
+{
+	if (!pool_put(pool, ptr))
+		free(ptr);
+}
+
+static inline void pool_drain(struct syd_pool *pool, void (*free_func)(void *))
+{
+	void *ptr;
+
+	while ((ptr = pool->head)) {
+		pool->head = *(void **)ptr;
+		free_func(ptr);
+	}
+	pool->count = 0;
+}
+
+#endif
@@ -337,6 +337,44 @@ int proc_stat(pid_t pid, struct proc_statinfo *info)
 	return 0;
 }
 
+/*
+ * read the system call number from /proc/$pid/syscall,
+ * -1 if the process is blocked outside a system call,
+ * -EBUSY if it is running.
+ */
+int proc_syscall(pid_t pid, long *sysnum)
+{
+	int r, nr;
+	char *p;
+	FILE *f;
+	char word[32];
+
+	assert(pid >= 1);
+	assert(sysnum);
+
+	if (asprintf(&p, "/proc/%u/syscall", pid) < 0)
+		return -ENOMEM;
+
+	f = fopen(p, "r");
+	free(p);
+
+	if (!f)
+		return -errno;
+
+	r = 0;
+	if (fscanf(f, "%31s", word) != 1)
+		r = -EINVAL;
+	else if (streq(word, "running"))
+		r = -EBUSY;
+	else if (safe_atoi(word, &nr) < 0)
+		r = -EINVAL;
+	else
+		*sysnum = nr;
+
+	fclose(f);
+	return r;
+}
+
 #if 0
 /*
  * read /proc/$pid/environ and set the environment.
@@ -30,6 +30,7 @@ struct proc_statinfo {
 
 int proc_cwd(pid_t pid, bool use_toolong_hack, char **buf);
 int proc_stat(pid_t pid, struct proc_statinfo *info);
+int proc_syscall(pid_t pid, long *sysnum);
 
 #if 0
 int proc_fd(pid_t pid, int dfd, char **buf);
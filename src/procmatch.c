@@ -9,9 +9,13 @@
 
 #include "sydconf.h"
 
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <strings.h>
 
+#include "macro.h"
 #include "xfunc.h"
 #include "procmatch.h"
 #include "pathmatch.h"
@@ -26,7 +30,6 @@ int procadd(proc_pid_t **pp, pid_t pid)
 
 	npp = xmalloc(sizeof(proc_pid_t));
 	npp->pid = pid;
-	sprintf(npp->path, "/proc/%u/***", pid);
 
 	HASH_ADD_INT(*pp, pid, npp);
 	return 1;
@@ -45,14 +48,37 @@ int procdrop(proc_pid_t **pp, pid_t pid)
 	return 1;
 }
 
+/*
+ * Is path below /proc/$pid for any of the pids?
+ * Rather than matching a pattern for every pid, the pid is parsed out of
+ * path and looked up in the hash table.
+ */
 int procmatch(proc_pid_t **pp, const char *path)
 {
-	proc_pid_t *node, *tmp;
+	pid_t pid;
+	const char *p;
+	proc_pid_t *node;
+
+	if (!*pp)
+		return 0;
 
-	HASH_ITER(hh, *pp, node, tmp) {
-		if (pathmatch(node->path, path))
-			return 1;
+	if (pathmatch_get_case()
+	    ? strncmp(path, "/proc/", STRLEN_LITERAL("/proc/"))
+	    : strncasecmp(path, "/proc/", STRLEN_LITERAL("/proc/")))
+		return 0;
+	p = path + STRLEN_LITERAL("/proc/");
+
+	/* pids have no leading zeros */
+	if (*p < '1' || *p > '9')
+		return 0;
+	for (pid = 0; *p >= '0' && *p <= '9'; p++) {
+		if (pid > (INT_MAX - (*p - '0')) / 10)
+			return 0;
+		pid = pid * 10 + (*p - '0');
 	}
+	if (*p != '/')
+		return 0;
 
-	return 0;
+	HASH_FIND_INT(*pp, &pid, node);
+	return node != NULL;
 }
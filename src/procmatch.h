@@ -14,7 +14,6 @@
 
 typedef struct {
 	pid_t pid;
-	char path[sizeof("/proc/%u/***") + sizeof(int)*3 + /*paranoia:*/16];
 	UT_hash_handle hh;
 } proc_pid_t;
 
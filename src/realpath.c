@@ -18,6 +18,129 @@
 #include "sydconf.h"
 #include "bsd-compat.h"
 #include "file.h"
+#include "util.h"
+#include "sydhash.h"
+#include "scratch.h"
+
+/*
+ * Resolution cache:
+ * Maps resolved path names of symbolic links to their targets so that
+ * resolving the same links over and over again needs no readlink() and no
+ * timestamp reset. Every component is still looked up with lstat() and a
+ * cached target is only used if the device, inode, size and modification
+ * time of the link are the ones it was read from. The change time is no
+ * use, resetting the timestamps after following a link updates it. The
+ * target of a link never changes, so an entry does not go stale whatever
+ * happens behind our back, be it a system call we do not trap, a system
+ * call which is still running or a process outside the sandbox. Paths are
+ * dropped when the sandbox sees a system call which is about to change
+ * them, see RPATH_MODIFY, which only keeps the cache small. /proc is never
+ * cached.
+ * The cache is not thread safe, worker threads pass RPATH_NOCACHE which
+ * leaves it alone, including the drop for RPATH_MODIFY.
+ * Each tracer thread has a cache of its own.
+ */
+struct rpath_node {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtim;
+	char *link;
+	UT_hash_handle hh;
+};
+
+static __thread struct rpath_node *rpath_cache;
+static __thread unsigned rpath_cache_count;
+
+static void rpath_cache_remove(struct rpath_node *node)
+{
+	HASH_DEL(rpath_cache, node);
+	rpath_cache_count--;
+	free(node->path);
+	free(node->link);
+	free(node);
+}
+
+static bool rpath_cache_valid(const struct rpath_node *node,
+			      const struct stat *sb)
+{
+	return node->dev == sb->st_dev && node->ino == sb->st_ino &&
+	       node->size == sb->st_size &&
+	       node->mtim.tv_sec == sb->st_mtim.tv_sec &&
+	       node->mtim.tv_nsec == sb->st_mtim.tv_nsec;
+}
+
+static const char *rpath_cache_lookup(const char *path, const struct stat *sb)
+{
+	struct rpath_node *node;
+
+	HASH_FIND_STR(rpath_cache, path, node);
+	if (!node)
+		return NULL;
+	if (!rpath_cache_valid(node, sb)) {
+		rpath_cache_remove(node);
+		return NULL;
+	}
+	return node->link;
+}
+
+static void rpath_cache_store(const char *path, const struct stat *sb,
+			      const char *link)
+{
+	struct rpath_node *node;
+
+	if (startswith(path, "/proc/"))
+		return;
+
+	HASH_FIND_STR(rpath_cache, path, node);
+	if (node) {
+		free(node->link);
+	} else {
+		if (rpath_cache_count >= SYDBOX_REALPATH_CACHE_MAX)
+			realpath_cache_free();
+		node = xmalloc(sizeof(struct rpath_node));
+		node->path = xstrdup(path);
+		HASH_ADD_KEYPTR(hh, rpath_cache, node->path, strlen(node->path),
+				node);
+		rpath_cache_count++;
+	}
+	node->dev = sb->st_dev;
+	node->ino = sb->st_ino;
+	node->size = sb->st_size;
+	node->mtim = sb->st_mtim;
+	node->link = xstrdup(link);
+}
+
+void realpath_cache_drop(const char *path, bool tree)
+{
+	size_t len;
+	struct rpath_node *node, *tmp;
+
+	if (!tree) {
+		HASH_FIND_STR(rpath_cache, path, node);
+		if (node)
+			rpath_cache_remove(node);
+		return;
+	}
+
+	len = strlen(path);
+	if (len == 1) /* "/" */
+		len = 0;
+	HASH_ITER(hh, rpath_cache, node, tmp) {
+		if (!strncmp(node->path, path, len) &&
+		    (node->path[len] == '\0' || node->path[len] == '/'))
+			rpath_cache_remove(node);
+	}
+}
+
+void realpath_cache_free(void)
+{
+	struct rpath_node *node, *tmp;
+
+	HASH_ITER(hh, rpath_cache, node, tmp)
+		rpath_cache_remove(node);
+}
 
 struct stat_mode {
 	unsigned rmode;
@@ -72,12 +195,35 @@ out:
 	return 0;
 }
 
+static ssize_t readlink_mode(const char *path, const struct stat *sb,
+			     bool nocache, char *buf, size_t len)
+{
+	ssize_t slen;
+	const char *link;
+
+	link = nocache ? NULL : rpath_cache_lookup(path, sb);
+	if (link) {
+		slen = strlcpy(buf, link, len);
+		if ((size_t)slen >= len)
+			return -ENAMETOOLONG;
+		return slen;
+	}
+
+	/* readlink() updates atime, keep the timestamps of the link */
+	slen = readlink_copy(path, buf, len);
+	utime_reset(path, sb);
+	if (slen >= 0 && !nocache)
+		rpath_cache_store(path, sb, buf);
+	return slen;
+}
+
 /*
  * Find the real name of path, by removing all ".", ".." and symlink
  * components.  Returns (resolved) on success, or (NULL) on failure,
  * in which case the path which caused trouble is left in (resolved).
  *
  * Take care of side affects like symlink atime update on readlink() etc.
+ * The result is allocated with scratch_alloc().
  */
 int realpath_mode(const char * restrict path, unsigned mode, char **buf)
 {
@@ -91,7 +237,7 @@ int realpath_mode(const char * restrict path, unsigned mode, char **buf)
 	char symlink[SYDBOX_PATH_MAX];
 
 	short flags;
-	bool nofollow;
+	bool nofollow, nocache;
 	char *resolved;
 
 	if (!path)
@@ -104,11 +250,10 @@ int realpath_mode(const char * restrict path, unsigned mode, char **buf)
 		return -EINVAL;
 	flags = mode & ~RPATH_MASK;
 	nofollow = !!(flags & RPATH_NOFOLLOW);
+	nocache = !!(flags & RPATH_NOCACHE);
 	mode &= RPATH_MASK;
 
-	resolved = malloc(sizeof(char) * SYDBOX_PATH_MAX);
-	if (!resolved)
-		return -ENOMEM;
+	resolved = scratch_alloc(sizeof(char) * SYDBOX_PATH_MAX);
 	r = 0;
 	symlinks = 0;
 	resolved[0] = '/';
@@ -118,7 +263,7 @@ int realpath_mode(const char * restrict path, unsigned mode, char **buf)
 	resolved_len = 1;
 	left_len = strlcpy(left, path + 1, sizeof(left));
 	if (left_len >= sizeof(left) || resolved_len >= SYDBOX_PATH_MAX) {
-		free(resolved);
+		scratch_free(resolved);
 		return -ENAMETOOLONG;
 	}
 
@@ -133,7 +278,7 @@ int realpath_mode(const char * restrict path, unsigned mode, char **buf)
 		p = strchr(left, '/');
 		s = p ? p : left + left_len;
 		if ((size_t)(s - left) >= sizeof(next_token)) {
-			free(resolved);
+			scratch_free(resolved);
 			return -ENAMETOOLONG;
 		}
 		memcpy(next_token, left, s - left);
@@ -143,7 +288,7 @@ int realpath_mode(const char * restrict path, unsigned mode, char **buf)
 			memmove(left, s + 1, left_len + 1);
 		if (resolved[resolved_len - 1] != '/') {
 			if (resolved_len + 1 >= SYDBOX_PATH_MAX) {
-				free(resolved);
+				scratch_free(resolved);
 				return -ENAMETOOLONG;
 			}
 			resolved[resolved_len++] = '/';
@@ -163,15 +308,16 @@ int realpath_mode(const char * restrict path, unsigned mode, char **buf)
 			sm.nofollow = nofollow;
 			sm.last_node = true;
 			if ((r = stat_mode(resolved, &sm, &sb)) < 0) {
-				free(resolved);
+				scratch_free(resolved);
 				return r;
 			}
+			r = 0;
 			if (sb.st_mode == 0 && mode == RPATH_NOLAST) {
 				r = 0;
 				break;
 			}
 			if (!S_ISDIR(sb.st_mode)) {
-				free(resolved);
+				scratch_free(resolved);
 				return -ENOTDIR;
 			}
 			continue;
@@ -197,7 +343,7 @@ int realpath_mode(const char * restrict path, unsigned mode, char **buf)
 		 */
 		resolved_len = strlcat(resolved, next_token, SYDBOX_PATH_MAX);
 		if (resolved_len >= SYDBOX_PATH_MAX) {
-			free(resolved);
+			scratch_free(resolved);
 			return -ENAMETOOLONG;
 		}
 
@@ -208,31 +354,33 @@ int realpath_mode(const char * restrict path, unsigned mode, char **buf)
 		else
 			sm.last_node = false;
 		if ((r = stat_mode(resolved, &sm, &sb)) < 0) {
-			free(resolved);
+			scratch_free(resolved);
 			return r;
 		}
 		if (S_ISLNK(sb.st_mode)) {
 			if (symlinks++ > SYDBOX_MAXSYMLINKS) {
-				free(resolved);
+				scratch_free(resolved);
 				return -ELOOP;
 			}
-			if (!nofollow) {
-				slen = readlink_copy(resolved, symlink, SYDBOX_PATH_MAX);
-				utime_reset(resolved, &sb);
-				if (slen < 0) {
-					free(resolved);
-					return slen; /* negated errno */
-				}
-				if (symlink[0] == '/') {
-					resolved[1] = 0;
-					resolved_len = 1;
-				} else if (resolved_len > 1) {
-					/* Strip the last path component. */
-					resolved[resolved_len - 1] = '\0';
-					q = strrchr(resolved, '/') + 1;
-					*q = '\0';
-					resolved_len = q - resolved;
-				}
+			/*
+			 * Symbolic links are not followed (i.e. stat_mode()
+			 * does not return them) for the last component only.
+			 */
+			slen = readlink_mode(resolved, &sb, nocache,
+					     symlink, SYDBOX_PATH_MAX);
+			if (slen < 0) {
+				scratch_free(resolved);
+				return slen; /* negated errno */
+			}
+			if (symlink[0] == '/') {
+				resolved[1] = 0;
+				resolved_len = 1;
+			} else if (resolved_len > 1) {
+				/* Strip the last path component. */
+				resolved[resolved_len - 1] = '\0';
+				q = strrchr(resolved, '/') + 1;
+				*q = '\0';
+				resolved_len = q - resolved;
 			}
 
 			/*
@@ -243,7 +391,7 @@ int realpath_mode(const char * restrict path, unsigned mode, char **buf)
 			if (p != NULL) {
 				if (symlink[slen - 1] != '/') {
 					if ((size_t)(slen + 1) >= sizeof(symlink)) {
-						free(resolved);
+						scratch_free(resolved);
 						return -ENAMETOOLONG;
 					}
 					symlink[slen] = '/';
@@ -251,7 +399,7 @@ int realpath_mode(const char * restrict path, unsigned mode, char **buf)
 				}
 				left_len = strlcat(symlink, left, sizeof(symlink));
 				if (left_len >= sizeof(left)) {
-					free(resolved);
+					scratch_free(resolved);
 					return -ENAMETOOLONG;
 				}
 			}
@@ -271,6 +419,8 @@ int realpath_mode(const char * restrict path, unsigned mode, char **buf)
 	if (resolved_len > 1 && resolved[resolved_len - 1] == '/')
 		resolved[resolved_len - 1] = '\0';
 out:
+	if (flags & RPATH_MODIFY && !nocache)
+		realpath_cache_drop(resolved, !!(flags & RPATH_MODIFY_TREE));
 	*buf = resolved;
 	return r;
 }
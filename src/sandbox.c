@@ -10,12 +10,16 @@
 #include "sydbox.h"
 #include <errno.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
+#include <syd.h>
 #include "pink.h"
 #include "macro.h"
 #include "bsd-compat.h"
@@ -26,6 +30,8 @@
 #include "sockmatch.h"
 #include "proc.h"
 #include "util.h"
+#include "sydhash.h"
+#include "worker.h"
 
 static void box_report_violation_path(syd_process_t *current,
 				      unsigned arg_index,
@@ -127,15 +133,15 @@ static char *box_resolve_path_special(const char *abspath, pid_t tid)
 	p = NULL;
 	if (streq(abspath, "/proc/mounts")) {
 		/* /proc/mounts -> /proc/$tid/mounts */
-		xasprintf(&p, "/proc/%u/mounts", tid);
+		p = scratch_printf("/proc/%u/mounts", tid);
 	} else if (startswith(abspath, "/proc/net")) {
 		/* /proc/net/ -> /proc/$tid/net/ */
 		tail = abspath + STRLEN_LITERAL("/proc/net");
-		xasprintf(&p, "/proc/%u/net%s", tid, tail);
+		p = scratch_printf("/proc/%u/net%s", tid, tail);
 	} else if (startswith(abspath, "/proc/self")) {
 		/* /proc/self/ -> /proc/$tid/ */
 		tail = abspath + STRLEN_LITERAL("/proc/self");
-		xasprintf(&p, "/proc/%u%s", tid, tail);
+		p = scratch_printf("/proc/%u%s", tid, tail);
 	}
 
 	return p;
@@ -150,11 +156,12 @@ static int box_resolve_path_helper(const char *abspath, pid_t tid,
 	p = box_resolve_path_special(abspath, tid);
 	r = realpath_mode(p ? p : abspath, rmode, res);
 	if (p)
-		free(p);
+		scratch_free(p);
 
 	return r;
 }
 
+/* The result is to be freed with scratch_free(). */
 int box_resolve_path(const char *path, const char *prefix, pid_t tid,
 		     unsigned rmode, char **res)
 {
@@ -164,16 +171,101 @@ int box_resolve_path(const char *path, const char *prefix, pid_t tid,
 	if (path == NULL && prefix == NULL)
 		return -EINVAL;
 	if (path == NULL)
-		abspath = xstrdup(prefix);
-	else if (prefix == NULL)
-		abspath = xstrdup(path);
+		abspath = scratch_strdup(prefix);
+	else if (prefix == NULL || path_is_absolute(path))
+		abspath = scratch_strdup(path);
 	else
-		abspath = path_make_absolute(path, prefix);
-	if (!abspath)
-		return -errno;
+		abspath = scratch_printf("%s/%s", prefix, path);
 
 	r = box_resolve_path_helper(abspath, tid, rmode, res);
-	free(abspath);
+	scratch_free(abspath);
+	return r;
+}
+
+/*
+ * Resolve a relative path by walking it from the directory handle of the
+ * tracee, /proc/$pid/cwd or /proc/$pid/fd/$dirfd, rather than from the
+ * string prefix so only the components of path need to be looked up.
+ * Returns -ENOSYS if the caller has to fall back to box_resolve_path().
+ * Neither reads the tracee nor touches the resolution cache.
+ */
+static int box_resolve_path_fd(pid_t pid, int fd, const char *path,
+			       unsigned rmode, char **res)
+{
+	int r, dirfd;
+	char *p;
+
+	if (!path || path_is_absolute(path))
+		return -ENOSYS;
+
+	if (fd == AT_FDCWD)
+		dirfd = syd_proc_cwd_open(pid);
+	else
+		dirfd = syd_proc_dirfd_open(pid, fd);
+	if (dirfd < 0)
+		return -ENOSYS;
+
+	r = syd_realpath_at(dirfd, path, &p, rmode & (RPATH_MASK|RPATH_NOFOLLOW));
+	close(dirfd);
+	if (r == -ENAMETOOLONG) {
+		return -ENOSYS;
+	} else if (r < 0) {
+		return r;
+	} else if (startswith(p, "/proc")) {
+		/* /proc/self is ours, let box_resolve_path_special() handle it */
+		free(p);
+		return -ENOSYS;
+	}
+
+	*res = p;
+	return 0;
+}
+
+/*
+ * Fallback of box_resolve_path_at(): resolve path from the path of the
+ * directory argument dirfd, which is looked up unless *prefix is known, or
+ * from the working directory for AT_FDCWD.
+ */
+static int box_resolve_path_prefix(syd_process_t *current, sysinfo_t *info,
+				   int dirfd, const char *path,
+				   char **prefix, char **res)
+{
+	int r;
+
+	if (path && path_is_absolute(path))
+		return box_resolve_path(path, NULL, current->pid, info->rmode,
+					res);
+
+	if (dirfd == AT_FDCWD) {
+		if ((r = update_cwd(current)) < 0)
+			return r;
+		return box_resolve_path(path, P_CWD(current), current->pid,
+					info->rmode, res);
+	}
+
+	if (!*prefix &&
+	    (r = path_prefix(current, info->arg_index - 1, prefix)) < 0)
+		return r;
+	return box_resolve_path(path, *prefix, current->pid, info->rmode, res);
+}
+
+/*
+ * Resolve path relative to the directory argument dirfd, from the directory
+ * handle if possible. The path of dirfd is only looked up for the fallback,
+ * it is returned via prefix.
+ */
+static int box_resolve_path_at(syd_process_t *current, sysinfo_t *info,
+			       int dirfd, const char *path,
+			       char **prefix, char **res)
+{
+	int r;
+
+	r = box_resolve_path_fd(current->pid, dirfd, path, info->rmode, res);
+	if (r == -ENOSYS)
+		return box_resolve_path_prefix(current, info, dirfd, path,
+					       prefix, res);
+	if (r == 0 && info->rmode & RPATH_MODIFY)
+		realpath_cache_drop(*res, !!(info->rmode & RPATH_MODIFY_TREE));
 	return r;
 }
 
@@ -185,6 +277,7 @@ static bool box_check_access(enum sys_access_mode mode,
 			     const aclq_t *aclq_list[], size_t aclq_list_len,
 			     const void *needle)
 {
+	bool proc;
 	size_t i;
 	unsigned r;
 	enum acl_action acl_mode;
@@ -204,7 +297,13 @@ static bool box_check_access(enum sys_access_mode mode,
 	}
 
 	for (i = 0; i < aclq_list_len; i++) {
-		r = match_func(acl_mode, aclq_list[i], needle, NULL);
+		if (aclq_list[i] == &sydbox->config.acl_network_connect_auto) {
+			auto_lock();
+			r = match_func(acl_mode, aclq_list[i], needle, NULL);
+			auto_unlock();
+		} else {
+			r = match_func(acl_mode, aclq_list[i], needle, NULL);
+		}
 		if (r & ACL_MATCH) {
 			r &= ~ACL_MATCH_MASK;
 			switch (r) {
@@ -223,10 +322,11 @@ static bool box_check_access(enum sys_access_mode mode,
 	case ACCESS_WHITELIST:
 		if (!sydbox->config.whitelist_per_process_directories)
 			return false; /* access denied (default) */
-		else if (procmatch(&sydbox->config.hh_proc_pid_auto, needle))
-			return true; /* access granted (/proc whitelist) */
-		else
-			return false; /* access denied (/proc did not match) */
+		auto_lock();
+		proc = procmatch(&sydbox->config.hh_proc_pid_auto, needle);
+		auto_unlock();
+		/* access granted only by the /proc whitelist */
+		return proc;
 	case ACCESS_BLACKLIST:
 		return true; /* access granted (default) */
 	default:
@@ -234,6 +334,108 @@ static bool box_check_access(enum sys_access_mode mode,
 	}
 }
 
+/*
+ * Access decision cache:
+ * A bounded, direct mapped cache of box_check_access() results together with
+ * the result of the violation filter. Entries are keyed by the sandbox
+ * version, which changes whenever a sandbox is edited, the lists and the
+ * access mode the decision was made with and the resolved path. Edits of the
+ * global lists bump the cache generation, see box_cache_flush().
+ */
+struct access_key {
+	unsigned long generation;
+	unsigned long version;
+	enum sys_access_mode mode;
+	const aclq_t *list;
+	const aclq_t *list_global;
+	const aclq_t *filter;
+	const char *path;
+};
+
+struct access_entry {
+	unsigned long generation;
+	unsigned long version;
+	enum sys_access_mode mode;
+	const aclq_t *list;
+	const aclq_t *list_global;
+	const aclq_t *filter;
+	char *path;
+	bool access;
+	bool filtered;
+};
+
+static __thread struct access_entry access_cache[SYDBOX_ACCESS_CACHE_SIZE];
+
+static struct access_entry *box_cache_slot(const struct access_key *key)
+{
+	unsigned hashv;
+
+	HASH_VALUE(key->path, strlen(key->path), hashv);
+	hashv ^= (unsigned)key->version * 2654435761U;
+
+	return &access_cache[hashv & (SYDBOX_ACCESS_CACHE_SIZE - 1)];
+}
+
+static bool box_cache_lookup(const struct access_key *key,
+			     bool *access, bool *filtered)
+{
+	const struct access_entry *e = box_cache_slot(key);
+
+	if (e->generation != key->generation ||
+	    e->version != key->version || e->mode != key->mode ||
+	    e->list != key->list || e->list_global != key->list_global ||
+	    e->filter != key->filter || !streq(e->path, key->path)) {
+		tracer->access_cache_miss++;
+		return false;
+	}
+
+	tracer->access_cache_hit++;
+	*access = e->access;
+	*filtered = e->filtered;
+	return true;
+}
+
+static void box_cache_store(const struct access_key *key,
+			    bool access, bool filtered)
+{
+	struct access_entry *e;
+
+	/*
+	 * Decisions on /proc/$pid depend on the set of traced processes,
+	 * see procmatch(), do not cache them.
+	 */
+	if (key->mode == ACCESS_WHITELIST &&
+	    sydbox->config.whitelist_per_process_directories &&
+	    startswith(key->path, "/proc/"))
+		return;
+
+	e = box_cache_slot(key);
+	if (e->path)
+		free(e->path);
+	e->generation = key->generation;
+	e->version = key->version;
+	e->mode = key->mode;
+	e->list = key->list;
+	e->list_global = key->list_global;
+	e->filter = key->filter;
+	e->path = xstrdup(key->path);
+	e->access = access;
+	e->filtered = filtered;
+}
+
+void box_cache_free(void)
+{
+	size_t i;
+
+	for (i = 0; i < SYDBOX_ACCESS_CACHE_SIZE; i++) {
+		if (access_cache[i].path) {
+			free(access_cache[i].path);
+			access_cache[i].path = NULL;
+		}
+		access_cache[i].generation = 0;
+	}
+}
+
 static int box_check_ftype(const char *path, sysinfo_t *info)
 {
 	int deny_errno, stat_ret;
@@ -299,76 +501,19 @@ static int box_check_ftype(const char *path, sysinfo_t *info)
 	return deny_errno;
 }
 
-int box_check_path(syd_process_t *current, sysinfo_t *info)
+/*
+ * Steps 4 to 6 of box_check_path(), r is the result of the path resolution.
+ * Takes the ownership of path, prefix and abspath, the abspath returned via
+ * info->ret_abspath is to be freed with scratch_free().
+ */
+static int box_check_path_finish(syd_process_t *current, sysinfo_t *info,
+				 char *path, char *prefix, char *abspath, int r)
 {
-	bool badfd;
-	int r, deny_errno, stat_errno;
-	pid_t pid;
-	char *prefix, *path, *abspath;
-
-	assert(current);
-	assert(info);
+	int deny_errno, stat_errno;
 
-	pid = current->pid;
-	prefix = path = abspath = NULL;
 	deny_errno = info->deny_errno ? info->deny_errno : EPERM;
 
-	/* Step 0: check for cached abspath from a previous check */
-	if (info->cache_abspath) {
-		/* use cached abspath */
-		prefix = path = NULL;
-		abspath = (char *)info->cache_abspath;
-		goto check_access;
-	}
-
-	/* Step 1: resolve file descriptor for `at' suffixed functions */
-	badfd = false;
-	if (info->at_func) {
-		r = path_prefix(current, info->arg_index - 1, &prefix);
-		if (r == -ESRCH) {
-			return -ESRCH;
-		} else if (r == -EBADF) {
-			/* Using a bad directory for absolute paths is fine!
-			 * System call will be denied after path_decode()
-			 */
-			badfd = true;
-		} else if (r < 0) {
-			r = deny(current, -r);
-			if (sydbox->config.violation_raise_fail)
-				violation(current, "%s()", current->sysname);
-			return r;
-		}
-	}
-
-	/* Step 2: read path */
-	if ((r = path_decode(current, info->arg_index, &path)) < 0) {
-		/*
-		 * For EFAULT we assume path argument is NULL.
-		 * For some `at' suffixed functions, NULL as path
-		 * argument may be OK.
-		 */
-		if (!(r == -EFAULT && info->at_func && info->null_ok)) {
-			r = deny(current, -r);
-			if (sydbox->config.violation_raise_fail)
-				violation(current, "%s()", current->sysname);
-			goto out;
-		} else if (r == -ESRCH) {
-			goto out;
-		}
-	} else { /* r == 0 */
-		/* Careful, we may both have a bad fd and the path may be NULL! */
-		if (badfd && (!path || !path_is_absolute(path))) {
-			/* Bad directory for non-absolute path! */
-			r = deny(current, EBADF);
-			if (sydbox->config.violation_raise_fail)
-				violation(current, "%s()", current->sysname);
-			goto out;
-		}
-	}
-
-	/* Step 3: resolve path */
-	if ((r = box_resolve_path(path, prefix ? prefix : P_CWD(current),
-				  pid, info->rmode, &abspath)) < 0) {
+	if (r < 0) {
 		r = deny(current, -r);
 		if (sydbox->config.violation_raise_fail)
 			violation(current, "%s()", current->sysname);
@@ -376,11 +521,12 @@ int box_check_path(syd_process_t *current, sysinfo_t *info)
 	}
 
 	/* Step 4: Check for access */
+	bool access, filtered;
 	enum sys_access_mode access_mode;
 	const aclq_t *access_lists[2];
 	const aclq_t *access_filter;
+	struct access_key key;
 
-check_access:
 	if (info->access_mode != ACCESS_0)
 		access_mode = info->access_mode;
 	else if (sandbox_deny_write(current))
@@ -394,7 +540,28 @@ check_access:
 		access_lists[0] = &P_BOX(current)->acl_write;
 	access_lists[1] = info->access_list_global;
 
-	if (box_check_access(access_mode, acl_pathmatch, access_lists, 2, abspath)) {
+	if (info->access_filter)
+		access_filter = info->access_filter;
+	else
+		access_filter = &sydbox->config.filter_write;
+
+	key.generation = syd_counter_get(sydbox->access_cache_generation);
+	key.version = P_BOX(current)->version;
+	key.mode = access_mode;
+	key.list = access_lists[0];
+	key.list_global = access_lists[1];
+	key.filter = access_filter;
+	key.path = abspath;
+	if (!box_cache_lookup(&key, &access, &filtered)) {
+		access = box_check_access(access_mode, acl_pathmatch,
+					  access_lists, 2, abspath);
+		filtered = !access && acl_match_path(ACL_ACTION_NONE,
+						     access_filter,
+						     abspath, NULL);
+		box_cache_store(&key, access, filtered);
+	}
+
+	if (access) {
 		r = 0;
 		goto out;
 	}
@@ -423,12 +590,10 @@ check_access:
 	/* Step 6: report violation */
 	r = deny(current, deny_errno);
 
-	if (info->access_filter)
-		access_filter = info->access_filter;
-	else
-		access_filter = &sydbox->config.filter_write;
-
-	if (!acl_match_path(ACL_ACTION_NONE, access_filter, abspath, NULL)) {
+	if (!filtered) {
+		/* the path of the directory is only looked up when needed */
+		if (info->at_func && !prefix)
+			path_prefix(current, info->arg_index - 1, &prefix);
 		if (info->at_func)
 			box_report_violation_path_at(current, info->arg_index,
 						     path, prefix);
@@ -437,24 +602,332 @@ check_access:
 	}
 
 out:
-	if (prefix)
-		free(prefix);
-	if (path)
-		free(path);
+	scratch_free(prefix);
+	scratch_free(path);
 	if (r == 0) {
 		if (info->ret_abspath)
 			*info->ret_abspath = abspath;
-		else if (abspath && !info->cache_abspath)
-			free(abspath);
+		else if (!info->cache_abspath)
+			scratch_free(abspath);
 	} else {
-		if (abspath && !info->cache_abspath)
-			free(abspath);
+		if (!info->cache_abspath)
+			scratch_free(abspath);
 		if (info->ret_abspath)
 			*info->ret_abspath = NULL;
 	}
 	return r;
 }
 
+/*
+ * Path checks handed over to the worker threads:
+ * The tracer reads the arguments, a worker resolves the path and the tracer
+ * checks the access and resumes the tracee once the job is collected, see
+ * box_worker_done(). Access checks stay on the tracer thread as the sandbox,
+ * the compiled lists and the caches are not thread safe.
+ */
+struct box_job {
+	struct worker_job job;
+
+	syd_process_t *current; /* NULL if the process is gone */
+	sysinfo_t info;
+	/*
+	 * Offset of info.access_list in the sandbox, (size_t)-1 unless it
+	 * is one of its lists. The sandbox may be replaced by magic commands
+	 * before the job is collected, see box_job_rebase().
+	 */
+	size_t acl_offset;
+
+	/* Owned by the worker until the job is collected */
+	pid_t pid;
+	int fd; /* directory argument or AT_FDCWD */
+	char *path;
+	char *cwd; /* working directory, NULL if it is not known */
+	int result;
+	char *abspath;
+};
+
+static void box_resolve_job(struct worker_job *job)
+{
+	const char *prefix;
+	struct box_job *b = (struct box_job *)job;
+
+	b->abspath = NULL;
+	b->result = box_resolve_path_fd(b->pid, b->fd, b->path,
+					b->info.rmode, &b->abspath);
+	if (b->result != -ENOSYS)
+		return;
+
+	if (b->path && path_is_absolute(b->path))
+		prefix = NULL;
+	else if (b->fd == AT_FDCWD && b->cwd)
+		prefix = b->cwd;
+	else
+		return; /* the tracer has to look up the directory */
+	b->result = box_resolve_path(b->path, prefix, b->pid,
+				     b->info.rmode | RPATH_NOCACHE,
+				     &b->abspath);
+}
+
+static void box_job_free(struct box_job *b)
+{
+	if (b->path)
+		free(b->path);
+	if (b->cwd)
+		free(b->cwd);
+	if (b->abspath)
+		free(b->abspath);
+	free(b);
+}
+
+static bool box_check_path_defer(syd_process_t *current, sysinfo_t *info,
+				 int dirfd, char *path)
+{
+	struct box_job *b;
+	sandbox_t *box;
+
+	if (!sydbox->config.worker_threads || worker_fd() < 0)
+		return false;
+	/* notifications are answered right away, see event_notify() */
+	if (sydbox->notify_current)
+		return false;
+	if (info->ret_abspath || info->ret_statbuf || info->cache_abspath)
+		return false;
+
+	b = xmalloc(sizeof(struct box_job));
+	b->job.func = box_resolve_job;
+	b->current = current;
+	b->info = *info;
+	box = P_BOX(current);
+	if ((char *)info->access_list >= (char *)box &&
+	    (char *)info->access_list < (char *)(box + 1))
+		b->acl_offset = (char *)info->access_list - (char *)box;
+	else
+		b->acl_offset = (size_t)-1;
+	b->pid = current->pid;
+	b->fd = dirfd;
+	/* the job outlives the stop */
+	b->path = scratch_keepstr(path);
+	b->cwd = P_CWD_STALE(current) ? NULL : xstrdup(P_CWD(current));
+	b->abspath = NULL;
+
+	current->job = b;
+	current->flags |= SYD_IN_WORKER;
+	worker_submit(&b->job);
+	return true;
+}
+
+/* Forget about the pending check of a process, the job is freed when done */
+void box_worker_cancel(syd_process_t *current)
+{
+	if (!current || !(current->flags & SYD_IN_WORKER))
+		return;
+
+	current->job->current = NULL;
+	current->job = NULL;
+	current->flags &= ~SYD_IN_WORKER;
+}
+
+/* Points the access list and mode of the job to the sandbox in effect now. */
+static void box_job_rebase(syd_process_t *current, struct box_job *b)
+{
+	bool deny;
+	sandbox_t *box = P_BOX(current);
+
+	if (b->acl_offset == (size_t)-1)
+		return;
+	b->info.access_list = (aclq_t *)((char *)box + b->acl_offset);
+	if (b->info.access_mode == ACCESS_0)
+		return;
+
+	switch (b->acl_offset) {
+	case offsetof(sandbox_t, acl_exec):
+		deny = sandbox_deny_exec(current);
+		break;
+	case offsetof(sandbox_t, acl_read):
+		deny = sandbox_deny_read(current);
+		break;
+	case offsetof(sandbox_t, acl_write):
+		deny = sandbox_deny_write(current);
+		break;
+	case offsetof(sandbox_t, acl_network_bind):
+	case offsetof(sandbox_t, acl_network_connect):
+		deny = sandbox_deny_network(current);
+		break;
+	default:
+		assert_not_reached();
+		return;
+	}
+	b->info.access_mode = deny ? ACCESS_WHITELIST : ACCESS_BLACKLIST;
+}
+
+static void box_worker_finish(struct box_job *b)
+{
+	int r;
+	char *prefix, *abspath;
+	syd_process_t *current = b->current;
+
+	current->job = NULL;
+	current->flags &= ~SYD_IN_WORKER;
+	box_job_rebase(current, b);
+
+	r = b->result;
+	prefix = NULL;
+	abspath = b->abspath;
+	b->abspath = NULL;
+	if (r == -ENOSYS) {
+		r = box_resolve_path_prefix(current, &b->info, b->fd, b->path,
+					    &prefix, &abspath);
+	} else if (r == 0 && b->info.rmode & RPATH_MODIFY) {
+		realpath_cache_drop(abspath,
+				    !!(b->info.rmode & RPATH_MODIFY_TREE));
+	}
+	if (b->info.rmode & RPATH_MODIFY_TREE) {
+		/* cached directory file descriptor paths may change */
+		syd_counter_inc(sydbox->fd_cache_generation);
+	}
+
+	r = box_check_path_finish(current, &b->info, b->path, prefix,
+				  abspath, r);
+	b->path = NULL;
+
+	/* Resume the tracee, r != 0 means the process is gone. */
+	if (r == 0)
+		syd_trace_step(current, 0);
+}
+
+/* Called by the tracer when worker_fd() is readable */
+void box_worker_done(void)
+{
+	struct worker_job *job, *next;
+	struct box_job *b;
+
+	for (job = worker_collect(); job; job = next) {
+		next = job->next;
+		b = (struct box_job *)job;
+		if (b->current)
+			box_worker_finish(b);
+		box_job_free(b);
+	}
+}
+
+void box_worker_free(void)
+{
+	struct worker_job *job, *next;
+
+	for (job = worker_free(); job; job = next) {
+		next = job->next;
+		box_worker_cancel(((struct box_job *)job)->current);
+		box_job_free((struct box_job *)job);
+	}
+}
+
+static int box_check_path_internal(syd_process_t *current, sysinfo_t *info,
+				   bool async)
+{
+	int r, dirfd;
+	char *prefix, *path, *abspath;
+
+	assert(current);
+	assert(info);
+
+	prefix = abspath = NULL;
+
+	/* path decoded in advance is ours to free */
+	path = info->cache_path;
+	info->cache_path = NULL;
+
+	/* Step 0: check for cached abspath from a previous check */
+	if (info->cache_abspath) {
+		/* use cached abspath */
+		abspath = (char *)info->cache_abspath;
+		return box_check_path_finish(current, info, path, NULL,
+					     abspath, 0);
+	}
+
+	/*
+	 * Step 1: read the directory argument of `at' suffixed functions,
+	 * its path is only looked up if the path can not be resolved from
+	 * the directory handle, see box_resolve_path_at().
+	 */
+	dirfd = AT_FDCWD;
+	if (info->at_func) {
+		r = syd_read_argument_int(current, info->arg_index - 1, &dirfd);
+		if (r == -ESRCH) {
+			goto out;
+		} else if (r < 0) {
+			r = deny(current, -r);
+			if (sydbox->config.violation_raise_fail)
+				violation(current, "%s()", current->sysname);
+			goto out;
+		}
+	}
+
+	/* Step 2: read path (unless decoded in advance) */
+	r = path ? 0 : path_decode(current, info->arg_index, &path);
+	if (r < 0) {
+		/*
+		 * For EFAULT we assume path argument is NULL.
+		 * For some `at' suffixed functions, NULL as path
+		 * argument may be OK.
+		 */
+		if (!(r == -EFAULT && info->at_func && info->null_ok)) {
+			r = deny(current, -r);
+			if (sydbox->config.violation_raise_fail)
+				violation(current, "%s()", current->sysname);
+			goto out;
+		} else if (r == -ESRCH) {
+			goto out;
+		}
+	} else { /* r == 0 */
+		/* Careful, we may both have a bad fd and the path may be NULL!
+		 * Using a bad directory for absolute paths is fine.
+		 */
+		if (dirfd < 0 && dirfd != AT_FDCWD &&
+		    (!path || !path_is_absolute(path))) {
+			/* Bad directory for non-absolute path! */
+			r = deny(current, EBADF);
+			if (sydbox->config.violation_raise_fail)
+				violation(current, "%s()", current->sysname);
+			goto out;
+		}
+	}
+
+	/* Step 3: resolve path */
+	if (async && box_check_path_defer(current, info, dirfd, path))
+		return 0;
+	r = box_resolve_path_at(current, info, dirfd, path, &prefix, &abspath);
+	if (r == -ESRCH)
+		goto out;
+	if (info->rmode & RPATH_MODIFY_TREE) {
+		/* cached directory file descriptor paths may change */
+		syd_counter_inc(sydbox->fd_cache_generation);
+	}
+
+	return box_check_path_finish(current, info, path, prefix, abspath, r);
+
+out:
+	scratch_free(prefix);
+	scratch_free(path);
+	if (info->ret_abspath)
+		*info->ret_abspath = NULL;
+	return r;
+}
+
+int box_check_path(syd_process_t *current, sysinfo_t *info)
+{
+	return box_check_path_internal(current, info, false);
+}
+
+/*
+ * Same as box_check_path() for handlers which return its result as is. The
+ * path may be resolved by a worker thread in which case 0 is returned with
+ * SYD_IN_WORKER set and the tracee is resumed by box_worker_done().
+ */
+int box_check_path_async(syd_process_t *current, sysinfo_t *info)
+{
+	return box_check_path_internal(current, info, true);
+}
+
 int box_check_socket(syd_process_t *current, sysinfo_t *info)
 {
 	int r;
@@ -471,7 +944,7 @@ int box_check_socket(syd_process_t *current, sysinfo_t *info)
 
 	pid = current->pid;
 	abspath = NULL;
-	psa = xmalloc(sizeof(struct pink_sockaddr));
+	psa = scratch_alloc(sizeof(struct pink_sockaddr));
 
 	if ((r = syd_read_socket_address(current, info->decode_socketcall,
 					 info->arg_index, info->ret_fd,
@@ -508,15 +981,20 @@ int box_check_socket(syd_process_t *current, sysinfo_t *info)
 		goto report;
 	}
 
+	bool access, filtered;
 	const aclq_t *access_lists[2];
+	struct access_key key;
 	access_lists[0] = info->access_list;
 	access_lists[1] = info->access_list_global;
 
 	if (psa->family == AF_UNIX && !path_abstract(psa->u.sa_un.sun_path)) {
 		/* Non-abstract UNIX socket, resolve the path. */
-		r = box_resolve_path(psa->u.sa_un.sun_path,
-				     P_CWD(current), pid,
-				     info->rmode, &abspath);
+		r = path_is_absolute(psa->u.sa_un.sun_path)
+			? 0 : update_cwd(current);
+		if (r == 0)
+			r = box_resolve_path(psa->u.sa_un.sun_path,
+					     P_CWD(current), pid,
+					     info->rmode, &abspath);
 		if (r < 0) {
 			r = deny(current, -r);
 			if (sydbox->config.violation_raise_fail)
@@ -524,13 +1002,35 @@ int box_check_socket(syd_process_t *current, sysinfo_t *info)
 			goto out;
 		}
 
-		if (box_check_access(info->access_mode, acl_sockmatch_saun,
-				     access_lists, 2, abspath)) {
+		key.generation = syd_counter_get(sydbox->access_cache_generation);
+		key.version = P_BOX(current)->version;
+		key.mode = info->access_mode;
+		key.list = access_lists[0];
+		key.list_global = access_lists[1];
+		key.filter = info->access_filter;
+		key.path = abspath;
+		if (!box_cache_lookup(&key, &access, &filtered)) {
+			access = box_check_access(info->access_mode,
+						  acl_sockmatch_saun,
+						  access_lists, 2, abspath);
+			filtered = !access && acl_match_saun(ACL_ACTION_NONE,
+							     info->access_filter,
+							     abspath, NULL);
+			box_cache_store(&key, access, filtered);
+		}
+
+		if (access) {
 			/* access granted */
 			r = 0;
 			goto out;
 		}
 		/* access denied */
+		r = deny(current, info->deny_errno);
+		if (filtered) {
+			/* access violation filtered */
+			goto out;
+		}
+		goto report;
 	} else {
 		if (box_check_access(info->access_mode, acl_sockmatch,
 				     access_lists, 2, psa)) {
@@ -543,17 +1043,9 @@ int box_check_socket(syd_process_t *current, sysinfo_t *info)
 
 	r = deny(current, info->deny_errno);
 
-	if (psa->family == AF_UNIX && *psa->u.sa_un.sun_path != 0) {
-		/* Non-abstract UNIX socket */
-		if (acl_match_saun(ACL_ACTION_NONE, info->access_filter, abspath, NULL)) {
-			/* access violation filtered */
-			goto out;
-		}
-	} else {
-		if (acl_match_sock(ACL_ACTION_NONE, info->access_filter, psa, NULL)) {
-			/* access violation filtered */
-			goto out;
-		}
+	if (acl_match_sock(ACL_ACTION_NONE, info->access_filter, psa, NULL)) {
+		/* access violation filtered */
+		goto out;
 	}
 
 report:
@@ -564,17 +1056,17 @@ out:
 		/* Access granted. */
 		if (info->ret_abspath)
 			*info->ret_abspath = abspath;
-		else if (abspath && !info->cache_abspath)
-			free(abspath);
+		else if (!info->cache_abspath)
+			scratch_free(abspath);
 
 		if (info->ret_addr)
 			*info->ret_addr = psa;
 		else
-			free(psa);
+			scratch_free(psa);
 	} else {
-		free(psa);
-		if (abspath && !info->cache_abspath)
-			free(abspath);
+		scratch_free(psa);
+		if (!info->cache_abspath)
+			scratch_free(abspath);
 		if (info->ret_abspath)
 			*info->ret_abspath = NULL;
 		if (info->ret_addr)
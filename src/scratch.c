@@ -0,0 +1,125 @@
+/*
+ * sydbox/scratch.c
+ *
+ * Scratch area for the strings of a system call check
+ *
+ * Copyright (c) 2015 Ali Polatel <alip@exherbo.org>
+ * Released under the terms of the 3-clause BSD license
+ */
+
+#include "scratch.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "xfunc.h"
+
+/*
+ * The path arguments, their prefixes and resolved names only live as long
+ * as the stop they are checked for. Tracer threads hand them out from a
+ * fixed area which is reset at every stop, see trace(), so the common path
+ * of a check does not touch the heap. Memory which outlives the stop, e.g.
+ * the address of a bind() saved for the system call exit, has to be copied
+ * out with scratch_keep(). Threads without a scratch area, e.g. the
+ * workers, and allocations which do not fit fall back to the heap;
+ * scratch_free() tells the two apart.
+ */
+__thread struct scratch *scratch_arena;
+
+#define SCRATCH_ALIGN(size) \
+	(((size) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+static inline bool scratch_owns(const struct scratch *s, const void *ptr)
+{
+	const char *p = ptr;
+
+	return s && p >= s->buf && p < s->buf + sizeof(s->buf);
+}
+
+void scratch_attach(struct scratch *s)
+{
+	scratch_arena = s;
+	scratch_reset();
+}
+
+void *scratch_alloc(size_t size)
+{
+	void *ptr;
+	struct scratch *s = scratch_arena;
+
+	size = SCRATCH_ALIGN(size ? size : 1);
+	if (!s)
+		return xmalloc(size);
+	if (size > sizeof(s->buf) - s->used) {
+		s->overflow++;
+		return xmalloc(size);
+	}
+
+	ptr = s->buf + s->used;
+	s->last = s->used;
+	s->used += size;
+	return ptr;
+}
+
+char *scratch_strdup(const char *src)
+{
+	size_t len;
+	char *dest;
+
+	len = strlen(src) + 1;
+	dest = scratch_alloc(len);
+	memcpy(dest, src, len);
+	return dest;
+}
+
+char *scratch_printf(const char *fmt, ...)
+{
+	int len;
+	char *dest;
+	va_list ap;
+
+	va_start(ap, fmt);
+	len = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		die_errno("vsnprintf");
+
+	dest = scratch_alloc(len + 1);
+	va_start(ap, fmt);
+	vsnprintf(dest, len + 1, fmt, ap);
+	va_end(ap);
+	return dest;
+}
+
+/*
+ * Frees heap memory. Scratch memory is released by the next reset unless
+ * it is the last allocation.
+ */
+void scratch_free(void *ptr)
+{
+	struct scratch *s = scratch_arena;
+
+	if (!ptr)
+		return;
+	if (!scratch_owns(s, ptr)) {
+		free(ptr);
+		return;
+	}
+	if ((char *)ptr == s->buf + s->last)
+		s->used = s->last; /* nothing starts there any more */
+}
+
+/* Returns ptr if it is heap memory, a copy on the heap otherwise. */
+void *scratch_keep(void *ptr, size_t size)
+{
+	void *dest;
+
+	if (!ptr || !scratch_owns(scratch_arena, ptr))
+		return ptr;
+
+	dest = xmalloc(size);
+	memcpy(dest, ptr, size);
+	return dest;
+}
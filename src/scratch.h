@@ -0,0 +1,47 @@
+/*
+ * sydbox/scratch.h
+ *
+ * Scratch area for the strings of a system call check
+ *
+ * Copyright (c) 2015 Ali Polatel <alip@exherbo.org>
+ * Released under the terms of the 3-clause BSD license
+ */
+
+#ifndef SCRATCH_H
+#define SCRATCH_H 1
+
+#include <stddef.h>
+#include <string.h>
+#include "sydconf.h"
+
+struct scratch {
+	size_t used;
+	size_t last; /* offset of the last allocation */
+	unsigned long overflow; /* allocations which did not fit */
+	char buf[SYDBOX_SCRATCH_SIZE] __attribute__((aligned(sizeof(void *))));
+};
+
+/* Scratch area of the calling thread, NULL unless it is a tracer thread */
+extern __thread struct scratch *scratch_arena;
+
+void scratch_attach(struct scratch *s);
+void *scratch_alloc(size_t size);
+char *scratch_strdup(const char *src);
+char *scratch_printf(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+void scratch_free(void *ptr);
+void *scratch_keep(void *ptr, size_t size);
+
+static inline char *scratch_keepstr(char *str)
+{
+	return str ? scratch_keep(str, strlen(str) + 1) : NULL;
+}
+
+/* Everything allocated from the scratch area is released at once. */
+static inline void scratch_reset(void)
+{
+	if (scratch_arena)
+		scratch_arena->used = scratch_arena->last = 0;
+}
+
+#endif
@@ -22,6 +22,12 @@
 #include <signal.h>
 #include <string.h>
 #include <unistd.h>
+#include <assert.h>
+#include <sys/syscall.h>
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#endif
 
 int seccomp_init(void)
 {
@@ -30,61 +36,329 @@ int seccomp_init(void)
 	return 0;
 }
 
-int seccomp_apply(int arch, uint32_t *syscalls, int count)
+/* Maximum number of rules matched linearly at the leaves of the search */
+#define SECCOMP_LEAF_MAX 3
+/* Maximum offset of a conditional jump */
+#define SECCOMP_JUMP_MAX 255
+
+static int seccomp_rule_cmp(const void *a, const void *b)
 {
-	const struct sock_filter header[] = {
-		BPF_STMT(BPF_LD+BPF_W+BPF_ABS, arch_nr),
-		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, arch, 1, 0),
-		BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW),
-		BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_nr),
-	};
-	const struct sock_filter footer[] = {
-		BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW)
-	};
+	const struct seccomp_rule *ra = a, *rb = b;
 
-	int i;
-	unsigned n = count;
-	struct sock_filter *f;
-	struct sock_fprog prog;
+	if (ra->sysnum < rb->sysnum)
+		return -1;
+	return ra->sysnum > rb->sysnum;
+}
 
-	if (!syscalls)
-		return -EINVAL;
+static unsigned seccomp_rule_len(const struct seccomp_rule *rule)
+{
+	return rule->filter_len + rule->prefilter_len + 1;
+}
+
+/*
+ * The filter may deny the system call, the prefilter may allow it, both fall
+ * through to the action otherwise. The accumulator is clobbered but the
+ * program returns on every path from here.
+ */
+static unsigned seccomp_rule_fill(struct sock_filter *f,
+				  const struct seccomp_rule *rule)
+{
+	unsigned n = 0;
+
+	if (rule->filter_len > 0) {
+		memcpy(f + n, rule->filter,
+		       sizeof(struct sock_filter) * rule->filter_len);
+		n += rule->filter_len;
+	}
+	if (rule->prefilter_len > 0) {
+		memcpy(f + n, rule->prefilter,
+		       sizeof(struct sock_filter) * rule->prefilter_len);
+		n += rule->prefilter_len;
+	}
+	f[n++] = (struct sock_filter)BPF_STMT(BPF_RET+BPF_K, rule->action);
+
+	return n;
+}
+
+static unsigned seccomp_tree_len(const struct seccomp_rule *rules,
+				 unsigned lo, unsigned hi)
+{
+	unsigned i, len, mid;
+
+	if (hi - lo <= SECCOMP_LEAF_MAX) {
+		len = 1;
+		for (i = lo; i < hi; i++)
+			len += 1 + seccomp_rule_len(&rules[i]);
+		return len;
+	}
+
+	mid = lo + (hi - lo) / 2;
+	len = seccomp_tree_len(rules, lo, mid);
+	return (len > SECCOMP_JUMP_MAX ? 2 : 1) + len +
+		seccomp_tree_len(rules, mid, hi);
+}
+
+/*
+ * Binary search on the system call number in the accumulator: each node
+ * jumps over its left half if the number is greater than or equal to the
+ * pivot, the leaves compare the few remaining numbers and allow the system
+ * call if none match.
+ */
+static unsigned seccomp_tree_fill(struct sock_filter *f,
+				  const struct seccomp_rule *rules,
+				  unsigned lo, unsigned hi)
+{
+	unsigned i, n, len, mid;
+
+	n = 0;
+	if (hi - lo <= SECCOMP_LEAF_MAX) {
+		for (i = lo; i < hi; i++) {
+			len = seccomp_rule_len(&rules[i]);
+			assert(len <= SECCOMP_JUMP_MAX);
+			f[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K,
+							      rules[i].sysnum,
+							      0, len);
+			n += seccomp_rule_fill(f + n, &rules[i]);
+		}
+		f[n++] = (struct sock_filter)BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW);
+		return n;
+	}
+
+	mid = lo + (hi - lo) / 2;
+	len = seccomp_tree_len(rules, lo, mid);
+	if (len > SECCOMP_JUMP_MAX) {
+		f[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP+BPF_JGE+BPF_K,
+						      rules[mid].sysnum, 0, 1);
+		f[n++] = (struct sock_filter)BPF_STMT(BPF_JMP+BPF_JA, len);
+	} else {
+		f[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP+BPF_JGE+BPF_K,
+						      rules[mid].sysnum, len, 0);
+	}
+	n += seccomp_tree_fill(f + n, rules, lo, mid);
+	n += seccomp_tree_fill(f + n, rules, mid, hi);
 
-	/* Build the filter program from a header, the syscall matches
-	 * and the footer */
-	f = alloca(sizeof(struct sock_filter) * (ELEMENTSOF(header) + 2*n + ELEMENTSOF(footer)));
-	memcpy(f, header, sizeof(header));
+	return n;
+}
 
-	for (i = 0, n = 0; i < count; i++) {
-		struct sock_filter item[] = {
-			BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, syscalls[i], 0, 1),
-			BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_TRACE|(syscalls[i] & SECCOMP_RET_DATA))
-		};
+static unsigned seccomp_section_len(const struct seccomp_rule *rules,
+				    unsigned count)
+{
+	if (!count)
+		return 1;
+	return 4 + seccomp_tree_len(rules, 0, count);
+}
 
-		f[ELEMENTSOF(header) + 2*n] = item[0];
-		f[ELEMENTSOF(header) + 2*n+1] = item[1];
+/*
+ * System calls outside the range of the rules, e.g. read() and write(), are
+ * allowed right after loading the number.
+ */
+static unsigned seccomp_section_fill(struct sock_filter *f,
+				     const struct seccomp_rule *rules,
+				     unsigned count)
+{
+	unsigned n = 0;
 
-		n++;
+	if (!count) {
+		f[n++] = (struct sock_filter)BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW);
+		return n;
 	}
 
-	memcpy(f + ELEMENTSOF(header) + 2*n, footer, sizeof(footer));
+	f[n++] = (struct sock_filter)BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_nr);
+	f[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP+BPF_JGT+BPF_K,
+					      rules[count - 1].sysnum, 1, 0);
+	f[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP+BPF_JGE+BPF_K,
+					      rules[0].sysnum, 1, 0);
+	f[n++] = (struct sock_filter)BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW);
+	n += seccomp_tree_fill(f + n, rules, 0, count);
+
+	return n;
+}
+
+/*
+ * Compile the rules of all architectures into a single filter program and
+ * install it. The rules are sorted by system call number in place and must
+ * not contain duplicate numbers per architecture.
+ * Returns the listener file descriptor if SECCOMP_FILTER_FLAG_NEW_LISTENER
+ * is given in flags, zero on success otherwise and negated errno on failure.
+ */
+int seccomp_apply(const int *arch, struct seccomp_rule **rules,
+		  const int *count, unsigned arch_count, unsigned flags)
+{
+	int r;
+	unsigned i, n, len;
+	struct sock_filter *f;
+	struct sock_fprog prog;
+
+	if (!arch || !rules || !count)
+		return -EINVAL;
+
+	n = 2;
+	for (i = 0; i < arch_count; i++) {
+		qsort(rules[i], count[i], sizeof(struct seccomp_rule),
+		      seccomp_rule_cmp);
+		n += 2 + seccomp_section_len(rules[i], count[i]);
+	}
+
+	f = alloca(sizeof(struct sock_filter) * n);
+	n = 0;
+	f[n++] = (struct sock_filter)BPF_STMT(BPF_LD+BPF_W+BPF_ABS, arch_nr);
+	for (i = 0; i < arch_count; i++) {
+		/* Skip this section unless the architecture matches */
+		len = seccomp_section_len(rules[i], count[i]);
+		f[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, arch[i], 1, 0);
+		f[n++] = (struct sock_filter)BPF_STMT(BPF_JMP+BPF_JA, len);
+		n += seccomp_section_fill(f + n, rules[i], count[i]);
+	}
+	f[n++] = (struct sock_filter)BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW);
 
 	/* Install the filter */
 	memset(&prog, 0, sizeof(prog));
-	prog.len = ELEMENTSOF(header) + ELEMENTSOF(footer) + 2*n;
+	prog.len = n;
 	prog.filter = f;
-	if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) < 0)
+	if (!flags) {
+		if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) < 0)
+			return -errno;
+		return 0;
+	}
+#ifdef __NR_seccomp
+	r = syscall(__NR_seccomp, SECCOMP_SET_MODE_FILTER, flags, &prog);
+	if (r < 0)
+		return -errno;
+	return r;
+#else
+	return -ENOSYS;
+#endif
+}
+
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+static size_t notif_size;
+static size_t notif_resp_size;
+
+int seccomp_notify_alloc(struct seccomp_notif **req,
+			 struct seccomp_notif_resp **resp)
+{
+	struct seccomp_notif_sizes sizes;
+
+	/* The kernel structures may be larger than our headers say. */
+	if (syscall(__NR_seccomp, SECCOMP_GET_NOTIF_SIZES, 0, &sizes) < 0)
 		return -errno;
 
+	notif_size = sizeof(struct seccomp_notif);
+	if (sizes.seccomp_notif > notif_size)
+		notif_size = sizes.seccomp_notif;
+	notif_resp_size = sizeof(struct seccomp_notif_resp);
+	if (sizes.seccomp_notif_resp > notif_resp_size)
+		notif_resp_size = sizes.seccomp_notif_resp;
+
+	*req = calloc(1, notif_size);
+	if (!*req)
+		return -errno;
+	*resp = calloc(1, notif_resp_size);
+	if (!*resp) {
+		free(*req);
+		*req = NULL;
+		return -errno;
+	}
+	return 0;
+}
+
+int seccomp_notify_receive(int fd, struct seccomp_notif *req)
+{
+	memset(req, 0, notif_size);
+	while (ioctl(fd, SECCOMP_IOCTL_NOTIF_RECV, req) < 0) {
+		if (errno != EINTR)
+			return -errno;
+	}
 	return 0;
 }
+
+int seccomp_notify_respond(int fd, struct seccomp_notif_resp *resp)
+{
+	while (ioctl(fd, SECCOMP_IOCTL_NOTIF_SEND, resp) < 0) {
+		if (errno != EINTR)
+			return -errno;
+	}
+	return 0;
+}
+
+int seccomp_notify_id_valid(int fd, uint64_t id)
+{
+	if (ioctl(fd, SECCOMP_IOCTL_NOTIF_ID_VALID, &id) < 0)
+		return -errno;
+	return 0;
+}
+
+/* Pass the listener file descriptor to the tracer over a UNIX socket. */
+int seccomp_listener_send(int sock, int fd)
+{
+	char dummy = 0;
+	char buf[CMSG_SPACE(sizeof(int))];
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+
+	memset(buf, 0, sizeof(buf));
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &dummy;
+	iov.iov_len = sizeof(dummy);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = buf;
+	msg.msg_controllen = sizeof(buf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	if (sendmsg(sock, &msg, 0) < 0)
+		return -errno;
+	return 0;
+}
+
+int seccomp_listener_recv(int sock)
+{
+	int fd;
+	ssize_t r;
+	char dummy;
+	char buf[CMSG_SPACE(sizeof(int))];
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &dummy;
+	iov.iov_len = sizeof(dummy);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = buf;
+	msg.msg_controllen = sizeof(buf);
+
+	do {
+		r = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	} while (r < 0 && errno == EINTR);
+	if (r < 0)
+		return -errno;
+	else if (r == 0)
+		return -EPIPE; /* child exited before sending the listener */
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+	    cmsg->cmsg_type != SCM_RIGHTS)
+		return -EBADMSG;
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	return fd;
+}
+#endif
 #else
 int seccomp_init(void)
 {
 	return -ENOTSUP;
 }
 
-int seccomp_apply(int arch, uint32_t *syscalls, int count)
+int seccomp_apply(const int *arch, struct seccomp_rule **rules,
+		  const int *count, unsigned arch_count, unsigned flags)
 {
 	return -ENOTSUP;
 }
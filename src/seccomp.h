@@ -27,6 +27,7 @@
 # define syscall_arg(_n) (offsetof(struct seccomp_data, args[_n]))
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 #ifdef HAVE_LINUX_AUDIT_H
 # include <linux/audit.h>
@@ -35,7 +36,35 @@
 # define AUDIT_ARCH_X86_64	(62|0x80000000|0x40000000)
 #endif
 
+/*
+ * Filter program rule for a system call, see sysfilter_t in sydbox.h.
+ * The filter may deny the system call, the prefilter may allow it and the
+ * action is returned if neither does.
+ */
+struct seccomp_rule {
+	uint32_t sysnum;
+	uint32_t action;
+	const struct sock_filter *filter;
+	size_t filter_len;
+	const struct sock_filter *prefilter;
+	size_t prefilter_len;
+};
+
 int seccomp_init(void);
-int seccomp_apply(int arch, uint32_t *syscalls, int count);
+int seccomp_apply(const int *arch, struct seccomp_rule **rules,
+		  const int *count, unsigned arch_count, unsigned flags);
+
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+struct seccomp_notif;
+struct seccomp_notif_resp;
+
+int seccomp_notify_alloc(struct seccomp_notif **req,
+			 struct seccomp_notif_resp **resp);
+int seccomp_notify_receive(int fd, struct seccomp_notif *req);
+int seccomp_notify_respond(int fd, struct seccomp_notif_resp *resp);
+int seccomp_notify_id_valid(int fd, uint64_t id);
+int seccomp_listener_send(int sock, int fd);
+int seccomp_listener_recv(int sock);
+#endif
 
 #endif
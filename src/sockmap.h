@@ -15,20 +15,62 @@
 #include "sockmatch.h"
 #include "sydhash.h"
 
+struct acl_node;
+
 struct sockmap {
 	int fd;
-	struct sockinfo *info;
+	struct sockinfo *info; /* bind() with port zero, see sys_getsockname() */
+	struct acl_node *node; /* automatic whitelist entry held by the socket */
 	UT_hash_handle hh;
 };
 
-static inline void sockmap_add(struct sockmap **map, int fd, struct sockinfo *info)
+/* Reference counting of automatic whitelist entries, see syscall-sock.c */
+void sockmap_release(struct acl_node *node);
+void sockmap_retain(struct acl_node *node);
+
+static inline void sockmap_del(struct sockmap **map, struct sockmap *s)
 {
-	struct sockmap *s = xmalloc(sizeof(struct sockmap));
+	HASH_DEL(*map, s);
+	if (s->info)
+		free_sockinfo(s->info);
+	if (s->node)
+		sockmap_release(s->node);
+	free(s);
+}
+
+static inline void sockmap_remove(struct sockmap **map, int fd)
+{
+	struct sockmap *s;
+
+	if (!*map)
+		return;
+
+	HASH_FIND_INT(*map, &fd, s);
+	if (s)
+		sockmap_del(map, s);
+}
+
+static inline void sockmap_add_full(struct sockmap **map, int fd,
+				    struct sockinfo *info,
+				    struct acl_node *node)
+{
+	struct sockmap *s;
+
+	/* the file descriptor was closed behind our back */
+	sockmap_remove(map, fd);
+
+	s = xmalloc(sizeof(struct sockmap));
 	s->fd = fd;
 	s->info = info;
+	s->node = node;
 	HASH_ADD_INT(*map, fd, s);
 }
 
+static inline void sockmap_add(struct sockmap **map, int fd, struct sockinfo *info)
+{
+	sockmap_add_full(map, fd, info, NULL);
+}
+
 static inline const struct sockinfo *sockmap_find(struct sockmap **map, int fd)
 {
 	struct sockmap *s;
@@ -40,20 +82,46 @@ static inline const struct sockinfo *sockmap_find(struct sockmap **map, int fd)
 	return s ? s->info : NULL;
 }
 
-static inline void sockmap_remove(struct sockmap **map, int fd)
+/* newfd refers to the same socket as oldfd from now on */
+static inline void sockmap_dup(struct sockmap **map, int oldfd, int newfd)
 {
 	struct sockmap *s;
 
+	if (oldfd == newfd)
+		return;
+
+	sockmap_remove(map, newfd);
 	if (!*map)
 		return;
 
-	HASH_FIND_INT(*map, &fd, s);
-	HASH_DEL(*map, s);
-	free_sockinfo(s->info);
-	free(s);
+	HASH_FIND_INT(*map, &oldfd, s);
+	if (!s)
+		return;
+	if (s->node)
+		sockmap_retain(s->node);
+	sockmap_add_full(map, newfd, s->info ? sockinfo_xdup(s->info) : NULL,
+			 s->node);
 }
 
-static inline void sockmap_destroy(struct sockmap **map)
+/* Copy the table for a new process which does not share it */
+static inline void sockmap_copy(struct sockmap **dest, struct sockmap **src)
+{
+	struct sockmap *e, *t;
+
+	if (!*src)
+		return;
+
+	HASH_ITER(hh, *src, e, t) {
+		if (e->node)
+			sockmap_retain(e->node);
+		sockmap_add_full(dest, e->fd,
+				 e->info ? sockinfo_xdup(e->info) : NULL,
+				 e->node);
+	}
+}
+
+static inline void sockmap_remove_range(struct sockmap **map,
+					unsigned first, unsigned last)
 {
 	struct sockmap *e, *t;
 
@@ -61,11 +129,20 @@ static inline void sockmap_destroy(struct sockmap **map)
 		return;
 
 	HASH_ITER(hh, *map, e, t) {
-		if (e->info)
-			free_sockinfo(e->info);
-		HASH_DEL(*map, e);
-		free(e);
+		if ((unsigned)e->fd >= first && (unsigned)e->fd <= last)
+			sockmap_del(map, e);
 	}
+}
+
+static inline void sockmap_destroy(struct sockmap **map)
+{
+	struct sockmap *e, *t;
+
+	if (!*map)
+		return;
+
+	HASH_ITER(hh, *map, e, t)
+		sockmap_del(map, e);
 	HASH_CLEAR(hh, *map);
 }
 
@@ -73,6 +73,34 @@ struct sockmatch *sockmatch_xdup(const struct sockmatch *src)
 	return match;
 }
 
+bool sockmatch_equal(const struct sockmatch *a, const struct sockmatch *b)
+{
+	if (a->family != b->family)
+		return false;
+
+	switch (a->family) {
+	case AF_UNIX:
+		return a->addr.sa_un.abstract == b->addr.sa_un.abstract &&
+			streq(a->addr.sa_un.path, b->addr.sa_un.path);
+	case AF_INET:
+		return a->addr.sa_in.netmask == b->addr.sa_in.netmask &&
+			a->addr.sa_in.port[0] == b->addr.sa_in.port[0] &&
+			a->addr.sa_in.port[1] == b->addr.sa_in.port[1] &&
+			!memcmp(&a->addr.sa_in.addr, &b->addr.sa_in.addr,
+				sizeof(struct in_addr));
+#if SYDBOX_HAVE_IPV6
+	case AF_INET6:
+		return a->addr.sa6.netmask == b->addr.sa6.netmask &&
+			a->addr.sa6.port[0] == b->addr.sa6.port[0] &&
+			a->addr.sa6.port[1] == b->addr.sa6.port[1] &&
+			!memcmp(&a->addr.sa6.addr, &b->addr.sa6.addr,
+				sizeof(struct in6_addr));
+#endif
+	default:
+		return false;
+	}
+}
+
 int sockmatch_expand(const char *src, char ***buf)
 {
 	const char *port;
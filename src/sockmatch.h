@@ -63,6 +63,7 @@ struct sockmatch {
 
 struct sockinfo *sockinfo_xdup(const struct sockinfo *src);
 struct sockmatch *sockmatch_xdup(const struct sockmatch *src);
+bool sockmatch_equal(const struct sockmatch *a, const struct sockmatch *b);
 
 /* Expand network aliases and unix wildmatch patterns */
 int sockmatch_expand(const char *src, char ***buf);
@@ -15,6 +15,7 @@
 
 #include <time.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,12 +28,18 @@
 #include <sys/stat.h>
 #include <sys/utsname.h>
 #include <getopt.h>
+#include <poll.h>
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+#include <sys/socket.h>
+#endif
 #include "asyd.h"
 #include "macro.h"
+#include "bsd-compat.h"
 #include "file.h"
 #include "pathlookup.h"
 #include "proc.h"
 #include "util.h"
+#include "worker.h"
 #if SYDBOX_HAVE_SECCOMP
 #include "seccomp.h"
 #endif
@@ -55,7 +62,7 @@ static int post_attach_sigstop = SYD_IGNORE_ONE_SIGSTOP;
 # define NR_OPEN 1024
 #endif
 
-#define switch_execve_flags(f) ((f) & ~(SYD_IN_CLONE|SYD_IN_EXECVE|SYD_IN_SYSCALL|SYD_KILLED))
+#define switch_execve_flags(f) ((f) & ~(SYD_IN_CLONE|SYD_IN_EXECVE|SYD_IN_SYSCALL|SYD_KILLED|SYD_FDCACHE_BUSY))
 
 sydbox_t *sydbox;
 static unsigned os_release;
@@ -84,6 +91,11 @@ static void about(void)
 	printf(" seccomp:yes");
 #else
 	printf(" seccomp:no");
+#endif
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+	printf(" notify:yes");
+#else
+	printf(" notify:no");
 #endif
 	printf(" ipv6:%s", PINK_HAVE_IPV6 ? "yes" : "no");
 	printf(" netlink:%s", PINK_HAVE_NETLINK ? "yes" : "no");
@@ -161,14 +173,27 @@ static void kill_save_errno(pid_t pid, int sig)
 	errno = saved_errno;
 }
 
-static void new_shared_memory_clone_thread(struct syd_process *p)
+static void *shm_alloc(struct syd_pool *pool, size_t size)
+{
+	void *ptr;
+
+	ptr = pool_get(pool);
+	return ptr ? ptr : xmalloc(size);
+}
+
+static void new_shared_memory_clone_thread(struct syd_process *p, sandbox_t *box)
 {
 	int r;
 
-	p->shm.clone_thread = xmalloc(sizeof(struct syd_process_shared_clone_thread));
+	p->shm.clone_thread = shm_alloc(TRACER_POOL(clone_thread_pool),
+					sizeof(struct syd_process_shared_clone_thread));
 	p->shm.clone_thread->refcnt = 1;
-	if ((r = new_sandbox(&p->shm.clone_thread->box)) < 0) {
-		free(p->shm.clone_thread);
+	if (box) {
+		/* copy on write, see box_unshare() */
+		p->shm.clone_thread->box = box;
+		box->refcnt++;
+	} else if ((r = new_sandbox(&p->shm.clone_thread->box)) < 0) {
+		pool_free(TRACER_POOL(clone_thread_pool), p->shm.clone_thread);
 		errno = -r;
 		die_errno("new_sandbox");
 	}
@@ -176,22 +201,28 @@ static void new_shared_memory_clone_thread(struct syd_process *p)
 
 static void new_shared_memory_clone_fs(struct syd_process *p)
 {
-	p->shm.clone_fs = xmalloc(sizeof(struct syd_process_shared_clone_fs));
+	p->shm.clone_fs = shm_alloc(TRACER_POOL(clone_fs_pool),
+				    sizeof(struct syd_process_shared_clone_fs));
 	p->shm.clone_fs->refcnt = 1;
 	p->shm.clone_fs->cwd = NULL;
+	p->shm.clone_fs->cwd_stale = false;
 }
 
 static void new_shared_memory_clone_files(struct syd_process *p)
 {
-	p->shm.clone_files = xmalloc(sizeof(struct syd_process_shared_clone_files));
+	p->shm.clone_files = shm_alloc(TRACER_POOL(clone_files_pool),
+				       sizeof(struct syd_process_shared_clone_files));
 	p->shm.clone_files->refcnt = 1;
 	p->shm.clone_files->savebind = NULL;
 	p->shm.clone_files->sockmap = NULL;
+	p->shm.clone_files->fdcache = NULL;
+	p->shm.clone_files->fdcache_off = false;
+	p->shm.clone_files->fdcache_busy = 0;
 }
 
 static void new_shared_memory(struct syd_process *p)
 {
-	new_shared_memory_clone_thread(p);
+	new_shared_memory_clone_thread(p, NULL);
 	new_shared_memory_clone_fs(p);
 	new_shared_memory_clone_files(p);
 }
@@ -199,22 +230,30 @@ static void new_shared_memory(struct syd_process *p)
 static syd_process_t *new_thread(pid_t pid, short flags)
 {
 	int r;
+	struct pink_regset *regset;
 	syd_process_t *thread;
 
-	thread = calloc(1, sizeof(syd_process_t));
-	if (!thread)
-		return NULL;
+	/* Buried records come with their regset, see free_process(). */
+	thread = pool_get(TRACER_POOL(proc_pool));
+	if (thread) {
+		regset = thread->regset;
+		memset(thread, 0, sizeof(syd_process_t));
+		thread->regset = regset;
+	} else {
+		thread = calloc(1, sizeof(syd_process_t));
+		if (!thread)
+			return NULL;
+		if ((r = pink_regset_alloc(&thread->regset)) < 0) {
+			free(thread);
+			errno = -r;
+			return NULL;
+		}
+	}
 
 	thread->pid = pid;
 	thread->ppid = SYD_PPID_NONE;
 	thread->tgid = SYD_TGID_NONE;
 
-	if ((r = pink_regset_alloc(&thread->regset)) < 0) {
-		free(thread);
-		errno = -r;
-		return NULL;
-	}
-
 	thread->abi = PINK_ABI_DEFAULT;
 	thread->flags = SYD_STARTUP | flags;
 	thread->trace_step = SYD_STEP_NOT_SET;
@@ -232,7 +271,7 @@ static syd_process_t *new_process(pid_t pid, short flags)
 	process = new_thread(pid, flags);
 	if (!process)
 		return NULL;
-	process->tgid = process->pid;
+	process_set_tgid(process, process->pid);
 	new_shared_memory(process);
 
 	return process;
@@ -331,8 +370,8 @@ static void init_shareable_data(syd_process_t *current, syd_process_t *parent)
 	 * sandbox information can no longer be edited. Treat such cases as
 	 * `threads'. (Threads only share sandbox_t which is constant when
 	 * magic_lock is set.)
-	 * TODO: We need to simplify the sandbox data structure to take more
-	 * advantage of such cases and decrease memory usage.
+	 * Other processes share the sandbox_t of the parent until either of
+	 * them edits it, see box_unshare().
 	 */
 	current->clone_flags = parent->new_clone_flags;
 
@@ -340,8 +379,7 @@ static void init_shareable_data(syd_process_t *current, syd_process_t *parent)
 		current->shm.clone_thread = parent->shm.clone_thread;
 		P_CLONE_THREAD_RETAIN(current);
 	} else {
-		new_shared_memory_clone_thread(current);
-		copy_sandbox(P_BOX(current), box_current(parent));
+		new_shared_memory_clone_thread(current, P_BOX(parent));
 	}
 
 	if (share_fs) {
@@ -350,6 +388,7 @@ static void init_shareable_data(syd_process_t *current, syd_process_t *parent)
 	} else {
 		new_shared_memory_clone_fs(current);
 		P_CWD(current) = xstrdup(P_CWD(parent));
+		P_CWD_STALE(current) = P_CWD_STALE(parent);
 	}
 
 	if (share_files) {
@@ -357,6 +396,8 @@ static void init_shareable_data(syd_process_t *current, syd_process_t *parent)
 		P_CLONE_FILES_RETAIN(current);
 	} else {
 		new_shared_memory_clone_files(current);
+		/* the sockets of the parent are inherited */
+		sockmap_copy(&P_SOCKMAP(current), &P_SOCKMAP(parent));
 	}
 }
 
@@ -366,7 +407,9 @@ static void init_process_data(syd_process_t *current, syd_process_t *parent)
 
 	if (sydbox->config.whitelist_per_process_directories &&
 	    (!parent || current->pid != parent->pid)) {
+		auto_lock();
 		procadd(&sydbox->config.hh_proc_pid_auto, current->pid);
+		auto_unlock();
 	}
 }
 
@@ -379,16 +422,17 @@ static syd_process_t *clone_process(syd_process_t *p, pid_t cpid)
 		child = new_thread_or_kill(cpid, post_attach_sigstop);
 	if (p->new_clone_flags & CLONE_THREAD) {
 		child->ppid = p->ppid;
-		child->tgid = p->tgid;
+		process_set_tgid(child, p->tgid);
 	} else {
 		child->ppid = p->pid;
-		child->tgid = child->pid;
+		process_set_tgid(child, child->pid);
 	}
 	init_process_data(child, p);
 
 	/* clone OK: p->pid <-> cpid */
 	p->new_clone_flags = 0;
 	p->flags &= ~SYD_IN_CLONE;
+	process_update_forking(p);
 	if (p->flags & SYD_KILLED) {
 		/* Parent had died already and we do not need the process entry
 		 * anymore. Farewell. */
@@ -398,6 +442,16 @@ static syd_process_t *clone_process(syd_process_t *p, pid_t cpid)
 	return child;
 }
 
+/* Keeps the record together with its regset for the next new_thread() */
+static void free_process(syd_process_t *p)
+{
+	if (p->regset && pool_put(TRACER_POOL(proc_pool), p))
+		return;
+	if (p->regset)
+		pink_regset_free(p->regset);
+	free(p);
+}
+
 void bury_process(syd_process_t *p)
 {
 	pid_t pid;
@@ -407,33 +461,42 @@ void bury_process(syd_process_t *p)
 	pid = p->pid;
 	dump(DUMP_THREAD_FREE, pid);
 
+	if (p->flags & SYD_HANDOFF && p->handoff_to != tracer) {
+		/* died before the hand-over */
+		tracer_unclaim(p->handoff_to);
+	}
+
 	if (p->abspath) {
 		free(p->abspath);
 		p->abspath = NULL;
 	}
-	if (p->regset) {
-		pink_regset_free(p->regset);
-		p->regset = NULL;
-	}
+	box_worker_cancel(p);
 
 	process_remove(p);
 
 	/* Release shared memory */
+	fdcache_done(p);
 	P_CLONE_THREAD_RELEASE(p);
 	P_CLONE_FS_RELEASE(p);
 	P_CLONE_FILES_RELEASE(p);
 
-	if (sydbox->config.whitelist_per_process_directories)
+	if (sydbox->config.whitelist_per_process_directories) {
+		auto_lock();
 		procdrop(&sydbox->config.hh_proc_pid_auto, pid);
+		auto_unlock();
+	}
 
-	free(p); /* good bye, good bye, good bye. */
+	free_process(p); /* good bye, good bye, good bye. */
 }
 
 /* Drop leader, switch to the thread, reusing leader's tid */
 static void tweak_execve_thread(syd_process_t *execve_thread, pid_t leader_pid, short flags)
 {
-	if (sydbox->config.whitelist_per_process_directories)
+	if (sydbox->config.whitelist_per_process_directories) {
+		auto_lock();
 		procdrop(&sydbox->config.hh_proc_pid_auto, execve_thread->pid);
+		auto_unlock();
+	}
 	process_remove(execve_thread);
 
 	execve_thread->pid = leader_pid;
@@ -446,30 +509,32 @@ static void switch_execve_leader(syd_process_t *leader, syd_process_t *execve_th
 {
 	process_remove(leader);
 
+	fdcache_done(leader);
 	P_CLONE_THREAD_RELEASE(leader);
 	P_CLONE_FS_RELEASE(leader);
 	P_CLONE_FILES_RELEASE(leader);
 
-	if (leader->regset)
-		pink_regset_free(leader->regset);
 	if (execve_thread->abspath)
 		free(execve_thread->abspath);
 
 	tweak_execve_thread(execve_thread, leader->pid, leader->flags);
 	execve_thread->ppid = leader->ppid;
-	execve_thread->tgid = leader->tgid;
+	process_set_tgid(execve_thread, leader->tgid);
 	execve_thread->clone_flags = leader->clone_flags;
 	execve_thread->abspath = leader->abspath;
 
-	free(leader);
+	free_process(leader);
 }
 
 void remove_process_node(syd_process_t *p)
 {
 	if (p->flags & SYD_IN_CLONE || p->flags & SYD_IN_EXECVE) {
 		/* Let's wait for the children before the funeral. */
-		if (sydbox->config.whitelist_per_process_directories)
+		if (sydbox->config.whitelist_per_process_directories) {
+			auto_lock();
 			procdrop(&sydbox->config.hh_proc_pid_auto, p->pid);
+			auto_unlock();
+		}
 		p->flags |= SYD_KILLED;
 	} else if (!(p->flags & SYD_KILLED)) {
 		bury_process(p);
@@ -483,12 +548,16 @@ static void remove_process(pid_t pid, int status)
 	if (pid == sydbox->execve_pid)
 		save_exit_status(status);
 
+	/* Died before the clone event of its parent. */
+	pidmap_del(&tracer->early_children, pid);
+
 	p = lookup_process(pid);
 	if (!p)
 		return;
 	/* This is a proper exit notification,
 	 * no more children expected, clear flags. */
 	p->flags &= ~(SYD_IN_CLONE|SYD_IN_EXECVE|SYD_KILLED);
+	process_update_forking(p);
 
 	remove_process_node(p);
 }
@@ -497,7 +566,7 @@ static syd_process_t *parent_process(pid_t pid_task, syd_process_t *p_task)
 {
 	pid_t ppid;
 	unsigned short parent_count;
-	syd_process_t *parent_node, *node, *tmp;
+	syd_process_t *parent_node, *node;
 
 	/* Try (really) hard to find the parent process. */
 
@@ -515,16 +584,15 @@ static syd_process_t *parent_process(pid_t pid_task, syd_process_t *p_task)
 
 	/* Step 3: Check for IN_CLONE|IN_EXECVE flags and /proc/$pid/task
 	 * We need IN_EXECVE for threaded exec -> leader lost case.
+	 * Only the processes on the forking list have these flags set.
 	 */
 	parent_count = 0;
-	process_iter(node, tmp) {
-		if (node->flags & (SYD_IN_CLONE|SYD_IN_EXECVE)) {
-			if (!syd_proc_task_find(node->pid, pid_task))
-				return node;
-			if (parent_count < 2) {
-				parent_count++;
-				parent_node = node;
-			}
+	for (node = tracer->forking; node; node = node->fork_next) {
+		if (!syd_proc_task_find(node->pid, pid_task))
+			return node;
+		if (parent_count < 2) {
+			parent_count++;
+			parent_node = node;
 		}
 	}
 
@@ -535,11 +603,126 @@ static syd_process_t *parent_process(pid_t pid_task, syd_process_t *p_task)
 	return NULL;
 }
 
+/*
+ * Hand-over of new processes between tracer threads, see tracer.c:
+ * A new process is claimed by an idle tracer at startup. At its first
+ * trapped system call, which comes before it can clone or execute, the
+ * system call is replaced with pause(2) and the process is detached. The
+ * new tracer seizes and interrupts it, then puts the original system call
+ * back for the kernel to restart it. Unlike a group-stop this is not
+ * reported to the parent. Detached, the process gets ENOSYS for trapped
+ * system calls, hence seccomp is required. Processes sharing anything but
+ * the sandbox with their parent stay with the tracer of the parent.
+ */
+static bool handoff_start(syd_process_t *current)
+{
+	sandbox_t *box;
+	syd_tracer_t *t;
+
+	if (!multi_tracer() ||
+	    current->pid != current->tgid ||
+	    current->ppid == SYD_PPID_NONE ||
+	    current->clone_flags & (CLONE_THREAD|CLONE_FS|CLONE_FILES) ||
+	    current->flags & SYD_KILLED)
+		return false;
+	if (!(t = tracer_claim()))
+		return false;
+
+	/* The sandbox is copied on write, copy it now. */
+	if (current->shm.clone_thread->refcnt > 1) {
+		box = P_BOX(current);
+		P_CLONE_THREAD_RELEASE(current);
+		new_shared_memory_clone_thread(current, box);
+	}
+	box_unshare(current);
+
+	current->flags |= SYD_HANDOFF;
+	current->handoff_to = t;
+	return true;
+}
+
+/* Returns true if the process was parked and handed over. */
+static bool handoff_park(syd_process_t *current)
+{
+	long sysnum, pause_sysnum;
+	syd_tracer_t *t = current->handoff_to;
+
+	if (syd_regset_fill(current) < 0 ||
+	    syd_read_syscall(current, &sysnum) < 0)
+		return false; /* dead, bury_process() gives back the tracer */
+
+	pause_sysnum = pink_lookup_syscall("pause", current->abi);
+	if (pause_sysnum < 0) {
+		/* nowhere to park, keep the process */
+		current->flags &= ~SYD_HANDOFF;
+		current->handoff_to = NULL;
+		tracer_unclaim(t);
+		return false;
+	}
+
+	/*
+	 * Note, unlike syd_trace_detach() this detaches with seccomp too:
+	 * the process waits in pause(2) until it's seized.
+	 */
+	if (syd_write_syscall(current, pause_sysnum) < 0 ||
+	    pink_trace_detach(current->pid, 0) < 0)
+		return false;
+	current->handoff_sysnum = sysnum;
+	process_remove(current);
+	tracer_push(t, current);
+	return true;
+}
+
+/* Restarts the original system call in the PTRACE_INTERRUPT-stop. */
+static void handoff_resume(syd_process_t *current)
+{
+	long sysnum;
+
+	current->flags &= ~SYD_HANDOFF;
+	current->handoff_to = NULL;
+
+	/*
+	 * The kernel restarts the interrupted pause(2) with the system call
+	 * number we write. A signal handler may have cut the pause short
+	 * already, the process saw EINTR then.
+	 */
+	if (syd_regset_fill(current) < 0 ||
+	    syd_read_syscall(current, &sysnum) < 0)
+		return;
+	if (sysnum == pink_lookup_syscall("pause", current->abi) &&
+	    syd_write_syscall(current, current->handoff_sysnum) < 0)
+		return;
+	syd_trace_step(current, 0);
+}
+
+static void handoff_receive(syd_process_t *list)
+{
+	syd_process_t *p, *next;
+
+	for (p = list; p; p = next) {
+		next = p->handoff_next;
+		p->handoff_next = NULL;
+
+		process_add(p);
+		tracer->handoff_in++;
+		if (pink_trace_seize(p->pid, sydbox->trace_options) < 0 ||
+		    pink_trace_interrupt(p->pid) < 0) {
+			/* dead already */
+			bury_process(p);
+		}
+	}
+}
+
 static void interrupt(int sig)
 {
 	interrupted = sig;
 }
 
+static void wakeup(int sig)
+{
+	/* SIGCHLD: interrupt ppoll() to reap ptrace events. */
+}
+
 static unsigned get_os_release(void)
 {
 	unsigned rel;
@@ -878,8 +1061,13 @@ static void dump_one_process(syd_process_t *current, bool verbose)
 static void sig_usr(int sig)
 {
 	bool complete_dump;
-	unsigned count;
-	syd_process_t *node, *tmp;
+	unsigned i, j, count;
+	unsigned long access_hit, access_miss, fd_hit, fd_miss;
+	unsigned long stops, loop_syscalls, scratch_overflow;
+	unsigned long proc_reused, proc_allocated;
+	unsigned long early_children, parent_lookups;
+	syd_tracer_t *t;
+	syd_process_t *node;
 
 	if (!sydbox)
 		return;
@@ -895,11 +1083,60 @@ static void sig_usr(int sig)
 
 	fprintf(stderr, "sydbox: Dumping process tree:\n");
 	count = 0;
-	process_iter(node, tmp) {
-		dump_one_process(node, complete_dump);
-		count++;
+	access_hit = access_miss = fd_hit = fd_miss = 0;
+	stops = loop_syscalls = scratch_overflow = 0;
+	proc_reused = proc_allocated = 0;
+	early_children = parent_lookups = 0;
+	for (i = 0; i < sydbox->tracer_count; i++) {
+		t = &sydbox->tracers[i];
+		if (t != tracer)
+			tracer_lock(t);
+		pidmap_iter(&t->proctab, j, node) {
+			dump_one_process(node, complete_dump);
+			count++;
+		}
+		if (t != tracer)
+			tracer_unlock(t);
+		access_hit += t->access_cache_hit;
+		access_miss += t->access_cache_miss;
+		fd_hit += t->fd_cache_hit;
+		fd_miss += t->fd_cache_miss;
+		stops += t->stops;
+		loop_syscalls += t->loop_syscalls;
+		scratch_overflow += t->scratch.overflow;
+		proc_reused += t->proc_pool.reused;
+		proc_allocated += t->proc_pool.allocated;
+		early_children += t->early_children_seen;
+		parent_lookups += t->parent_lookups;
 	}
 	fprintf(stderr, "Tracing %u process%s\n", count, count > 1 ? "es" : "");
+	fprintf(stderr, "Event loop: %lu stops, %.2f system calls to wait and resume per stop\n",
+		stops, stops ? (double)loop_syscalls / stops : 0.0);
+	fprintf(stderr, "Process records: %lu reused, %lu allocated\n",
+		proc_reused, proc_allocated);
+	fprintf(stderr, "New children: %lu stopped before the clone event, %lu parents looked up in /proc\n",
+		early_children, parent_lookups);
+	fprintf(stderr, "Access cache: %lu hits, %lu misses\n",
+		access_hit, access_miss);
+	if (scratch_overflow)
+		fprintf(stderr, "Scratch area: %lu allocations did not fit (SYDBOX_SCRATCH_SIZE)\n",
+			scratch_overflow);
+	if (sydbox->config.use_fd_cache)
+		fprintf(stderr, "Fd path cache: %lu hits (/proc readlinks saved), %lu misses\n",
+			fd_hit, fd_miss);
+	for (i = 0; multi_tracer() && i < sydbox->tracer_count; i++) {
+		t = &sydbox->tracers[i];
+		fprintf(stderr, "Tracer %u: %lu stops, %lu processes taken over, %lu handed over\n",
+			t->id, t->stops, t->handoff_in, t->handoff_out);
+	}
+	if (worker_fd() >= 0) {
+		struct worker_stats stats;
+
+		worker_get_stats(&stats);
+		fprintf(stderr, "Workers: %u threads, %lu checks done, %u pending at most\n",
+			sydbox->config.worker_threads,
+			stats.finished, stats.max_pending);
+	}
 }
 
 static void init_early(void)
@@ -908,7 +1145,16 @@ static void init_early(void)
 
 	os_release = get_os_release();
 	sydbox = xmalloc(sizeof(sydbox_t));
-	sydbox->proctab = NULL;
+	sydbox->tracers = NULL;
+	sydbox->tracer_count = 0;
+	sydbox->notify_fd = -1;
+	sydbox->notify_req = NULL;
+	sydbox->notify_resp = NULL;
+	sydbox->notify_current = NULL;
+	sydbox->sandbox_locked = 0;
+	sydbox->sandbox_version = 0;
+	sydbox->access_cache_generation = 1;
+	sydbox->fd_cache_generation = 1;
 	sydbox->violation = false;
 	sydbox->execve_wait = false;
 	sydbox->exit_code = EXIT_SUCCESS;
@@ -941,14 +1187,17 @@ static void init_signals(void)
 	x_sigaction(SIGTTIN, &sa, NULL); /* SIG_IGN */
 	x_sigaction(SIGTSTP, &sa, NULL); /* SIG_IGN */
 
-	sigaddset(&blocked_set, SIGHUP);
-	sigaddset(&blocked_set, SIGINT);
-	sigaddset(&blocked_set, SIGQUIT);
-	sigaddset(&blocked_set, SIGPIPE);
-	sigaddset(&blocked_set, SIGTERM);
-	sigaddset(&blocked_set, SIGABRT);
-	sigaddset(&blocked_set, SIGUSR1);
-	sigaddset(&blocked_set, SIGUSR2);
+	/*
+	 * The interrupting signals are never blocked: interrupt() only records
+	 * the signal, which is handled between two stops, see check_interrupt().
+	 * Without SA_RESTART they make waitpid() fail with EINTR so waiting is a
+	 * single system call and there's no sigprocmask() per stop.
+	 */
+	if (sydbox->notify_fd >= 0 || worker_fd() >= 0) {
+		sigaddset(&blocked_set, SIGCHLD);
+		sa.sa_handler = wakeup;
+		x_sigaction(SIGCHLD, &sa, NULL);
+	}
 
 	sa.sa_handler = interrupt;
 	x_sigaction(SIGHUP, &sa, NULL);
@@ -961,6 +1210,9 @@ static void init_signals(void)
 	x_sigaction(SIGUSR2, &sa, NULL);
 
 #undef x_sigaction
+
+	/* SIGCHLD is let through in ppoll() only, see wait_event(). */
+	sigprocmask(SIG_SETMASK, &blocked_set, NULL);
 }
 
 static int handle_interrupt(int sig)
@@ -978,18 +1230,15 @@ static int handle_interrupt(int sig)
 	}
 }
 
+/* Handles the signal interrupt() recorded, makes no system calls otherwise. */
 static int check_interrupt(void)
 {
-	int r = 0;
-
-	sigprocmask(SIG_SETMASK, &empty_set, NULL);
-	if (interrupted) {
-		int sig = interrupted;
-		r = handle_interrupt(sig);
-	}
-	sigprocmask(SIG_BLOCK, &blocked_set, NULL);
+	int sig = interrupted;
 
-	return r;
+	if (!sig)
+		return 0;
+	interrupted = 0;
+	return handle_interrupt(sig);
 }
 
 static int event_startup(syd_process_t *current)
@@ -1023,6 +1272,13 @@ static int event_clone(syd_process_t *current)
 
 	clone_process(current, cpid);
 
+	/* Its first stop came first, handle it next, see trace(). */
+	void *early = pidmap_del(&tracer->early_children, cpid);
+	if (early) {
+		tracer->replay_pid = cpid;
+		tracer->replay_status = (int)(intptr_t)early;
+	}
+
 	return 0;
 }
 
@@ -1043,19 +1299,30 @@ static int event_exec(syd_process_t *current)
 
 	if (P_BOX(current)->magic_lock == LOCK_PENDING) {
 		/* magic commands are locked */
-		P_BOX(current)->magic_lock = LOCK_SET;
+		box_unshare(current)->magic_lock = LOCK_SET;
 	}
 
+	/* The execve(2) is done, no children are to be expected from it. */
+	current->flags &= ~SYD_IN_EXECVE;
+	process_update_forking(current);
+
 	/* Drop all threads except this one */
-	syd_process_t *node, *tmp;
-	process_iter(node, tmp) {
-		if (current->pid != node->pid &&
-		    current->tgid == node->tgid &&
-		    current->shm.clone_thread == node->shm.clone_thread) {
-			remove_process_node(node); /* process_iter is delete-safe. */
-		}
+	syd_process_t *node, *next;
+	for (node = lookup_thread_group(current->tgid); node; node = next) {
+		next = node->thread_next;
+		if (current != node &&
+		    current->shm.clone_thread == node->shm.clone_thread)
+			remove_process_node(node); /* unlinks node at most */
 	}
 
+	/*
+	 * execve(2) closes O_CLOEXEC file descriptors and unshares the file
+	 * descriptor table with processes other than the dropped threads.
+	 */
+	fdcache_destroy(&P_FDCACHE(current));
+	if (P_CLONE_FILES_REFCNT(current) > 1)
+		P_FDCACHE_OFF(current) = true;
+
 	if (!current->abspath) /* nothing left to do */
 		return 0;
 
@@ -1158,16 +1425,248 @@ static int event_seccomp(syd_process_t *current)
 }
 #endif
 
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+static short notify_abi(uint32_t arch)
+{
+#if defined(__x86_64__)
+	if (arch == AUDIT_ARCH_I386)
+		return PINK_ABI_I386;
+	return PINK_ABI_X86_64;
+#else
+	return PINK_ABI_DEFAULT;
+#endif
+}
+
+static int event_notify(void)
+{
+	int r;
+	syd_process_t *current;
+	struct seccomp_notif *req = sydbox->notify_req;
+	struct seccomp_notif_resp *resp = sydbox->notify_resp;
+
+	if ((r = seccomp_notify_receive(sydbox->notify_fd, req)) < 0) {
+		if (r == -ENOENT) /* tracee interrupted or dead */
+			return 0;
+		return r;
+	}
+
+	resp->id = req->id;
+	resp->val = 0;
+	resp->error = 0;
+	resp->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+
+	/*
+	 * New-born children are kept stopped until we see them, so this is
+	 * an untraced process (e.g. core/trace/follow_fork:false).
+	 */
+	current = lookup_process(req->pid);
+	if (!current)
+		goto respond;
+
+	current->abi = notify_abi(req->data.arch);
+	sydbox->notify_current = current;
+	r = sysenter(current);
+	sydbox->notify_current = NULL;
+
+	if (r < 0 && r != -ESRCH) {
+		/* Failed to read tracee memory, do not let it through. */
+		resp->flags = 0;
+		resp->val = 0;
+		resp->error = r;
+	}
+
+respond:
+	r = seccomp_notify_respond(sydbox->notify_fd, resp);
+	return (r == -ENOENT) ? 0 : r;
+}
+
+#endif
+
+/* Time left until end, false if there's none. */
+static bool time_left(const struct timespec *end, struct timespec *left)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	left->tv_sec = end->tv_sec - now.tv_sec;
+	left->tv_nsec = end->tv_nsec - now.tv_nsec;
+	if (left->tv_nsec < 0) {
+		left->tv_sec--;
+		left->tv_nsec += 1000000000L;
+	}
+	return left->tv_sec > 0 || (left->tv_sec == 0 && left->tv_nsec > 0);
+}
+
+/*
+ * Wait for a ptrace event serving seccomp notifications and collecting the
+ * path checks finished by the worker threads meanwhile.
+ * Called with signals blocked, they are only delivered in ppoll() where
+ * SIGCHLD wakes us up to reap ptrace events.
+ * Returns 0 if no event came within timeout, unless it's NULL.
+ */
+static pid_t wait_event(int *status, int wait_flags,
+			const struct timespec *timeout)
+{
+	int r;
+	pid_t pid;
+	nfds_t i, nfds;
+	struct pollfd pfd[2];
+	struct timespec end, left;
+
+	if (timeout) {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		end.tv_sec += timeout->tv_sec;
+		end.tv_nsec += timeout->tv_nsec;
+		if (end.tv_nsec >= 1000000000L) {
+			end.tv_sec++;
+			end.tv_nsec -= 1000000000L;
+		}
+	}
+
+	for (;;) {
+		scratch_reset();
+
+		/* Resume the tracees whose checks are done first. */
+		box_worker_done();
+
+		tracer->loop_syscalls++;
+		pid = waitpid(-1, status, wait_flags|WNOHANG);
+		if (pid != 0)
+			return pid;
+		if (interrupted) {
+			errno = EINTR;
+			return -1;
+		}
+		if (timeout && !time_left(&end, &left))
+			return 0;
+
+		nfds = 0;
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+		if (sydbox->notify_fd >= 0)
+			pfd[nfds++].fd = sydbox->notify_fd;
+#endif
+		if (worker_fd() >= 0)
+			pfd[nfds++].fd = worker_fd();
+		for (i = 0; i < nfds; i++) {
+			pfd[i].events = POLLIN;
+			pfd[i].revents = 0;
+		}
+		tracer->loop_syscalls++;
+		/* Signals are blocked in the other tracer threads. */
+		r = ppoll(pfd, nfds, timeout ? &left : NULL,
+			  tracer->id == 0 ? &empty_set : NULL);
+		if (r < 0)
+			return -1;
+		else if (r == 0)
+			continue; /* timed out, reap what came meanwhile */
+
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+		if (sydbox->notify_fd >= 0) {
+			if (pfd[0].revents & POLLIN) {
+				if ((r = event_notify()) < 0) {
+					errno = -r;
+					die_errno("seccomp notification failed");
+				}
+			} else if (pfd[0].revents & (POLLHUP|POLLERR|POLLNVAL)) {
+				/* No more processes use the filter. */
+				close(sydbox->notify_fd);
+				sydbox->notify_fd = -1;
+				if (worker_fd() < 0) {
+					errno = EINTR;
+					return -1;
+				}
+			}
+		}
+#endif
+	}
+}
+
+/*
+ * A new child stopped before the clone event of its parent was handled.
+ * Rather than looking for its parent in /proc, the child is kept stopped
+ * until the event names it, as long as some process is in clone(2).
+ */
+static bool early_child(pid_t pid, int status)
+{
+	syd_process_t *node;
+
+	for (node = tracer->forking; node; node = node->fork_next) {
+		if (node->flags & SYD_IN_CLONE) {
+			pidmap_set(&tracer->early_children, pid,
+				   (void *)(intptr_t)status);
+			tracer->early_children_seen++;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Under seccomp there's no stop at the exit of clone(2) to notice it failed,
+ * see forking_done(). Before the early children are looked up in /proc, the
+ * processes which have left clone(2) meanwhile are not waited for anymore.
+ */
+static void forking_expire(void)
+{
+	long sysnum;
+	syd_process_t *node, *next;
+
+	for (node = tracer->forking; node; node = next) {
+		next = node->fork_next;
+		if (!(node->flags & SYD_IN_CLONE) || node->flags & SYD_KILLED)
+			continue;
+		if (proc_syscall(node->pid, &sysnum) < 0 ||
+		    sysnum == node->sysnum)
+			continue; /* running or still in clone(2) */
+		node->flags &= ~SYD_IN_CLONE;
+		process_update_forking(node);
+	}
+}
+
+/*
+ * Waits for the next stop while early_child() keeps children stopped. If
+ * none comes in time, e.g. the clone(2) failed after all, one of these
+ * children is returned to look for its parent in /proc.
+ */
+static pid_t wait_early_child(int *status, int wait_flags, bool *early)
+{
+	pid_t pid;
+	unsigned i;
+	void *ptr;
+	struct timespec ts;
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = SYDBOX_EARLY_CHILD_WAIT * 1000L;
+	/* SIGCHLD, if caught, ends it early */
+	pid = wait_event(status, wait_flags, &ts);
+	if (pid != 0)
+		return pid;
+
+	forking_expire();
+	pidmap_iter(&tracer->early_children, i, ptr) {
+		pid = pidmap_pid_at(&tracer->early_children, i);
+		pidmap_del(&tracer->early_children, pid);
+		*status = (int)(intptr_t)ptr;
+		*early = true;
+		return pid;
+	}
+	assert_not_reached(); /* the caller checked there is one */
+	return -1;
+}
+
 static int trace(void)
 {
 	int pid, wait_errno;
-	bool stopped;
+	bool stopped, early;
 	int r;
 	int status, sig;
+	int wait_flags;
 	unsigned event;
-	syd_process_t *current;
+	syd_process_t *current, *handoff;
 	int syscall_trap_sig;
 
+	/* Each tracer thread waits for its own tracees. */
+	wait_flags = multi_tracer() ? __WALL|__WNOTHREAD : __WALL;
 	syscall_trap_sig = sydbox->trace_options & PINK_TRACE_OPTION_SYSGOOD
 			   ? SIGTRAP | 0x80
 			   : SIGTRAP;
@@ -1181,25 +1680,56 @@ static int trace(void)
 	 * Waiting for ECHILD works better.
 	 */
 	while (1) {
-		if ((r = check_interrupt()) != 0)
+		/* Nothing allocated from the scratch area outlives a stop. */
+		scratch_reset();
+
+		/* Signals are blocked in the other tracer threads. */
+		if (tracer->id == 0 && (r = check_interrupt()) != 0)
 			return r;
 
-		sigprocmask(SIG_SETMASK, &empty_set, NULL);
-		errno = 0;
-		pid = waitpid(-1, &status, __WALL);
-		wait_errno = errno;
-		sigprocmask(SIG_SETMASK, &blocked_set, NULL);
+		early = false;
+		if (tracer->replay_pid) {
+			/* The clone event of its parent came, see event_clone() */
+			pid = tracer->replay_pid;
+			status = tracer->replay_status;
+			tracer->replay_pid = 0;
+			wait_errno = 0;
+		} else if (tracer->early_children.count) {
+			errno = 0;
+			pid = wait_early_child(&status, wait_flags, &early);
+			wait_errno = errno;
+		} else if (sydbox->notify_fd >= 0 || worker_fd() >= 0) {
+			errno = 0;
+			pid = wait_event(&status, wait_flags, NULL);
+			wait_errno = errno;
+		} else {
+			tracer->loop_syscalls++;
+			errno = 0;
+			pid = waitpid(-1, &status, wait_flags);
+			wait_errno = errno;
+		}
 
-		dump(DUMP_WAIT, pid, status, wait_errno);
+		dump(DUMP_WAIT, pid, status, wait_errno, tracer->loop_syscalls);
 
 		if (pid < 0) {
 			switch (wait_errno) {
 			case EINTR:
 				continue;
+			case ECHILD:
+				if (!multi_tracer())
+					goto cleanup;
+				/* No tracees left, wait for a hand-over. */
+				r = tracer_idle(&handoff);
+				if (r == 0)
+					goto cleanup;
+				if (r > 0)
+					handoff_receive(handoff);
+				continue;
 			default:
 				goto cleanup;
 			}
 		}
+		tracer->stops++;
 
 
 		if (WIFSIGNALED(status) || WIFEXITED(status)) {
@@ -1213,6 +1743,10 @@ static int trace(void)
 
 		event = pink_event_decide(status);
 		current = lookup_process(pid);
+		if (current && current->flags & SYD_IN_WORKER) {
+			/* Left the stop its check was made for, e.g. killed. */
+			box_worker_cancel(current);
+		}
 
 		/* Under Linux, execve changes pid to thread leader's pid,
 		 * and we see this changed pid on EVENT_EXEC and later,
@@ -1263,6 +1797,10 @@ static int trace(void)
 		if (!current) {
 			syd_process_t *parent;
 
+			if (!early && early_child(pid, status))
+				continue; /* stays stopped until the clone event */
+
+			tracer->parent_lookups++;
 			parent = parent_process(pid, current);
 
 			YELL_ON(parent, "pid %u, status %#x, event %d|%s (-pent)",
@@ -1274,6 +1812,7 @@ static int trace(void)
 		if (current->flags & SYD_STARTUP) {
 			if ((r = event_startup(current)) < 0)
 				continue; /* process dead */
+			handoff_start(current);
 		}
 
 		sig = WSTOPSIG(status);
@@ -1295,6 +1834,11 @@ static int trace(void)
 				stopped = true;
 				goto handle_stopsig;
 			case SIGTRAP:
+				if (current->flags & SYD_HANDOFF &&
+				    current->handoff_to == tracer) {
+					handoff_resume(current);
+					continue;
+				}
 				/* fall through */
 			default:
 				break;
@@ -1308,6 +1852,11 @@ static int trace(void)
 		case PINK_EVENT_VFORK:
 		case PINK_EVENT_CLONE:
 #if SYDBOX_HAVE_SECCOMP
+			if (event == PINK_EVENT_SECCOMP &&
+			    current->flags & SYD_HANDOFF &&
+			    current->handoff_to != tracer &&
+			    handoff_park(current))
+				continue;
 			r = (event == PINK_EVENT_SECCOMP) ? event_seccomp(current)
 							  : event_clone(current);
 #else
@@ -1315,6 +1864,8 @@ static int trace(void)
 #endif
 			if (r < 0)
 				continue; /* process dead */
+			if (current->flags & SYD_IN_WORKER)
+				continue; /* resumed by box_worker_done() */
 			/* fall through */
 		default:
 			goto restart_tracee_with_sig_0;
@@ -1341,8 +1892,15 @@ static int trace(void)
 			 * (as opposed to "tracee received signal").
 			 * TODO: shouldn't we check for errno == EINVAL too?
 			 * We can get ESRCH instead, you know...
+			 * With PTRACE_SEIZE group-stops are reported as
+			 * PTRACE_EVENT_STOP, this is signal-delivery-stop.
 			 */
-			stopped = (pink_trace_get_siginfo(pid, &si) < 0);
+			if (syd_use_seize) {
+				stopped = false;
+			} else {
+				tracer->loop_syscalls++;
+				stopped = (pink_trace_get_siginfo(pid, &si) < 0);
+			}
 #if PINK_HAVE_SEIZE
 handle_stopsig:
 #endif
@@ -1367,7 +1925,7 @@ handle_stopsig:
 		}
 
 		/* We handled quick cases, we are permitted to interrupt now. */
-		if ((r = check_interrupt()) != 0)
+		if (tracer->id == 0 && (r = check_interrupt()) != 0)
 			return r;
 
 		/* This should be syscall entry or exit.
@@ -1386,6 +1944,8 @@ handle_stopsig:
 			 */
 			continue;
 		}
+		if (current->flags & SYD_IN_WORKER)
+			continue; /* resumed by box_worker_done() */
 restart_tracee_with_sig_0:
 		sig = 0;
 restart_tracee:
@@ -1411,6 +1971,9 @@ static void startup_child(char **argv)
 	char *pathname;
 	pid_t pid = 0;
 	syd_process_t *child;
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+	int sock[2] = { -1, -1 };
+#endif
 
 	r = path_lookup(argv[0], &pathname);
 	if (r < 0) {
@@ -1418,6 +1981,12 @@ static void startup_child(char **argv)
 		die_errno("can't exec `%s'", argv[0]);
 	}
 
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+	if (sydbox->config.use_notify &&
+	    socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, sock) < 0)
+		die_errno("socketpair");
+#endif
+
 	pid = fork();
 	if (pid < 0)
 		die_errno("can't fork");
@@ -1437,6 +2006,24 @@ static void startup_child(char **argv)
 					-r, strerror(-r));
 				_exit(EXIT_FAILURE);
 			}
+
+# if SYDBOX_HAVE_SECCOMP_NOTIFY
+			/*
+			 * Pass the listener to the tracer, sendmsg() is not
+			 * trapped. Nothing else may be called here which the
+			 * filter hands to the listener, e.g. close(), or the
+			 * child waits for a tracer which waits for the
+			 * child. The listener and the socket pair are both
+			 * close-on-exec so execv() drops them.
+			 */
+			if (sydbox->config.use_notify &&
+			    (r = seccomp_listener_send(sock[1], r)) < 0) {
+				fprintf(stderr,
+					"seccomp_listener_send failed (errno:%d %s)\n",
+					-r, strerror(-r));
+				_exit(EXIT_FAILURE);
+			}
+# endif
 		}
 #endif
 		pid = getpid();
@@ -1457,6 +2044,25 @@ static void startup_child(char **argv)
 	}
 
 	free(pathname);
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+	if (sydbox->config.use_notify) {
+		close(sock[1]);
+		r = seccomp_listener_recv(sock[0]);
+		close(sock[0]);
+		if (r < 0) {
+			kill_save_errno(pid, SIGKILL);
+			errno = -r;
+			die_errno("can't receive seccomp listener");
+		}
+		sydbox->notify_fd = r;
+		if ((r = seccomp_notify_alloc(&sydbox->notify_req,
+					      &sydbox->notify_resp)) < 0) {
+			kill_save_errno(pid, SIGKILL);
+			errno = -r;
+			die_errno("seccomp_notify_alloc");
+		}
+	}
+#endif
 #if PINK_HAVE_SEIZE
 	if (syd_use_seize) {
 		/* Wait until child stopped itself */
@@ -1501,14 +2107,35 @@ void cleanup(void)
 	ACLQ_FREE(node, &sydbox->config.filter_write, free);
 	ACLQ_FREE(node, &sydbox->config.filter_network, free_sockmatch);
 
+	box_worker_free();
+	tracer_free();
+	box_cache_free();
+	realpath_cache_free();
+
 	if (sydbox->program_invocation_name)
 		free(sydbox->program_invocation_name);
+	if (sydbox->notify_fd >= 0)
+		close(sydbox->notify_fd);
+	if (sydbox->notify_req)
+		free(sydbox->notify_req);
+	if (sydbox->notify_resp)
+		free(sydbox->notify_resp);
 	free(sydbox);
 	sydbox = NULL;
 
 	systable_free();
 }
 
+static void *tracer_thread(void *arg)
+{
+	tracer = arg;
+	scratch_attach(&tracer->scratch);
+	trace();
+	box_cache_free();
+	realpath_cache_free();
+	return NULL;
+}
+
 int main(int argc, char **argv)
 {
 	int opt, r;
@@ -1582,8 +2209,6 @@ int main(int argc, char **argv)
 		config_parse_spec(env);
 
 	config_done();
-	systable_init();
-	sysinit();
 
 	ptrace_options = PINK_TRACE_OPTION_SYSGOOD | PINK_TRACE_OPTION_EXEC;
 	ptrace_default_step = SYD_STEP_SYSCALL;
@@ -1607,6 +2232,18 @@ int main(int argc, char **argv)
 #else
 		/* say("seccomp not supported, disabling"); */
 		sydbox->config.use_seccomp = false;
+#endif
+	}
+	if (sydbox->config.use_notify) {
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+		/* Linux-5.5 is required for SECCOMP_USER_NOTIF_FLAG_CONTINUE */
+		if (!sydbox->config.use_seccomp ||
+		    os_release < KERNEL_VERSION(5,5,0)) {
+			/* say("seccomp user notification not supported, disabling"); */
+			sydbox->config.use_notify = false;
+		}
+#else
+		sydbox->config.use_notify = false;
 #endif
 	}
 	if (sydbox->config.use_seize) {
@@ -1617,10 +2254,37 @@ int main(int argc, char **argv)
 		sydbox->config.use_seize = false;
 #endif
 	}
+	if (sydbox->config.tracer_threads > 1) {
+		/* Processes are handed over detached, see handoff_park() */
+		if (!syd_use_seize || !sydbox->config.use_seccomp) {
+			say("core/trace/tracer_threads requires core/trace/use_seize and core/trace/use_seccomp, using one tracer thread");
+			sydbox->config.tracer_threads = 1;
+		}
+	}
+	if (sydbox->config.tracer_threads > 1) {
+		if (sydbox->config.use_notify) {
+			say("core/trace/use_notify does not work with core/trace/tracer_threads, disabling");
+			sydbox->config.use_notify = false;
+		}
+		if (sydbox->config.worker_threads) {
+			say("core/trace/worker_threads does not work with core/trace/tracer_threads, disabling");
+			sydbox->config.worker_threads = 0;
+		}
+	}
+	if ((r = tracer_init(sydbox->config.tracer_threads)) < 0) {
+		errno = -r;
+		die_errno("tracer_init");
+	}
+	if (multi_tracer())
+		config_share();
 
 	sydbox->trace_options = ptrace_options;
 	sydbox->trace_step = ptrace_default_step;
 
+	/* The trap set depends on the final configuration. */
+	systable_init();
+	sysinit();
+
 	/*
 	 * Initial program_invocation_name to be used for P_COMM(current).
 	 * Saves one proc_comm() call.
@@ -1642,6 +2306,16 @@ int main(int argc, char **argv)
 	   Also we do not need to be protected by them as during interruption
 	   in the STARTUP_CHILD mode we kill the spawned process anyway.  */
 	startup_child(&argv[optind]);
+	if (multi_tracer() && (r = tracer_start(tracer_thread)) < 0) {
+		kill_save_errno(sydbox->execve_pid, SIGKILL);
+		errno = -r;
+		die_errno("can't start tracer threads");
+	}
+	if (sydbox->config.worker_threads &&
+	    (r = worker_init(sydbox->config.worker_threads)) < 0) {
+		say("worker_init(%u) failed (errno:%d %s), no worker threads",
+		    sydbox->config.worker_threads, -r, strerror(-r));
+	}
 	init_signals();
 	r = trace();
 	cleanup();
@@ -25,11 +25,16 @@
 #include <limits.h>
 #include <errno.h>
 #include <sched.h>
+#include <pthread.h>
 #include "pink.h"
 #include "acl-queue.h"
 #include "procmatch.h"
 #include "sockmatch.h"
 #include "sockmap.h"
+#include "fdcache.h"
+#include "scratch.h"
+#include "pool.h"
+#include "pidmap.h"
 #include "util.h"
 #include "xfunc.h"
 
@@ -49,6 +54,18 @@
 #define SYD_IN_CLONE		00020 /* process called clone(2) */
 #define SYD_IN_EXECVE		00040 /* process called execve(2) */
 #define SYD_KILLED		00100 /* process is dead, keeping entry for child. */
+#define SYD_REGSET		00200 /* regset is filled for this stop */
+#define SYD_SYSCALL_INFO	00400 /* syscall_info is filled for this system call */
+#define SYD_IN_WORKER		01000 /* path check is running on a worker thread */
+#define SYD_HANDOFF		02000 /* process is moving to another tracer thread */
+#define SYD_FDCACHE_BUSY	04000 /* process is closing or replacing file descriptors */
+#define SYD_FORKING		(SYD_IN_CLONE|SYD_IN_EXECVE)
+
+/* Sandboxing categories, see sysentry_t */
+#define SYD_SANDBOX_EXEC	00001
+#define SYD_SANDBOX_READ	00002
+#define SYD_SANDBOX_WRITE	00004
+#define SYD_SANDBOX_NETWORK	00010
 
 #define SYD_PPID_NONE		0      /* no parent PID (yet) */
 #define SYD_TGID_NONE		0      /* no thread group ID (yet) */
@@ -155,10 +172,16 @@ enum magic_key {
 	MAGIC_KEY_CORE_TRACE_FOLLOW_FORK,
 	MAGIC_KEY_CORE_TRACE_EXIT_KILL,
 	MAGIC_KEY_CORE_TRACE_MAGIC_LOCK,
+	MAGIC_KEY_CORE_TRACE_SANDBOX_LOCK,
+	MAGIC_KEY_CORE_TRACE_MAGIC_STAT,
 	MAGIC_KEY_CORE_TRACE_INTERRUPT,
 	MAGIC_KEY_CORE_TRACE_USE_SECCOMP,
 	MAGIC_KEY_CORE_TRACE_USE_SEIZE,
+	MAGIC_KEY_CORE_TRACE_USE_NOTIFY,
+	MAGIC_KEY_CORE_TRACE_USE_FD_CACHE,
 	MAGIC_KEY_CORE_TRACE_USE_TOOLONG_HACK,
+	MAGIC_KEY_CORE_TRACE_WORKER_THREADS,
+	MAGIC_KEY_CORE_TRACE_TRACER_THREADS,
 
 	MAGIC_KEY_EXEC,
 	MAGIC_KEY_EXEC_KILL_IF_MATCH,
@@ -254,6 +277,14 @@ typedef struct {
 	aclq_t acl_write;
 	aclq_t acl_network_bind;
 	aclq_t acl_network_connect;
+
+	/*
+	 * Sandboxes are shared between processes after fork and copied on
+	 * the first edit, see box_unshare().
+	 */
+	unsigned refcnt;
+	/* Unique among all versions of all sandboxes, changes on edit */
+	unsigned long version;
 } sandbox_t;
 
 /* process information */
@@ -270,6 +301,14 @@ typedef struct syd_process {
 	/* Process registry set */
 	struct pink_regset *regset;
 
+	/* System call information from PTRACE_GET_SYSCALL_INFO */
+	struct syd_syscall_info {
+		long nr;
+		long args[PINK_MAX_ARGS];
+		long rval;
+		bool is_error;
+	} syscall_info;
+
 	/* System call ABI */
 	short abi;
 
@@ -291,6 +330,15 @@ typedef struct syd_process {
 	/* Resolved path argument for specially treated system calls like execve() */
 	char *abspath;
 
+	/* Pending path check if SYD_IN_WORKER is set */
+	struct box_job *job;
+
+	/* Tracer thread taking over the process if SYD_HANDOFF is set */
+	struct syd_tracer *handoff_to;
+	struct syd_process *handoff_next;
+	/* System call the process was parked in for the hand-over */
+	long handoff_sysnum;
+
 	/* Last (socket) subcall */
 	long subcall;
 
@@ -320,9 +368,9 @@ typedef struct syd_process {
 					(p)->shm.clone_thread->refcnt--; \
 					if ((p)->shm.clone_thread->refcnt == 0) { \
 						if ((p)->shm.clone_thread->box) { \
-							free_sandbox((p)->shm.clone_thread->box); \
+							release_sandbox((p)->shm.clone_thread->box); \
 						} \
-						free((p)->shm.clone_thread); \
+						pool_free(TRACER_POOL(clone_thread_pool), (p)->shm.clone_thread); \
 						(p)->shm.clone_thread = NULL; \
 					} \
 				} \
@@ -335,6 +383,10 @@ typedef struct syd_process {
 			char *cwd;
 #define			P_CWD(p) ((p)->shm.clone_fs->cwd)
 
+			/* Working directory changed since read, see update_cwd() */
+			bool cwd_stale;
+#define			P_CWD_STALE(p) ((p)->shm.clone_fs->cwd_stale)
+
 			/* Reference count */
 			unsigned refcnt;
 #define			P_CLONE_FS_REFCNT(p) ((p)->shm.clone_fs->refcnt)
@@ -347,7 +399,7 @@ typedef struct syd_process {
 						if ((p)->shm.clone_fs->cwd) { \
 							free((p)->shm.clone_fs->cwd); \
 						} \
-						free((p)->shm.clone_fs); \
+						pool_free(TRACER_POOL(clone_fs_pool), (p)->shm.clone_fs); \
 						(p)->shm.clone_fs = NULL; \
 					} \
 				} \
@@ -368,6 +420,22 @@ typedef struct syd_process {
 			struct sockmap *sockmap;
 #define			P_SOCKMAP(p) ((p)->shm.clone_files->sockmap)
 
+			/*
+			 * Paths of directory file descriptors, see
+			 * path_prefix(). Not used once the table is known
+			 * to be shared no more, e.g. after unshare(2).
+			 */
+			struct fdcache *fdcache;
+			bool fdcache_off;
+#define			P_FDCACHE(p) ((p)->shm.clone_files->fdcache)
+#define			P_FDCACHE_OFF(p) ((p)->shm.clone_files->fdcache_off)
+			/*
+			 * Number of processes in close(2) like calls, no
+			 * paths are cached until they are done.
+			 */
+			unsigned fdcache_busy;
+#define			P_FDCACHE_BUSY(p) ((p)->shm.clone_files->fdcache_busy)
+
 			/* Reference count */
 			unsigned refcnt;
 #define			P_CLONE_FILES_REFCNT(p) ((p)->shm.clone_files->refcnt)
@@ -384,7 +452,8 @@ typedef struct syd_process {
 							sockmap_destroy(&(p)->shm.clone_files->sockmap); \
 							free((p)->shm.clone_files->sockmap); \
 						} \
-						free((p)->shm.clone_files); \
+						fdcache_destroy(&(p)->shm.clone_files->fdcache); \
+						pool_free(TRACER_POOL(clone_files_pool), (p)->shm.clone_files); \
 						(p)->shm.clone_files = NULL; \
 					} \
 				} \
@@ -392,8 +461,13 @@ typedef struct syd_process {
 		} *clone_files;
 	} shm;
 
-	/* Process hash table via sydbox->proctab */
-	UT_hash_handle hh;
+	/* Other threads of the thread group, see lookup_thread_group() */
+	struct syd_process *thread_next;
+	struct syd_process *thread_prev;
+
+	/* Processes with a clone or an execve in flight, see parent_process() */
+	struct syd_process *fork_next;
+	struct syd_process *fork_prev;
 } syd_process_t;
 
 #if 0
@@ -502,9 +576,15 @@ typedef struct {
 
 	bool follow_fork;
 	bool exit_kill;
+	bool sandbox_lock;
+	bool magic_stat;
 	bool use_seccomp;
 	bool use_seize;
+	bool use_notify;
+	bool use_fd_cache;
 	bool use_toolong_hack;
+	unsigned worker_threads;
+	unsigned tracer_threads;
 
 	aclq_t exec_kill_if_match;
 	aclq_t exec_resume_if_match;
@@ -518,12 +598,96 @@ typedef struct {
 	aclq_t acl_network_connect_auto;
 } config_t;
 
+struct seccomp_notif;
+struct seccomp_notif_resp;
+
+/*
+ * Tracer thread, see core/trace/tracer_threads:
+ * Each thread waits for the processes it traces, new processes are handed
+ * over to idle threads. Only the owner thread changes its process table and
+ * it takes the lock to do so. Other threads take the lock to read it.
+ */
+typedef struct syd_tracer {
+	unsigned id;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	/* Traced processes by pid, the first thread of each group by tgid */
+	struct pidmap proctab;
+	struct pidmap thread_groups;
+	/* Processes which may have children not seen yet, SYD_FORKING set */
+	syd_process_t *forking;
+	/*
+	 * New children stopped before the clone event of their parent, by pid
+	 * with their wait status, see event_clone(). The stop to handle next
+	 * instead of waiting, if any.
+	 */
+	struct pidmap early_children;
+	pid_t replay_pid;
+	int replay_status;
+
+	/* Hand-over state, protected by sydbox->tracer_lock */
+	bool idle;
+	syd_process_t *handoff;
+	int doorbell; /* eventfd, written on hand-over and on exit */
+
+	/* Strings of the system call being checked, reset at every stop */
+	struct scratch scratch;
+
+	/* Buried process records with their regsets and shared data */
+	struct syd_pool proc_pool;
+	struct syd_pool clone_thread_pool;
+	struct syd_pool clone_fs_pool;
+	struct syd_pool clone_files_pool;
+
+	/* Statistics */
+	unsigned long stops;
+	unsigned long loop_syscalls; /* waits and resumes, see trace() */
+	unsigned long handoff_in;
+	unsigned long handoff_out;
+	unsigned long early_children_seen;
+	unsigned long parent_lookups; /* via /proc, see parent_process() */
+	unsigned long access_cache_hit;
+	unsigned long access_cache_miss;
+	unsigned long fd_cache_hit;
+	unsigned long fd_cache_miss;
+} syd_tracer_t;
+
+/* Tracer of the calling thread */
+extern __thread syd_tracer_t *tracer;
+#define TRACER_POOL(name) (tracer ? &tracer->name : NULL)
+
 typedef struct {
-	syd_process_t *proctab;
+	/* Tracer threads, the first one is the main thread */
+	syd_tracer_t *tracers;
+	unsigned tracer_count;
+	pthread_mutex_t tracer_lock;
+	unsigned tracer_busy; /* threads which are not idle */
+	bool tracer_done;
+	/* Lock for the lists edited as processes come and go, see auto_lock() */
+	pthread_mutex_t auto_lock;
 
 	int trace_options;
 	enum syd_step trace_step;
 
+	/* seccomp user notification listener (-1 if not in use) */
+	int notify_fd;
+	struct seccomp_notif *notify_req;
+	struct seccomp_notif_resp *notify_resp;
+	/* Process whose notification is being served, if any */
+	syd_process_t *notify_current;
+
+	/* Sandboxing categories which are off and may not be turned on */
+	unsigned sandbox_locked;
+
+	/* Last sandbox_t version handed out */
+	unsigned long sandbox_version;
+
+	/* Access decision cache, see box_check_path() */
+	unsigned long access_cache_generation;
+
+	/* File descriptor path cache, see path_prefix() */
+	unsigned long fd_cache_generation;
+
 	bool execve_wait;
 	pid_t execve_pid;
 	int exit_code;
@@ -539,7 +703,8 @@ typedef struct {
 } sydbox_t;
 
 typedef int (*sysfunc_t) (syd_process_t *current);
-typedef int (*sysfilter_t) (int arch, uint32_t sysnum);
+struct sock_filter;
+typedef size_t (*sysfilter_t) (const struct sock_filter **prog);
 
 typedef struct {
 	const char *name;
@@ -549,15 +714,54 @@ typedef struct {
 	sysfunc_t enter;
 	sysfunc_t exit;
 
-	/* Apply a simple seccomp filter (bpf-only, no ptrace) */
+	/*
+	 * Return a simple seccomp filter (bpf-only, no ptrace) which denies
+	 * the system call or falls through.
+	 */
 	sysfilter_t filter;
 	/*
 	 * Are ".enter" and ".exit" members ptrace fallbacks when seccomp
 	 * support is not available or do they have to be called anyway?
 	 */
 	bool ptrace_fallback;
+
+	/*
+	 * Return a seccomp program which is run before trapping the system
+	 * call. The program returns SECCOMP_RET_ALLOW for arguments which can
+	 * never be denied and falls through to the trap otherwise.
+	 */
+	sysfilter_t prefilter;
+
+	/*
+	 * Sandboxing categories checked by the handlers (SYD_SANDBOX_*).
+	 * The system call is not trapped if all of them are locked off.
+	 * Zero means the handlers are needed regardless of sandboxing.
+	 */
+	unsigned sandbox;
+
+	/*
+	 * The system call changes the file descriptor table and is always
+	 * trapped if core/trace/use_fd_cache is set. Otherwise it is trapped
+	 * only if sandboxing needs it, never if ".sandbox" is zero.
+	 */
+	bool fd_table;
+	/*
+	 * The sandboxing handlers only track addresses whitelisted by
+	 * core/whitelist/successful_bind, skip them if it is unset.
+	 */
+	bool successful_bind;
 } sysentry_t;
 
+/* Dispatch table entry, see systable.c */
+#define SYSDISPATCH_CLONE	00001 /* clone(2), fork(2) or vfork(2) */
+#define SYSDISPATCH_EXECVE	00002 /* execve(2) */
+typedef struct {
+	sysfunc_t enter;
+	sysfunc_t exit;
+	const char *name;
+	unsigned flags;
+} sysdispatch_t;
+
 typedef struct {
 	/* Argument index */
 	unsigned arg_index;
@@ -588,7 +792,8 @@ typedef struct {
 	/* Access filter lists (only global) */
 	aclq_t *access_filter;
 
-	/* Pointer to the data to be returned */
+	/* Pointer to the data to be returned, ret_abspath and ret_addr are
+	 * scratch memory, see scratch_keep() */
 	int *ret_fd;
 	char **ret_abspath;
 	struct stat *ret_statbuf;
@@ -596,6 +801,8 @@ typedef struct {
 
 	/* Cached data (to be reused by another sandboxing (read,write etc.) */
 	const char *cache_abspath;
+	/* Path argument decoded in advance (consumed by box_check_path()) */
+	char *cache_path;
 	const struct stat *cache_statbuf;
 } sysinfo_t;
 
@@ -606,6 +813,7 @@ extern sydbox_t *sydbox;
 #define exiting(p) ((p)->flags & SYD_IN_SYSCALL)
 #define sysdeny(p) ((p)->retval)
 #define hasparent(p) ((p)->ppid >= 0)
+#define notifying(p) ((p) == sydbox->notify_current)
 
 #define sandbox_allow(p, box) (!!(P_BOX(p)->sandbox_ ## box == SANDBOX_ALLOW))
 #define sandbox_deny(p, box) (!!(P_BOX(p)->sandbox_ ## box == SANDBOX_DENY))
@@ -629,10 +837,47 @@ extern sydbox_t *sydbox;
 #define sandbox_deny_network(p) (sandbox_deny((p), network))
 #define sandbox_deny_file(p) (sandbox_deny_exec((p)) && sandbox_deny_read((p)) && sandbox_deny_write((p)))
 
-#define process_count() HASH_COUNT(sydbox->proctab)
-#define process_iter(p, tmp) HASH_ITER(hh, sydbox->proctab, (p), (tmp))
-#define process_add(p) HASH_ADD(hh, sydbox->proctab, pid, sizeof(pid_t), (p))
-#define process_remove(p) HASH_DEL(sydbox->proctab, (p))
+/* Counters shared between the tracer threads */
+#define syd_counter_inc(c) __atomic_add_fetch(&(c), 1, __ATOMIC_RELAXED)
+#define syd_counter_get(c) __atomic_load_n(&(c), __ATOMIC_RELAXED)
+
+#define multi_tracer() (sydbox->tracer_count > 1)
+
+static inline void tracer_lock(syd_tracer_t *t)
+{
+	if (multi_tracer())
+		pthread_mutex_lock(&t->lock);
+}
+
+static inline void tracer_unlock(syd_tracer_t *t)
+{
+	if (multi_tracer())
+		pthread_mutex_unlock(&t->lock);
+}
+
+/*
+ * Serialises access to the lists which change as processes come and go,
+ * i.e. core/whitelist/per_process_directories and
+ * core/whitelist/successful_bind, when there is more than one tracer thread.
+ */
+static inline void auto_lock(void)
+{
+	if (multi_tracer())
+		pthread_mutex_lock(&sydbox->auto_lock);
+}
+
+static inline void auto_unlock(void)
+{
+	if (multi_tracer())
+		pthread_mutex_unlock(&sydbox->auto_lock);
+}
+
+#define process_count() (tracer->proctab.count)
+#define process_iter(p, i) pidmap_iter(&tracer->proctab, (i), (p))
+void process_add(syd_process_t *p);
+void process_remove(syd_process_t *p);
+void process_set_tgid(syd_process_t *p, pid_t tgid);
+void process_update_forking(syd_process_t *p);
 
 /* Global functions */
 int syd_trace_step(syd_process_t *current, int sig);
@@ -642,13 +887,18 @@ int syd_trace_kill(syd_process_t *current, int sig);
 int syd_trace_setup(syd_process_t *current);
 int syd_trace_geteventmsg(syd_process_t *current, unsigned long *data);
 int syd_regset_fill(syd_process_t *current);
+int syd_regset_load(syd_process_t *current);
 int syd_read_syscall(syd_process_t *current, long *sysnum);
 int syd_read_retval(syd_process_t *current, long *retval, int *error);
 int syd_read_argument(syd_process_t *current, unsigned arg_index, long *argval);
 int syd_read_argument_int(syd_process_t *current, unsigned arg_index, int *argval);
 ssize_t syd_read_string(syd_process_t *current, long addr, char *dest, size_t len);
+int syd_read_strings(syd_process_t *current, const long *addr, char **dest,
+		     size_t len, ssize_t *rlen, unsigned count);
+ssize_t syd_read_vm_data(syd_process_t *current, long addr, char *dest, size_t len);
 int syd_write_syscall(syd_process_t *current, long sysnum);
 int syd_write_retval(syd_process_t *current, long retval, int error);
+ssize_t syd_write_vm_data(syd_process_t *current, long addr, const char *src, size_t len);
 int syd_read_socket_argument(syd_process_t *current, bool decode_socketcall,
 			     unsigned arg_index, unsigned long *argval);
 int syd_read_socket_subcall(syd_process_t *current, bool decode_socketcall,
@@ -663,10 +913,13 @@ void remove_process_node(syd_process_t *p);
 
 static inline syd_process_t *lookup_process(pid_t pid)
 {
-	syd_process_t *process;
+	return pidmap_find(&tracer->proctab, pid);
+}
 
-	HASH_FIND(hh, sydbox->proctab, &pid, sizeof(pid_t), process);
-	return process;
+/* First thread of the thread group, the others follow via thread_next */
+static inline syd_process_t *lookup_thread_group(pid_t tgid)
+{
+	return pidmap_find(&tracer->thread_groups, tgid);
 }
 
 void cleanup(void);
@@ -681,6 +934,7 @@ int violation(syd_process_t *current, const char *fmt, ...)
 
 void config_init(void);
 void config_done(void);
+void config_share(void);
 void config_parse_file(const char *filename) PINK_GCC_ATTR((nonnull(1)));
 void config_parse_spec(const char *filename) PINK_GCC_ATTR((nonnull(1)));
 
@@ -689,7 +943,26 @@ void callback_init(void);
 int box_resolve_path(const char *path, const char *prefix, pid_t pid,
 		     unsigned rmode, char **res);
 int box_check_path(syd_process_t *current, sysinfo_t *info);
+int box_check_path_async(syd_process_t *current, sysinfo_t *info);
 int box_check_socket(syd_process_t *current, sysinfo_t *info);
+void box_cache_free(void);
+
+int tracer_init(unsigned count);
+int tracer_start(void *(*func)(void *));
+void tracer_free(void);
+syd_tracer_t *tracer_claim(void);
+void tracer_unclaim(syd_tracer_t *t);
+void tracer_push(syd_tracer_t *t, syd_process_t *p);
+int tracer_idle(syd_process_t **list);
+void box_worker_cancel(syd_process_t *current);
+void box_worker_done(void);
+void box_worker_free(void);
+
+/* Forget all cached access decisions, called when a list is edited. */
+static inline void box_cache_flush(void)
+{
+	syd_counter_inc(sydbox->access_cache_generation);
+}
 
 static inline sandbox_t *box_current(syd_process_t *current)
 {
@@ -705,6 +978,9 @@ static inline void init_sandbox(sandbox_t *box)
 
 	box->magic_lock = LOCK_UNSET;
 
+	box->refcnt = 1;
+	box->version = syd_counter_inc(sydbox->sandbox_version);
+
 	ACLQ_INIT(&box->acl_exec);
 	ACLQ_INIT(&box->acl_read);
 	ACLQ_INIT(&box->acl_write);
@@ -765,12 +1041,44 @@ static inline void free_sandbox(sandbox_t *box)
 	free(box);
 }
 
+static inline void release_sandbox(sandbox_t *box)
+{
+	if (--box->refcnt == 0)
+		free_sandbox(box);
+}
+
+/*
+ * Return the sandbox of the current process for editing.
+ * The sandbox is copied first if it is shared with other processes.
+ */
+static inline sandbox_t *box_unshare(syd_process_t *current)
+{
+	int r;
+	sandbox_t *box;
+
+	if (!current)
+		return &sydbox->config.box_static;
+
+	box = P_BOX(current);
+	if (box->refcnt > 1) {
+		if ((r = new_sandbox(&P_BOX(current))) < 0) {
+			errno = -r;
+			die_errno("new_sandbox");
+		}
+		copy_sandbox(P_BOX(current), box);
+		box->refcnt--;
+	}
+	P_BOX(current)->version = syd_counter_inc(sydbox->sandbox_version);
+	return P_BOX(current);
+}
+
 void systable_init(void);
 void systable_free(void);
 void systable_add_full(long no, short abi, const char *name,
-		       sysfunc_t fenter, sysfunc_t fexit);
-void systable_add(const char *name, sysfunc_t fenter, sysfunc_t fexit);
-const sysentry_t *systable_lookup(long no, short abi);
+		       sysfunc_t fenter, sysfunc_t fexit, unsigned flags);
+void systable_add(const char *name, sysfunc_t fenter, sysfunc_t fexit,
+		  unsigned flags);
+const sysdispatch_t *systable_lookup(long no, short abi);
 
 size_t syscall_entries_max(void);
 void sysinit(void);
@@ -802,8 +1110,14 @@ int magic_set_trace_use_seccomp(const void *val, syd_process_t *current);
 int magic_query_trace_use_seccomp(syd_process_t *current);
 int magic_set_trace_use_seize(const void *val, syd_process_t *current);
 int magic_query_trace_use_seize(syd_process_t *current);
+int magic_set_trace_use_notify(const void *val, syd_process_t *current);
+int magic_query_trace_use_notify(syd_process_t *current);
+int magic_set_trace_use_fd_cache(const void *val, syd_process_t *current);
+int magic_query_trace_use_fd_cache(syd_process_t *current);
 int magic_set_trace_use_toolong_hack(const void *val, syd_process_t *current);
 int magic_query_trace_use_toolong_hack(syd_process_t *current);
+int magic_set_trace_worker_threads(const void *val, syd_process_t *current);
+int magic_set_trace_tracer_threads(const void *val, syd_process_t *current);
 int magic_set_restrict_fcntl(const void *val, syd_process_t *current);
 int magic_query_restrict_fcntl(syd_process_t *current);
 int magic_set_restrict_shm_wr(const void *val, syd_process_t *current);
@@ -844,6 +1158,10 @@ int magic_append_filter_network(const void *val, syd_process_t *current);
 int magic_remove_filter_network(const void *val, syd_process_t *current);
 int magic_set_violation_decision(const void *val, syd_process_t *current);
 int magic_set_trace_magic_lock(const void *val, syd_process_t *current);
+int magic_set_trace_sandbox_lock(const void *val, syd_process_t *current);
+int magic_query_trace_sandbox_lock(syd_process_t *current);
+int magic_set_trace_magic_stat(const void *val, syd_process_t *current);
+int magic_query_trace_magic_stat(syd_process_t *current);
 int magic_query_sandbox_exec(syd_process_t *current);
 int magic_query_sandbox_read(syd_process_t *current);
 int magic_query_sandbox_write(syd_process_t *current);
@@ -867,10 +1185,16 @@ static inline void init_sysinfo(sysinfo_t *info)
 	memset(info, 0, sizeof(sysinfo_t));
 }
 
-int filter_open(int arch, uint32_t sysnum);
-int filter_openat(int arch, uint32_t sysnum);
-int filter_fcntl(int arch, uint32_t sysnum);
-int filter_mmap(int arch, uint32_t sysnum);
+size_t filter_open(const struct sock_filter **prog);
+size_t filter_openat(const struct sock_filter **prog);
+size_t filter_fcntl(const struct sock_filter **prog);
+size_t filter_mmap(const struct sock_filter **prog);
+size_t prefilter_open(const struct sock_filter **prog);
+size_t prefilter_openat(const struct sock_filter **prog);
+size_t prefilter_access(const struct sock_filter **prog);
+size_t prefilter_faccessat(const struct sock_filter **prog);
+size_t prefilter_fcntl(const struct sock_filter **prog);
+size_t prefilter_sendto(const struct sock_filter **prog);
 int sys_fallback_mmap(syd_process_t *current);
 
 int sys_access(syd_process_t *current);
@@ -885,7 +1209,9 @@ int sys_open(syd_process_t *current);
 int sys_openat(syd_process_t *current);
 int sys_creat(syd_process_t *current);
 int sys_close(syd_process_t *current);
-int sysx_close(syd_process_t *current);
+int sys_close_range(syd_process_t *current);
+void fdcache_busy(syd_process_t *current);
+void fdcache_done(syd_process_t *current);
 int sys_mkdir(syd_process_t *current);
 int sys_mkdirat(syd_process_t *current);
 int sys_mknod(syd_process_t *current);
@@ -905,6 +1231,7 @@ int sys_link(syd_process_t *current);
 int sys_linkat(syd_process_t *current);
 int sys_rename(syd_process_t *current);
 int sys_renameat(syd_process_t *current);
+int sys_renameat2(syd_process_t *current);
 int sys_symlink(syd_process_t *current);
 int sys_symlinkat(syd_process_t *current);
 int sys_listxattr(syd_process_t *current);
@@ -916,13 +1243,18 @@ int sys_lremovexattr(syd_process_t *current);
 
 int sys_dup(syd_process_t *current);
 int sys_dup3(syd_process_t *current);
+int sys_unshare(syd_process_t *current);
 int sys_fcntl(syd_process_t *current);
 
 int sys_fork(syd_process_t *current);
 int sys_vfork(syd_process_t *current);
 int sys_clone(syd_process_t *current);
+int update_cwd(syd_process_t *current);
+
+int sys_chdir(syd_process_t *current);
 int sys_execve(syd_process_t *current);
 int sys_stat(syd_process_t *current);
+int sys_magic(syd_process_t *current);
 
 int sys_socketcall(syd_process_t *current);
 int sys_bind(syd_process_t *current);
@@ -932,6 +1264,8 @@ int sys_getsockname(syd_process_t *current);
 
 int sysx_chdir(syd_process_t *current);
 int sysx_dup(syd_process_t *current);
+int sysx_close(syd_process_t *current);
+int sysx_close_range(syd_process_t *current);
 int sysx_fcntl(syd_process_t *current);
 int sysx_socketcall(syd_process_t *current);
 int sysx_bind(syd_process_t *current);
@@ -66,6 +66,79 @@
 # define SYDBOX_MAGIC_PREFIX "/dev/sydbox"
 #endif
 
+/*
+ * Reserved system call number for magic commands, invalid on all supported
+ * architectures. The only argument is the magic path.
+ */
+#ifndef SYDBOX_MAGIC_SYSCALL
+# define SYDBOX_MAGIC_SYSCALL 4096
+#endif
+
+/*
+ * Number of access decisions kept in the cache of box_check_path(),
+ * must be a power of two.
+ */
+#ifndef SYDBOX_ACCESS_CACHE_SIZE
+# define SYDBOX_ACCESS_CACHE_SIZE 1024
+#endif
+
+/*
+ * Number of symbolic link targets kept in the resolution cache of
+ * realpath_mode().
+ */
+#ifndef SYDBOX_REALPATH_CACHE_MAX
+# define SYDBOX_REALPATH_CACHE_MAX 8192
+#endif
+
+/*
+ * Number of seconds after which the cached path of a file descriptor is
+ * looked up again, see core/trace/use_fd_cache.
+ */
+#ifndef SYDBOX_FD_CACHE_TTL
+# define SYDBOX_FD_CACHE_TTL 2
+#endif
+
+/*
+ * Maximum number of threads resolving path arguments for the tracer,
+ * see core/trace/worker_threads.
+ */
+#ifndef SYDBOX_WORKER_THREADS_MAX
+# define SYDBOX_WORKER_THREADS_MAX 64
+#endif
+
+/*
+ * Maximum number of threads tracing the sandboxed processes,
+ * see core/trace/tracer_threads.
+ */
+#ifndef SYDBOX_TRACER_THREADS_MAX
+# define SYDBOX_TRACER_THREADS_MAX 64
+#endif
+
+/*
+ * Size of the scratch area of each tracer thread which holds the strings of
+ * a system call check, see scratch_alloc().
+ */
+#ifndef SYDBOX_SCRATCH_SIZE
+# define SYDBOX_SCRATCH_SIZE (16 * SYDBOX_PATH_MAX)
+#endif
+
+/*
+ * Number of buried process records, and of each kind of data processes
+ * share, which every tracer thread keeps for reuse.
+ */
+#ifndef SYDBOX_POOL_MAX
+# define SYDBOX_POOL_MAX 1024
+#endif
+
+/*
+ * Microseconds a tracer thread waits for the clone event of the parent of a
+ * new child whose first stop came first, before it looks for the parent in
+ * /proc instead.
+ */
+#ifndef SYDBOX_EARLY_CHILD_WAIT
+# define SYDBOX_EARLY_CHILD_WAIT 1000
+#endif
+
 #ifndef SYDBOX_MAGIC_SET_CHAR
 # define SYDBOX_MAGIC_SET_CHAR ':'
 #endif
@@ -17,8 +17,17 @@
 #include <errno.h>
 #include <fcntl.h>
 #include "pink.h"
+#include "pathdecode.h"
 #include "bsd-compat.h"
 #include "sockmap.h"
+#include "fdcache.h"
+
+#ifndef CLOSE_RANGE_UNSHARE
+# define CLOSE_RANGE_UNSHARE (1U << 1)
+#endif
+#ifndef RENAME_EXCHANGE
+# define RENAME_EXCHANGE (1 << 1)
+#endif
 
 struct open_info {
 	bool may_read;
@@ -81,12 +90,11 @@ static int check_access(syd_process_t *current, sysinfo_t *info, int mode)
 			info->ret_statbuf = NULL;
 		}
 		sysinfo_read_access(current, info);
-		r = box_check_path(current, info);
+		r = box_check_path_async(current, info);
 	}
 
 out:
-	if (abspath)
-		free(abspath);
+	scratch_free(abspath);
 	return r;
 }
 
@@ -172,6 +180,8 @@ static void init_open_info(syd_process_t *current, int flags, struct open_info *
 		}
 	}
 
+	if (flags & O_CREAT)
+		info->rmode |= RPATH_MODIFY;
 	if (flags & O_DIRECTORY)
 		info->syd_mode |= SYD_STAT_ISDIR;
 	if (flags & O_NOFOLLOW)
@@ -234,12 +244,11 @@ static int check_open(syd_process_t *current, sysinfo_t *info,
 			info->ret_statbuf = NULL;
 		}
 		sysinfo_read_access(current, info);
-		r = box_check_path(current, info);
+		r = box_check_path_async(current, info);
 	}
 
 out:
-	if (abspath)
-		free(abspath);
+	scratch_free(abspath);
 	return r;
 }
 
@@ -323,7 +332,7 @@ int sys_chmod(syd_process_t *current)
 
 	init_sysinfo(&info);
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_fchmodat(syd_process_t *current)
@@ -345,7 +354,7 @@ int sys_fchmodat(syd_process_t *current)
 	if (flags & AT_SYMLINK_NOFOLLOW)
 		info.rmode |= RPATH_NOFOLLOW;
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_chown(syd_process_t *current)
@@ -357,7 +366,7 @@ int sys_chown(syd_process_t *current)
 
 	init_sysinfo(&info);
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_lchown(syd_process_t *current)
@@ -370,7 +379,7 @@ int sys_lchown(syd_process_t *current)
 	init_sysinfo(&info);
 	info.rmode |= RPATH_NOFOLLOW;
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_fchownat(syd_process_t *current)
@@ -392,7 +401,7 @@ int sys_fchownat(syd_process_t *current)
 	if (flags & AT_SYMLINK_NOFOLLOW)
 		info.rmode |= RPATH_NOFOLLOW;
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_creat(syd_process_t *current)
@@ -403,9 +412,35 @@ int sys_creat(syd_process_t *current)
 		return 0;
 
 	init_sysinfo(&info);
-	info.rmode = RPATH_NOLAST;
+	info.rmode = RPATH_NOLAST | RPATH_MODIFY;
+
+	return box_check_path_async(current, &info);
+}
+
+/*
+ * close(2) like calls drop the cached paths of the file descriptors at
+ * entry and once more at exit. Threads sharing the file descriptor table
+ * may look them up while the call is running, nothing is cached meanwhile,
+ * see path_prefix().
+ */
+void fdcache_busy(syd_process_t *current)
+{
+	if (!sydbox->config.use_fd_cache || current->flags & SYD_FDCACHE_BUSY)
+		return;
 
-	return box_check_path(current, &info);
+	P_FDCACHE_BUSY(current)++;
+	current->flags |= SYD_FDCACHE_BUSY | SYD_STOP_AT_SYSEXIT;
+}
+
+/* Called at system call exit and when the process is gone. */
+void fdcache_done(syd_process_t *current)
+{
+	if (!(current->flags & SYD_FDCACHE_BUSY))
+		return;
+
+	current->flags &= ~SYD_FDCACHE_BUSY;
+	if (current->shm.clone_files)
+		P_FDCACHE_BUSY(current)--;
 }
 
 int sys_close(syd_process_t *current)
@@ -413,38 +448,65 @@ int sys_close(syd_process_t *current)
 	int r;
 	long fd;
 
-	current->args[0] = -1;
-
-	if (sandbox_off_network(current) ||
-	    !sydbox->config.whitelist_successful_bind)
-		return 0;
-
 	if ((r = syd_read_argument(current, 0, &fd)) < 0)
 		return r;
-	if (sockmap_find(&P_SOCKMAP(current), fd))
-		current->args[0] = fd;
+	current->args[0] = fd;
+	fdcache_remove(&P_FDCACHE(current), fd);
+	fdcache_busy(current);
+
+	/*
+	 * The file descriptor is released even if close() fails, drop the
+	 * whitelisted address of the socket if it was the last reference.
+	 */
+	sockmap_remove(&P_SOCKMAP(current), fd);
 	return 0;
 }
 
-int sysx_close(syd_process_t *current)
+int sys_close_range(syd_process_t *current)
 {
 	int r;
-	long retval;
+	long first, last, flags;
 
-	if (sandbox_off_network(current) ||
-	    !sydbox->config.whitelist_successful_bind ||
-	    current->args[0] < 0)
-		return 0;
-
-	if ((r = syd_read_retval(current, &retval, NULL)) < 0)
+	if ((r = syd_read_argument(current, 0, &first)) < 0)
+		return r;
+	if ((r = syd_read_argument(current, 1, &last)) < 0)
+		return r;
+	if ((r = syd_read_argument(current, 2, &flags)) < 0)
 		return r;
 
-	if (retval == -1) {
-		/* ignore failed close */
-		return 0;
+	if (flags & CLOSE_RANGE_UNSHARE) {
+		/* the table is not shared with anyone else anymore */
+		fdcache_destroy(&P_FDCACHE(current));
+		P_FDCACHE_OFF(current) = true;
+	} else {
+		current->args[0] = first;
+		current->args[1] = last;
+		fdcache_remove_range(&P_FDCACHE(current),
+				     (unsigned)first, (unsigned)last);
+		fdcache_busy(current);
+		sockmap_remove_range(&P_SOCKMAP(current),
+				     (unsigned)first, (unsigned)last);
+	}
+	return 0;
+}
+
+int sysx_close(syd_process_t *current)
+{
+	if (current->flags & SYD_FDCACHE_BUSY) {
+		fdcache_remove(&P_FDCACHE(current), current->args[0]);
+		fdcache_done(current);
 	}
+	return 0;
+}
 
-	sockmap_remove(&P_SOCKMAP(current), current->args[0]);
+int sysx_close_range(syd_process_t *current)
+{
+	if (current->flags & SYD_FDCACHE_BUSY) {
+		fdcache_remove_range(&P_FDCACHE(current),
+				     (unsigned)current->args[0],
+				     (unsigned)current->args[1]);
+		fdcache_done(current);
+	}
 	return 0;
 }
 
@@ -456,10 +518,10 @@ int sys_mkdir(syd_process_t *current)
 		return 0;
 
 	init_sysinfo(&info);
-	info.rmode = RPATH_NOLAST;
+	info.rmode = RPATH_NOLAST | RPATH_MODIFY;
 	info.syd_mode = SYD_STAT_NOEXIST;
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_mkdirat(syd_process_t *current)
@@ -472,10 +534,10 @@ int sys_mkdirat(syd_process_t *current)
 	init_sysinfo(&info);
 	info.at_func = true;
 	info.arg_index = 1;
-	info.rmode = RPATH_NOLAST;
+	info.rmode = RPATH_NOLAST | RPATH_MODIFY;
 	info.syd_mode = SYD_STAT_NOEXIST;
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_mknod(syd_process_t *current)
@@ -486,10 +548,10 @@ int sys_mknod(syd_process_t *current)
 		return 0;
 
 	init_sysinfo(&info);
-	info.rmode = RPATH_NOLAST;
+	info.rmode = RPATH_NOLAST | RPATH_MODIFY;
 	info.syd_mode = SYD_STAT_NOEXIST;
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_mknodat(syd_process_t *current)
@@ -502,10 +564,10 @@ int sys_mknodat(syd_process_t *current)
 	init_sysinfo(&info);
 	info.at_func = true;
 	info.arg_index = 1;
-	info.rmode = RPATH_NOLAST;
+	info.rmode = RPATH_NOLAST | RPATH_MODIFY;
 	info.syd_mode = SYD_STAT_NOEXIST;
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_rmdir(syd_process_t *current)
@@ -516,10 +578,10 @@ int sys_rmdir(syd_process_t *current)
 		return 0;
 
 	init_sysinfo(&info);
-	info.rmode |= RPATH_NOFOLLOW;
+	info.rmode |= RPATH_NOFOLLOW | RPATH_MODIFY | RPATH_MODIFY_TREE;
 	info.syd_mode |= SYD_STAT_EMPTYDIR;
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_truncate(syd_process_t *current)
@@ -531,7 +593,7 @@ int sys_truncate(syd_process_t *current)
 
 	init_sysinfo(&info);
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_mount(syd_process_t *current)
@@ -543,8 +605,9 @@ int sys_mount(syd_process_t *current)
 
 	init_sysinfo(&info);
 	info.arg_index = 1;
+	info.rmode |= RPATH_MODIFY | RPATH_MODIFY_TREE;
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_umount(syd_process_t *current)
@@ -555,8 +618,9 @@ int sys_umount(syd_process_t *current)
 		return 0;
 
 	init_sysinfo(&info);
+	info.rmode |= RPATH_MODIFY | RPATH_MODIFY_TREE;
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_umount2(syd_process_t *current)
@@ -571,6 +635,7 @@ int sys_umount2(syd_process_t *current)
 		return 0;
 
 	init_sysinfo(&info);
+	info.rmode |= RPATH_MODIFY | RPATH_MODIFY_TREE;
 #ifdef UMOUNT_NOFOLLOW
 	/* check for UMOUNT_NOFOLLOW */
 	if ((r = syd_read_argument(current, 1, &flags)) < 0)
@@ -579,7 +644,7 @@ int sys_umount2(syd_process_t *current)
 		info.rmode |= RPATH_NOFOLLOW;
 #endif
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_utime(syd_process_t *current)
@@ -591,7 +656,7 @@ int sys_utime(syd_process_t *current)
 
 	init_sysinfo(&info);
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_utimes(syd_process_t *current)
@@ -603,7 +668,7 @@ int sys_utimes(syd_process_t *current)
 
 	init_sysinfo(&info);
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_utimensat(syd_process_t *current)
@@ -626,7 +691,7 @@ int sys_utimensat(syd_process_t *current)
 	if (flags & AT_SYMLINK_NOFOLLOW)
 		info.rmode |= RPATH_NOFOLLOW;
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_futimesat(syd_process_t *current)
@@ -641,7 +706,7 @@ int sys_futimesat(syd_process_t *current)
 	info.null_ok = true;
 	info.arg_index = 1;
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_unlink(syd_process_t *current)
@@ -652,10 +717,10 @@ int sys_unlink(syd_process_t *current)
 		return 0;
 
 	init_sysinfo(&info);
-	info.rmode |= RPATH_NOFOLLOW;
+	info.rmode |= RPATH_NOFOLLOW | RPATH_MODIFY;
 	info.syd_mode |= SYD_STAT_NOTDIR;
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_unlinkat(syd_process_t *current)
@@ -678,24 +743,40 @@ int sys_unlinkat(syd_process_t *current)
 	 * behaves like rmdir(2), otherwise it behaves like unlink(2).
 	 */
 	if (flags & AT_REMOVEDIR) { /* rmdir */
-		info.rmode |= RPATH_NOFOLLOW;
+		info.rmode |= RPATH_NOFOLLOW | RPATH_MODIFY | RPATH_MODIFY_TREE;
 		info.syd_mode |= SYD_STAT_EMPTYDIR;
 	} else { /* unlink */
-		info.rmode |= RPATH_NOFOLLOW;
+		info.rmode |= RPATH_NOFOLLOW | RPATH_MODIFY;
 		info.syd_mode |= SYD_STAT_NOTDIR;
 	}
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
+}
+
+/*
+ * Read both path arguments of a link() or rename() like system call with
+ * one bulk read. The paths are passed to box_check_path() as cache_path.
+ */
+static int decode_paths(syd_process_t *current, unsigned old_index,
+			unsigned new_index, char **path)
+{
+	const unsigned arg_index[2] = { old_index, new_index };
+
+	return path_decode_many(current, arg_index, path, 2);
 }
 
 int sys_link(syd_process_t *current)
 {
 	int r;
 	sysinfo_t info;
+	char *path[2];
 
 	if (sandbox_off_write(current))
 		return 0;
 
+	if ((r = decode_paths(current, 0, 1, path)) < 0)
+		return r;
+
 	init_sysinfo(&info);
 	/*
 	 * POSIX.1-2001 says that link() should dereference oldpath if it is a
@@ -709,15 +790,18 @@ int sys_link(syd_process_t *current)
 	 * it is a symbolic link.
 	 */
 	info.rmode |= RPATH_NOFOLLOW;
+	info.cache_path = path[0];
 
 	r = box_check_path(current, &info);
 	if (!r && !sysdeny(current)) {
 		info.arg_index = 1;
-		info.rmode = RPATH_NOLAST;
+		info.rmode = RPATH_NOLAST | RPATH_MODIFY;
 		info.syd_mode = SYD_STAT_NOEXIST;
-		return box_check_path(current, &info);
+		info.cache_path = path[1];
+		return box_check_path_async(current, &info);
 	}
 
+	scratch_free(path[1]);
 	return r;
 }
 
@@ -726,6 +810,7 @@ int sys_linkat(syd_process_t *current)
 	int r;
 	long flags;
 	sysinfo_t info;
+	char *path[2];
 
 	if (sandbox_off_write(current))
 		return 0;
@@ -734,21 +819,27 @@ int sys_linkat(syd_process_t *current)
 	if ((r = syd_read_argument(current, 4, &flags)) < 0)
 		return r;
 
+	if ((r = decode_paths(current, 1, 3, path)) < 0)
+		return r;
+
 	init_sysinfo(&info);
 	info.at_func = true;
 	info.arg_index = 1;
 	if (!(flags & AT_SYMLINK_FOLLOW))
 		info.rmode |= RPATH_NOFOLLOW;
+	info.cache_path = path[0];
 
 	r = box_check_path(current, &info);
 	if (!r && !sysdeny(current)) {
 		info.arg_index = 3;
 		info.rmode &= ~RPATH_MASK;
-		info.rmode |= RPATH_NOLAST;
+		info.rmode |= RPATH_NOLAST | RPATH_MODIFY;
 		info.syd_mode = SYD_STAT_NOEXIST;
-		return box_check_path(current, &info);
+		info.cache_path = path[1];
+		return box_check_path_async(current, &info);
 	}
 
+	scratch_free(path[1]);
 	return r;
 }
 
@@ -757,13 +848,18 @@ int sys_rename(syd_process_t *current)
 	int r;
 	struct stat statbuf;
 	sysinfo_t info;
+	char *path[2];
 
 	if (sandbox_off_write(current))
 		return 0;
 
+	if ((r = decode_paths(current, 0, 1, path)) < 0)
+		return r;
+
 	init_sysinfo(&info);
-	info.rmode = RPATH_NOFOLLOW;
+	info.rmode = RPATH_NOFOLLOW | RPATH_MODIFY | RPATH_MODIFY_TREE;
 	info.ret_statbuf = &statbuf;
+	info.cache_path = path[0];
 
 	statbuf.st_mode = 0;
 	r = box_check_path(current, &info);
@@ -779,46 +875,78 @@ int sys_rename(syd_process_t *current)
 			info.syd_mode |= SYD_STAT_EMPTYDIR;
 		}
 		info.ret_statbuf = NULL;
-		return box_check_path(current, &info);
+		info.cache_path = path[1];
+		return box_check_path_async(current, &info);
 	}
 
+	scratch_free(path[1]);
 	return r;
 }
 
-int sys_renameat(syd_process_t *current)
+static int check_renameat(syd_process_t *current, long flags)
 {
 	int r;
 	struct stat statbuf;
 	sysinfo_t info;
+	char *path[2];
 
-	if (sandbox_off_write(current))
-		return 0;
+	if ((r = decode_paths(current, 1, 3, path)) < 0)
+		return r;
 
 	init_sysinfo(&info);
 	info.at_func = true;
 	info.arg_index = 1;
-	info.rmode = RPATH_NOFOLLOW;
+	info.rmode = RPATH_NOFOLLOW | RPATH_MODIFY | RPATH_MODIFY_TREE;
 	info.ret_statbuf = &statbuf;
+	info.cache_path = path[0];
 
+	statbuf.st_mode = 0;
 	r = box_check_path(current, &info);
 	if (!r && !sysdeny(current)) {
 		info.arg_index = 3;
-		info.rmode &= ~RPATH_MASK;
-		info.rmode |= RPATH_NOLAST;
-		if (S_ISDIR(statbuf.st_mode)) {
-			/* oldpath specifies a directory.
-			 * In this case, newpath must either not exist,
-			 * or it must specify an empty directory.
-			 */
-			info.syd_mode |= SYD_STAT_EMPTYDIR;
+		/* RENAME_EXCHANGE: newpath must exist, it replaces oldpath. */
+		if (!(flags & RENAME_EXCHANGE)) {
+			info.rmode &= ~RPATH_MASK;
+			info.rmode |= RPATH_NOLAST;
+			if (S_ISDIR(statbuf.st_mode)) {
+				/* oldpath specifies a directory.
+				 * In this case, newpath must either not exist,
+				 * or it must specify an empty directory.
+				 */
+				info.syd_mode |= SYD_STAT_EMPTYDIR;
+			}
 		}
 		info.ret_statbuf = NULL;
-		return box_check_path(current, &info);
+		info.cache_path = path[1];
+		return box_check_path_async(current, &info);
 	}
 
+	scratch_free(path[1]);
 	return r;
 }
 
+int sys_renameat(syd_process_t *current)
+{
+	if (sandbox_off_write(current))
+		return 0;
+
+	return check_renameat(current, 0);
+}
+
+int sys_renameat2(syd_process_t *current)
+{
+	int r;
+	long flags;
+
+	if (sandbox_off_write(current))
+		return 0;
+
+	if ((r = syd_read_argument(current, 4, &flags)) < 0)
+		return r;
+
+	return check_renameat(current, flags);
+}
+
 int sys_symlink(syd_process_t *current)
 {
 	sysinfo_t info;
@@ -828,10 +956,10 @@ int sys_symlink(syd_process_t *current)
 
 	init_sysinfo(&info);
 	info.arg_index = 1;
-	info.rmode = RPATH_NOLAST | RPATH_NOFOLLOW;
+	info.rmode = RPATH_NOLAST | RPATH_NOFOLLOW | RPATH_MODIFY;
 	info.syd_mode = SYD_STAT_NOEXIST;
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_symlinkat(syd_process_t *current)
@@ -844,10 +972,10 @@ int sys_symlinkat(syd_process_t *current)
 	init_sysinfo(&info);
 	info.at_func = true;
 	info.arg_index = 2;
-	info.rmode = RPATH_NOLAST | RPATH_NOFOLLOW;
+	info.rmode = RPATH_NOLAST | RPATH_NOFOLLOW | RPATH_MODIFY;
 	info.syd_mode = SYD_STAT_NOEXIST;
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 static int check_listxattr(syd_process_t *current, bool nofollow)
@@ -864,7 +992,7 @@ static int check_listxattr(syd_process_t *current, bool nofollow)
 		info.rmode |= RPATH_NOFOLLOW;
 	sysinfo_read_access(current, &info);
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_listxattr(syd_process_t *current)
@@ -886,7 +1014,7 @@ int sys_setxattr(syd_process_t *current)
 
 	init_sysinfo(&info);
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_lsetxattr(syd_process_t *current)
@@ -899,7 +1027,7 @@ int sys_lsetxattr(syd_process_t *current)
 	init_sysinfo(&info);
 	info.rmode |= RPATH_NOFOLLOW;
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_removexattr(syd_process_t *current)
@@ -911,7 +1039,7 @@ int sys_removexattr(syd_process_t *current)
 
 	init_sysinfo(&info);
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
 
 int sys_lremovexattr(syd_process_t *current)
@@ -924,5 +1052,5 @@ int sys_lremovexattr(syd_process_t *current)
 	init_sysinfo(&info);
 	info.rmode |= RPATH_NOFOLLOW;
 
-	return box_check_path(current, &info);
+	return box_check_path_async(current, &info);
 }
@@ -12,127 +12,220 @@
 #include <errno.h>
 #include <stdint.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <sys/mman.h>
 
 #if SYDBOX_HAVE_SECCOMP
 # include "seccomp.h"
 #endif
 
-static int filter_open_index(int arch, uint32_t sysnum, unsigned flag_index)
+/*
+ * Simple filters are compiled into the seccomp filter program, see
+ * seccomp_apply(). Each program loads the arguments of the system call,
+ * returns SECCOMP_RET_ERRNO to deny it and falls through otherwise.
+ */
+#if SYDBOX_HAVE_SECCOMP
+/* check for O_ASYNC|O_DIRECT|O_SYNC */
+static const struct sock_filter open_filter[] = {
+	BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_arg(1)), /* flags */
+	BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, O_ASYNC|O_DIRECT|O_SYNC, 0, 1),
+	BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ERRNO|(EINVAL & SECCOMP_RET_DATA)),
+};
+static const struct sock_filter openat_filter[] = {
+	BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_arg(2)), /* flags */
+	BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, O_ASYNC|O_DIRECT|O_SYNC, 0, 1),
+	BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ERRNO|(EINVAL & SECCOMP_RET_DATA)),
+};
+static const struct sock_filter fcntl_filter[] = {
+	BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_arg(1)), /* cmd */
+	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_SETFL, 11, 0), /* check arg2 */
+	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_GETFL, 13, 0),
+	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_SETOWN, 12, 0),
+	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_SETLK, 11, 0),
+	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_SETLKW, 10, 0),
+	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_SETLK64, 9, 0),
+	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_SETLKW64, 8, 0),
+	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_GETFD, 7, 0),
+	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_SETFD, 6, 0),
+	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_DUPFD, 5, 0),
+	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_DUPFD_CLOEXEC, 4, 0),
+	BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ERRNO|(EPERM & SECCOMP_RET_DATA)),
+	BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_arg(2)), /* flags */
+	BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, O_ASYNC|O_DIRECT, 0, 1),
+	BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ERRNO|(EINVAL & SECCOMP_RET_DATA)),
+};
+/* check for PROT_WRITE & MAP_SHARED */
+static const struct sock_filter mmap_filter[] = {
+	BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_arg(2)), /* prot */
+	BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, PROT_WRITE, 0, 3),
+	BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_arg(3)), /* flags */
+	BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, MAP_SHARED, 0, 1),
+	BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ERRNO|(EINVAL & SECCOMP_RET_DATA)),
+};
+#endif
+
+size_t filter_open(const struct sock_filter **prog)
 {
 #if SYDBOX_HAVE_SECCOMP
-	if (!sydbox->config.restrict_file_control)
-		return 0;
+	if (sydbox->config.restrict_file_control) {
+		*prog = open_filter;
+		return ELEMENTSOF(open_filter);
+	}
+#endif
+	return 0;
+}
+
+size_t filter_openat(const struct sock_filter **prog)
+{
+#if SYDBOX_HAVE_SECCOMP
+	if (sydbox->config.restrict_file_control) {
+		*prog = openat_filter;
+		return ELEMENTSOF(openat_filter);
+	}
+#endif
+	return 0;
+}
 
-	struct sock_filter open_filter[] = {
-		/* check for arch & syscall_nr */
-		BPF_STMT(BPF_LD+BPF_W+BPF_ABS, arch_nr),
-		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, arch, 1, 0),
-		BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW),
-		BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_nr),
-		/* check for O_ASYNC|O_DIRECT|O_SYNC */
-		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, sysnum, 0, 3),
-		BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_arg(flag_index)),
-		BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, ~(O_ASYNC|O_DIRECT|O_SYNC), 1, 0),
-		BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ERRNO|(EINVAL & SECCOMP_RET_DATA)),
-		BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW)
-	};
-	struct sock_fprog prog;
-
-	memset(&prog, 0, sizeof(prog));
-	prog.filter = open_filter;
-	prog.len = ELEMENTSOF(open_filter);
-
-	if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) < 0)
-		return -errno;
+size_t filter_fcntl(const struct sock_filter **prog)
+{
+#if SYDBOX_HAVE_SECCOMP
+	if (sydbox->config.restrict_file_control) {
+		*prog = fcntl_filter;
+		return ELEMENTSOF(fcntl_filter);
+	}
 #endif
 	return 0;
 }
 
-int filter_open(int arch, uint32_t sysnum)
+size_t filter_mmap(const struct sock_filter **prog)
+{
+#if SYDBOX_HAVE_SECCOMP
+	if (sydbox->config.restrict_shared_memory_writable) {
+		*prog = mmap_filter;
+		return ELEMENTSOF(mmap_filter);
+	}
+#endif
+	return 0;
+}
+
+/*
+ * Argument checks which are run before a system call is trapped.
+ * Each program loads an argument, returns SECCOMP_RET_ALLOW if the tracer
+ * would let the system call through anyway and falls through to the trap
+ * otherwise.
+ */
+#if SYDBOX_HAVE_SECCOMP
+/* O_RDONLY without O_CREAT */
+static const struct sock_filter open_prefilter[] = {
+	BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_arg(1)), /* flags */
+	BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, O_ACCMODE|O_CREAT, 1, 0),
+	BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW),
+};
+static const struct sock_filter openat_prefilter[] = {
+	BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_arg(2)), /* flags */
+	BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, O_ACCMODE|O_CREAT, 1, 0),
+	BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW),
+};
+/* mode without W_OK */
+static const struct sock_filter access_prefilter[] = {
+	BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_arg(1)), /* mode */
+	BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, W_OK, 1, 0),
+	BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW),
+};
+static const struct sock_filter faccessat_prefilter[] = {
+	BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_arg(2)), /* mode */
+	BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, W_OK, 1, 0),
+	BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW),
+};
+/* command other than F_DUPFD and F_DUPFD_CLOEXEC */
+static const struct sock_filter fcntl_prefilter[] = {
+	BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_arg(1)), /* cmd */
+	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_DUPFD, 2, 0),
+	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_DUPFD_CLOEXEC, 1, 0),
+	BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW),
+};
+/* NULL destination address, both halves of the 64 bit argument */
+static const struct sock_filter sendto_prefilter[] = {
+	BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_arg(4)), /* dest_addr */
+	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, 0, 0, 3),
+	BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_arg(4) + sizeof(uint32_t)),
+	BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, 0, 0, 1),
+	BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW),
+};
+#endif
+
+/*
+ * The filters are inherited and can not be changed once installed so a
+ * disabled read sandbox may only be relied upon if the sandboxed processes
+ * are not able to turn it on with magic commands.
+ */
+static bool prefilter_read_off(void)
 {
-	return filter_open_index(arch, sysnum, 1);
+	return !!(sydbox->sandbox_locked & SYD_SANDBOX_READ);
 }
 
-int filter_openat(int arch, uint32_t sysnum)
+size_t prefilter_open(const struct sock_filter **prog)
 {
-	return filter_open_index(arch, sysnum, 2);
+#if SYDBOX_HAVE_SECCOMP
+	if (prefilter_read_off()) {
+		*prog = open_prefilter;
+		return ELEMENTSOF(open_prefilter);
+	}
+#endif
+	return 0;
 }
 
-int filter_fcntl(int arch, uint32_t sysnum)
+size_t prefilter_openat(const struct sock_filter **prog)
 {
 #if SYDBOX_HAVE_SECCOMP
-	if (!sydbox->config.restrict_file_control)
-		return 0;
+	if (prefilter_read_off()) {
+		*prog = openat_prefilter;
+		return ELEMENTSOF(openat_prefilter);
+	}
+#endif
+	return 0;
+}
 
-	struct sock_filter fcntl_filter[] = {
-		/* check for arch & syscall_nr */
-		BPF_STMT(BPF_LD+BPF_W+BPF_ABS, arch_nr),
-		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, arch, 1, 0),
-		BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW),
-		BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_nr),
-		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, sysnum, 0, 16),
-		BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_arg(1)), /* cmd */
-		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_GETFL, 13, 0),
-		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_SETFL, 12, 0), /* check arg0 */
-		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_SETOWN, 11, 0),
-		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_SETLK, 10, 0),
-		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_SETLKW, 9, 0),
-		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_SETLK64, 8, 0),
-		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_SETLKW64, 7, 0),
-		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_GETFD, 6, 0),
-		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_SETFD, 5, 0),
-		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_DUPFD, 4, 0),
-		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, F_DUPFD_CLOEXEC, 3, 0),
-		BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ERRNO|(EPERM & SECCOMP_RET_DATA)),
-		BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_arg(2)),
-		BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, ~(O_ASYNC|O_DIRECT), 1, 0),
-		BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ERRNO|(EINVAL & SECCOMP_RET_DATA)),
-		BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW)
-	};
-	struct sock_fprog prog;
-
-	memset(&prog, 0, sizeof(prog));
-	prog.filter = fcntl_filter;
-	prog.len = ELEMENTSOF(fcntl_filter);
-
-	if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) < 0)
-		return -errno;
+size_t prefilter_access(const struct sock_filter **prog)
+{
+#if SYDBOX_HAVE_SECCOMP
+	if (prefilter_read_off()) {
+		*prog = access_prefilter;
+		return ELEMENTSOF(access_prefilter);
+	}
 #endif
 	return 0;
 }
 
-int filter_mmap(int arch, uint32_t sysnum)
+size_t prefilter_faccessat(const struct sock_filter **prog)
 {
 #if SYDBOX_HAVE_SECCOMP
-	if (!sydbox->config.restrict_shared_memory_writable)
-		return 0;
+	if (prefilter_read_off()) {
+		*prog = faccessat_prefilter;
+		return ELEMENTSOF(faccessat_prefilter);
+	}
+#endif
+	return 0;
+}
 
-	struct sock_filter mmap_filter[] = {
-		/* check for arch & syscall_nr */
-		BPF_STMT(BPF_LD+BPF_W+BPF_ABS, arch_nr),
-		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, arch, 1, 0),
-		BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW),
-		BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_nr),
-		/* check for PROT_WRITE & MAP_SHARED */
-		BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, sysnum, 0, 5),
-		BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_arg(2)), /* prot */
-		BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, ~PROT_WRITE, 3, 0),
-		BPF_STMT(BPF_LD+BPF_W+BPF_ABS, syscall_arg(3)), /* flags */
-		BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, ~MAP_SHARED, 1, 0),
-		BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ERRNO|(EINVAL & SECCOMP_RET_DATA)),
-		BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW)
-	};
-	struct sock_fprog prog;
-
-	memset(&prog, 0, sizeof(prog));
-	prog.filter = mmap_filter;
-	prog.len = ELEMENTSOF(mmap_filter);
-
-	if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) < 0)
-		return -errno;
+size_t prefilter_fcntl(const struct sock_filter **prog)
+{
+#if SYDBOX_HAVE_SECCOMP
+	*prog = fcntl_prefilter;
+	return ELEMENTSOF(fcntl_prefilter);
+#else
+	return 0;
 #endif
+}
+
+size_t prefilter_sendto(const struct sock_filter **prog)
+{
+#if SYDBOX_HAVE_SECCOMP
+	*prog = sendto_prefilter;
+	return ELEMENTSOF(sendto_prefilter);
+#else
 	return 0;
+#endif
 }
 
 int sys_fallback_mmap(syd_process_t *current)
@@ -21,6 +21,39 @@
 #include "bsd-compat.h"
 #include "sockmap.h"
 
+void sockmap_retain(struct acl_node *node)
+{
+	auto_lock();
+	node->refcnt++;
+	auto_unlock();
+}
+
+void sockmap_release(struct acl_node *node)
+{
+	auto_lock();
+	if (acl_release_sockmatch(node, &sydbox->config.acl_network_connect_auto))
+		box_cache_flush();
+	auto_unlock();
+}
+
+/*
+ * Whitelist the address of a bound socket for connect() until the socket is
+ * closed or its last owner exits, see sockmap_del().
+ */
+static void whitelist_bind(syd_process_t *current, int fd,
+			   struct sockmatch *match)
+{
+	struct acl_node *node;
+
+	auto_lock();
+	node = acl_retain_sockmatch(ACL_ACTION_WHITELIST, match,
+				    &sydbox->config.acl_network_connect_auto);
+	if (node->refcnt == 1)
+		box_cache_flush();
+	auto_unlock();
+	sockmap_add_full(&P_SOCKMAP(current), fd, NULL, node);
+}
+
 int sys_bind(syd_process_t *current)
 {
 	int r;
@@ -64,19 +97,19 @@ int sys_bind(syd_process_t *current)
 		if (r < 0)
 			goto out;
 		current->args[0] = fd;
+		/* saved until the system call exits */
 		P_SAVEBIND(current) = xmalloc(sizeof(struct sockinfo));
-		P_SAVEBIND(current)->path = unix_abspath;
-		P_SAVEBIND(current)->addr = psa;
+		P_SAVEBIND(current)->path = scratch_keepstr(unix_abspath);
+		P_SAVEBIND(current)->addr = scratch_keep(psa,
+							 sizeof(struct pink_sockaddr));
 		current->flags |= SYD_STOP_AT_SYSEXIT;
 		return 0;
 	}
 
 out:
 	if (sydbox->config.whitelist_successful_bind) {
-		if (unix_abspath)
-			free(unix_abspath);
-		if (psa)
-			free(psa);
+		scratch_free(unix_abspath);
+		scratch_free(psa);
 	}
 
 	return r;
@@ -86,7 +119,6 @@ int sysx_bind(syd_process_t *current)
 {
 	int r;
 	long retval;
-	struct acl_node *node;
 	struct sockmatch *match;
 
 	if (sandbox_off_network(current) ||
@@ -115,11 +147,10 @@ int sysx_bind(syd_process_t *current)
 #endif
 
 	/* whitelist socket address */
-	node = xcalloc(1, sizeof(struct acl_node));
 	match = sockmatch_new(P_SAVEBIND(current));
-	node->action = ACL_ACTION_WHITELIST;
-	node->match = match;
-	ACLQ_INSERT_TAIL(&sydbox->config.acl_network_connect_auto, node);
+	free_sockinfo(P_SAVEBIND(current));
+	P_SAVEBIND(current) = NULL;
+	whitelist_bind(current, current->args[0], match);
 	return 0;
 zero:
 	/* save sockfd with port 0 for whitelisting */
@@ -197,7 +228,6 @@ int sysx_getsockname(syd_process_t *current)
 	unsigned port;
 	long retval;
 	struct pink_sockaddr psa;
-	struct acl_node *node;
 	const struct sockinfo *info;
 	struct sockmatch *match;
 
@@ -222,7 +252,6 @@ int sysx_getsockname(syd_process_t *current)
 	info = sockmap_find(&P_SOCKMAP(current), current->args[0]);
 	assert(info);
 	match = sockmatch_new(info);
-	sockmap_remove(&P_SOCKMAP(current), current->args[0]);
 
 	switch (match->family) {
 	case AF_INET:
@@ -242,10 +271,7 @@ int sysx_getsockname(syd_process_t *current)
 	}
 
 	/* whitelist bind(0 -> port) for connect() */
-	node = xcalloc(1, sizeof(struct acl_node));
-	node->action = ACL_ACTION_WHITELIST;
-	node->match = match;
-	ACLQ_INSERT_TAIL(&sydbox->config.acl_network_connect_auto, node);
+	whitelist_bind(current, current->args[0], match);
 	return 0;
 }
 
@@ -21,10 +21,12 @@
 #include <sys/types.h>
 #include <sched.h>
 #include "pink.h"
+#include "path.h"
 #include "pathdecode.h"
 #include "proc.h"
 #include "bsd-compat.h"
 #include "sockmap.h"
+#include "fdcache.h"
 
 #include <stdio.h>
 
@@ -61,30 +63,42 @@ struct stat32 { /* for 32bit emulation */
 # warning do not know the size of stat buffer for non-default ABIs
 #endif
 
+int sys_chdir(syd_process_t *current)
+{
+	/*
+	 * The working directory is read from /proc lazily by update_cwd()
+	 * when a relative path needs it, so there is no need to stop at
+	 * system call exit to see whether chdir(2) succeeded. Unless the
+	 * working directory is shared: another process may read it before
+	 * chdir(2) runs, it is marked stale again at exit then.
+	 */
+	P_CWD_STALE(current) = true;
+	if (P_CLONE_FS_REFCNT(current) > 1)
+		current->flags |= SYD_STOP_AT_SYSEXIT;
+	return 0;
+}
+
 int sysx_chdir(syd_process_t *current)
+{
+	P_CWD_STALE(current) = true;
+	return 0;
+}
+
+int update_cwd(syd_process_t *current)
 {
 	int r;
-	long retval;
 	char *newcwd;
 
-	if ((r = syd_read_retval(current, &retval, NULL)) < 0)
-		return r;
-
-	if (retval < 0) {
-		/* TODO: dump(DUMP_SYSCALL, current, "chdir", retval, "ignore"); */
+	if (!P_CWD_STALE(current))
 		return 0;
-	}
-
-	if ((r = proc_cwd(current->pid, sydbox->config.use_toolong_hack, &newcwd)) < 0) {
-		/* TODO: dump(DUMP_SYSCALL, current, "chdir", retval, "panic"); */
-		return panic(current);
-	}
 
-	/* TODO: dump(DUMP_SYSCALL, current, "chdir", retval, "success", P_CWD(current), newcwd); */
+	if ((r = proc_cwd(current->pid, sydbox->config.use_toolong_hack, &newcwd)) < 0)
+		return r;
 
 	if (P_CWD(current))
 		free(P_CWD(current));
 	P_CWD(current) = newcwd;
+	P_CWD_STALE(current) = false;
 	return 0;
 }
 
@@ -105,16 +119,18 @@ int sys_execve(syd_process_t *current)
 	else if (r < 0)
 		return deny(current, errno);
 
-	r = box_resolve_path(path, P_CWD(current), current->pid, RPATH_EXIST, &abspath);
+	r = path_is_absolute(path) ? 0 : update_cwd(current);
+	if (r == 0)
+		r = box_resolve_path(path, P_CWD(current), current->pid, RPATH_EXIST, &abspath);
 	if (r < 0) {
 		/* resolve_path failed, deny */
 		r = deny(current, -r);
 		if (sydbox->config.violation_raise_fail)
 			violation(current, "%s(`%s')", current->sysname, path);
-		free(path);
+		scratch_free(path);
 		return r;
 	}
-	free(path);
+	scratch_free(path);
 
 	/*
 	 * Handling exec.kill_if_match and exec.resume_if_match:
@@ -126,6 +142,7 @@ int sys_execve(syd_process_t *current)
 	 */
 	if (current->abspath)
 		free(current->abspath);
+	abspath = scratch_keepstr(abspath);
 	current->abspath = abspath;
 
 	switch (P_BOX(current)->sandbox_exec) {
@@ -158,6 +175,27 @@ int sys_execve(syd_process_t *current)
 	return r;
 }
 
+/* Map the return value of a failed magic command to an errno */
+static int magic_errno(int r)
+{
+	switch (r) {
+	case MAGIC_RET_NOT_SUPPORTED:
+		return ENOTSUP;
+	case MAGIC_RET_INVALID_KEY:
+	case MAGIC_RET_INVALID_TYPE:
+	case MAGIC_RET_INVALID_VALUE:
+	case MAGIC_RET_INVALID_QUERY:
+	case MAGIC_RET_INVALID_COMMAND:
+	case MAGIC_RET_INVALID_OPERATION:
+		return EINVAL;
+	case MAGIC_RET_OOM:
+		return ENOMEM;
+	case MAGIC_RET_NOPERM:
+	default:
+		return EPERM;
+	}
+}
+
 int sys_stat(syd_process_t *current)
 {
 	int r;
@@ -180,31 +218,10 @@ int sys_stat(syd_process_t *current)
 		return 0;
 	} else if (MAGIC_ERROR(r)) {
 		say("failed to cast magic=`%s': %s", path, magic_strerror(r));
-		if (r == MAGIC_RET_PROCESS_TERMINATED) {
+		if (r == MAGIC_RET_PROCESS_TERMINATED)
 			r = -ESRCH;
-		} else {
-			switch (r) {
-			case MAGIC_RET_NOT_SUPPORTED:
-				errno = ENOTSUP;
-				break;
-			case MAGIC_RET_INVALID_KEY:
-			case MAGIC_RET_INVALID_TYPE:
-			case MAGIC_RET_INVALID_VALUE:
-			case MAGIC_RET_INVALID_QUERY:
-			case MAGIC_RET_INVALID_COMMAND:
-			case MAGIC_RET_INVALID_OPERATION:
-				errno = EINVAL;
-				break;
-			case MAGIC_RET_OOM:
-				errno = ENOMEM;
-				break;
-			case MAGIC_RET_NOPERM:
-			default:
-				errno = EPERM;
-				break;
-			}
-			r = deny(current, errno);
-		}
+		else
+			r = deny(current, magic_errno(r));
 	} else if (r != MAGIC_RET_NOOP) {
 		/* Write stat buffer */
 		const char *bufaddr = NULL;
@@ -255,8 +272,8 @@ int sys_stat(syd_process_t *current)
 			bufsize = sizeof(struct stat);
 		}
 
-		if (pink_read_argument(current->pid, current->regset, 1, &addr) == 0)
-			pink_write_vm_data(current->pid, current->regset, addr, bufaddr, bufsize);
+		if (syd_read_argument(current, 1, &addr) == 0)
+			syd_write_vm_data(current, addr, bufaddr, bufsize);
 #if !PINK_ARCH_X86_64
 skip_write:
 #endif
@@ -277,6 +294,40 @@ skip_write:
 	return r;
 }
 
+/*
+ * Magic commands via the reserved system call SYDBOX_MAGIC_SYSCALL.
+ * Unlike stat(2) this does not need anything but the system call number
+ * to be trapped. Returns zero for accepted commands and true queries,
+ * ENOENT for false queries. The kernel returns ENOSYS if magic is locked.
+ */
+int sys_magic(syd_process_t *current)
+{
+	int r;
+	long addr;
+	char path[SYDBOX_PATH_MAX];
+
+	if (P_BOX(current)->magic_lock == LOCK_SET) {
+		/* No magic allowed! */
+		return 0;
+	}
+
+	if ((r = syd_read_argument(current, 0, &addr)) < 0)
+		return r;
+	if (syd_read_string(current, addr, path, SYDBOX_PATH_MAX) < 0)
+		return errno == EFAULT ? deny(current, EFAULT) : -errno;
+
+	r = magic_cast_string(current, path, 1);
+	if (r == MAGIC_RET_NOOP)
+		return deny(current, EINVAL);
+	if (r == MAGIC_RET_PROCESS_TERMINATED)
+		return -ESRCH;
+	if (MAGIC_ERROR(r)) {
+		say("failed to cast magic=`%s': %s", path, magic_strerror(r));
+		return deny(current, magic_errno(r));
+	}
+	return deny(current, r == MAGIC_RET_FALSE ? ENOENT : 0);
+}
+
 int sys_dup(syd_process_t *current)
 {
 	int r;
@@ -296,11 +347,31 @@ int sys_dup(syd_process_t *current)
 	return 0;
 }
 
+int sys_dup3(syd_process_t *current)
+{
+	int r;
+	long newfd;
+
+	/* newfd is closed silently if it was open */
+	if ((r = syd_read_argument(current, 1, &newfd)) < 0)
+		return r;
+	current->args[1] = newfd;
+	fdcache_remove(&P_FDCACHE(current), newfd);
+	fdcache_busy(current);
+
+	return sys_dup(current);
+}
+
 int sysx_dup(syd_process_t *current)
 {
 	int r;
 	long retval;
-	const struct sockinfo *oldinfo;
+
+	if (current->flags & SYD_FDCACHE_BUSY) {
+		/* dup2(2) or dup3(2) replaced newfd */
+		fdcache_remove(&P_FDCACHE(current), current->args[1]);
+		fdcache_done(current);
+	}
 
 	if (sandbox_off_network(current) ||
 	    !sydbox->config.whitelist_successful_bind ||
@@ -315,13 +386,8 @@ int sysx_dup(syd_process_t *current)
 		return 0;
 	}
 
-	if (!(oldinfo = sockmap_find(&P_SOCKMAP(current), current->args[0]))) {
-		/* duplicated unknown file descriptor, ignore */
-		return 0;
-	}
-
-	/* file descriptor duplicated */
-	sockmap_add(&P_SOCKMAP(current), retval, sockinfo_xdup(oldinfo));
+	/* file descriptor duplicated, unknown ones are ignored */
+	sockmap_dup(&P_SOCKMAP(current), current->args[0], retval);
 	return 0;
 }
 
@@ -391,7 +457,6 @@ int sysx_fcntl(syd_process_t *current)
 {
 	int r;
 	long retval;
-	const struct sockinfo *oldinfo;
 
 	if (sandbox_off_network(current) ||
 	    !sydbox->config.whitelist_successful_bind ||
@@ -406,13 +471,8 @@ int sysx_fcntl(syd_process_t *current)
 		return 0;
 	}
 
-	if (!(oldinfo = sockmap_find(&P_SOCKMAP(current), current->args[0]))) {
-		/* unknown file descriptor duplicated, ignore */
-		return 0;
-	}
-
-	/* file descriptor duplicated */
-	sockmap_add(&P_SOCKMAP(current), retval, sockinfo_xdup(oldinfo));
+	/* file descriptor duplicated, unknown ones are ignored */
+	sockmap_dup(&P_SOCKMAP(current), current->args[0], retval);
 	return 0;
 }
 
@@ -441,6 +501,21 @@ int sys_vfork(syd_process_t *current)
 	return set_clone_flags(current, CLONE_VM|CLONE_VFORK|SIGCHLD);
 }
 
+int sys_unshare(syd_process_t *current)
+{
+	int r;
+	long flags;
+
+	if ((r = syd_read_argument(current, 0, &flags)) < 0)
+		return r;
+	if (flags & CLONE_FILES) {
+		/* the table is not shared with anyone else anymore */
+		fdcache_destroy(&P_FDCACHE(current));
+		P_FDCACHE_OFF(current) = true;
+	}
+	return 0;
+}
+
 int sys_clone(syd_process_t *current)
 {
 	int r;
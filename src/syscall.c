@@ -61,28 +61,42 @@ static const sysentry_t syscall_entries[] = {
 		.enter = sys_stat,
 	},
 
+	{
+		.no = SYDBOX_MAGIC_SYSCALL,
+		.enter = sys_magic,
+	},
+
 	{
 		.name = "access",
 		.enter = sys_access,
+		.prefilter = prefilter_access,
+		.sandbox = SYD_SANDBOX_READ|SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "faccessat",
 		.enter = sys_faccessat,
+		.prefilter = prefilter_faccessat,
+		.sandbox = SYD_SANDBOX_READ|SYD_SANDBOX_WRITE,
 	},
 
 	{
 		.name = "open",
 		.filter = filter_open,
 		.enter = sys_open,
+		.prefilter = prefilter_open,
+		.sandbox = SYD_SANDBOX_READ|SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "openat",
 		.filter = filter_openat,
 		.enter = sys_openat,
+		.prefilter = prefilter_openat,
+		.sandbox = SYD_SANDBOX_READ|SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "creat",
 		.enter = sys_creat,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 
 	{
@@ -90,151 +104,217 @@ static const sysentry_t syscall_entries[] = {
 		.filter = filter_fcntl,
 		.enter = sys_fcntl,
 		.exit = sysx_fcntl,
+		.prefilter = prefilter_fcntl,
+		.sandbox = SYD_SANDBOX_NETWORK,
 	},
 	{
 		.name = "fcntl64",
 		.filter = filter_fcntl,
 		.enter = sys_fcntl,
 		.exit = sysx_fcntl,
+		.prefilter = prefilter_fcntl,
+		.sandbox = SYD_SANDBOX_NETWORK,
 	},
 	{
 		.name = "dup",
 		.enter = sys_dup,
 		.exit = sysx_dup,
+		.sandbox = SYD_SANDBOX_NETWORK,
+		.successful_bind = true,
 	},
 	{
 		.name = "dup2",
-		.enter = sys_dup,
+		.enter = sys_dup3,
 		.exit = sysx_dup,
+		.sandbox = SYD_SANDBOX_NETWORK,
+		.fd_table = true,
+		.successful_bind = true,
 	},
 	{
 		.name = "dup3",
-		.enter = sys_dup,
+		.enter = sys_dup3,
 		.exit = sysx_dup,
+		.sandbox = SYD_SANDBOX_NETWORK,
+		.fd_table = true,
+		.successful_bind = true,
+	},
+	{
+		.name = "close",
+		.enter = sys_close,
+		.exit = sysx_close,
+		.sandbox = SYD_SANDBOX_NETWORK,
+		.fd_table = true,
+		.successful_bind = true,
+	},
+	{
+		.name = "close_range",
+		.enter = sys_close_range,
+		.exit = sysx_close_range,
+		.sandbox = SYD_SANDBOX_NETWORK,
+		.fd_table = true,
+		.successful_bind = true,
+	},
+	{
+		.name = "unshare",
+		.enter = sys_unshare,
+		.fd_table = true,
 	},
 
 	{
 		.name = "chdir",
+		.enter = sys_chdir,
 		.exit = sysx_chdir,
 	},
 	{
 		.name = "fchdir",
+		.enter = sys_chdir,
 		.exit = sysx_chdir,
 	},
 
 	{
 		.name = "chmod",
 		.enter = sys_chmod,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "fchmodat",
 		.enter = sys_fchmodat,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 
 	{
 		.name = "chown",
 		.enter = sys_chown,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "chown32",
 		.enter = sys_chown,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "lchown",
 		.enter = sys_lchown,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "lchown32",
 		.enter = sys_lchown,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "fchownat",
 		.enter = sys_fchownat,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 
 	{
 		.name = "mkdir",
 		.enter = sys_mkdir,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "mkdirat",
 		.enter = sys_mkdirat,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 
 	{
 		.name = "mknod",
 		.enter = sys_mknod,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "mknodat",
 		.enter = sys_mknodat,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 
 	{
 		.name = "rmdir",
 		.enter = sys_rmdir,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 
 	{
 		.name = "truncate",
 		.enter = sys_truncate,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "truncate64",
 		.enter = sys_truncate,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 
 	{
 		.name = "utime",
 		.enter = sys_utime,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "utimes",
 		.enter = sys_utimes,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "utimensat",
 		.enter = sys_utimensat,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "futimesat",
 		.enter = sys_futimesat,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 
 	{
 		.name = "unlink",
 		.enter = sys_unlink,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "unlinkat",
 		.enter = sys_unlinkat,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 
 	{
 		.name = "link",
 		.enter = sys_link,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "linkat",
 		.enter = sys_linkat,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 
 	{
 		.name = "rename",
 		.enter = sys_rename,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "renameat",
 		.enter = sys_renameat,
+		.sandbox = SYD_SANDBOX_WRITE,
+	},
+	{
+		.name = "renameat2",
+		.enter = sys_renameat2,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 
 	{
 		.name = "symlink",
 		.enter = sys_symlink,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "symlinkat",
 		.enter = sys_symlinkat,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 
 	{
@@ -259,62 +339,77 @@ static const sysentry_t syscall_entries[] = {
 		.name = "socketcall",
 		.enter = sys_socketcall,
 		.exit = sysx_socketcall,
+		.sandbox = SYD_SANDBOX_NETWORK,
 	},
 	{
 		.name = "bind",
 		.enter = sys_bind,
 		.exit = sysx_bind,
+		.sandbox = SYD_SANDBOX_NETWORK,
 	},
 	{
 		.name = "connect",
 		.enter = sys_connect,
+		.sandbox = SYD_SANDBOX_NETWORK,
 	},
 	{
 		.name = "sendto",
 		.enter = sys_sendto,
+		.prefilter = prefilter_sendto,
+		.sandbox = SYD_SANDBOX_NETWORK,
 	},
 	{
 		.name = "getsockname",
 		.enter = sys_getsockname,
 		.exit = sysx_getsockname,
+		.sandbox = SYD_SANDBOX_NETWORK,
 	},
 
 	{
 		.name = "listxattr",
 		.enter = sys_listxattr,
+		.sandbox = SYD_SANDBOX_READ,
 	},
 	{
 		.name = "llistxattr",
 		.enter = sys_llistxattr,
+		.sandbox = SYD_SANDBOX_READ,
 	},
 	{
 		.name = "setxattr",
 		.enter = sys_setxattr,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "lsetxattr",
 		.enter = sys_lsetxattr,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "removexattr",
 		.enter = sys_removexattr,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "lremovexattr",
 		.enter = sys_lremovexattr,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 
 	{
 		.name = "mount",
 		.enter = sys_mount,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "umount",
 		.enter = sys_umount,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 	{
 		.name = "umount2",
 		.enter = sys_umount2,
+		.sandbox = SYD_SANDBOX_WRITE,
 	},
 };
 
@@ -323,116 +418,227 @@ size_t syscall_entries_max(void)
 	return ELEMENTSOF(syscall_entries);
 }
 
+/*
+ * Sandboxing categories which are off at startup are locked off if magic
+ * commands are locked or if core/trace/sandbox_lock is set, so the system
+ * calls which are only checked for them need not be trapped.
+ */
+static unsigned sandbox_locked(void)
+{
+	unsigned mask = 0;
+	const sandbox_t *box = &sydbox->config.box_static;
+
+	if (!sydbox->config.sandbox_lock && box->magic_lock == LOCK_UNSET)
+		return 0;
+
+	if (box->sandbox_exec == SANDBOX_OFF)
+		mask |= SYD_SANDBOX_EXEC;
+	if (box->sandbox_read == SANDBOX_OFF)
+		mask |= SYD_SANDBOX_READ;
+	if (box->sandbox_write == SANDBOX_OFF)
+		mask |= SYD_SANDBOX_WRITE;
+	if (box->sandbox_network == SANDBOX_OFF)
+		mask |= SYD_SANDBOX_NETWORK;
+	return mask;
+}
+
+static bool sysentry_off(const sysentry_t *entry)
+{
+	/* Magic commands are locked for good after the initial exec. */
+	if (entry->enter == sys_stat || entry->enter == sys_magic) {
+		if (sydbox->config.box_static.magic_lock != LOCK_UNSET)
+			return true;
+		if (entry->enter == sys_stat && !sydbox->config.magic_stat)
+			return true;
+		return false;
+	}
+
+	if (entry->fd_table && sydbox->config.use_fd_cache)
+		return false;
+	if (!entry->sandbox)
+		return entry->fd_table;
+	if (entry->successful_bind && !sydbox->config.whitelist_successful_bind)
+		return true;
+	if ((entry->sandbox & sydbox->sandbox_locked) != entry->sandbox)
+		return false;
+	/* The handlers implement the simple filters without seccomp. */
+	if (entry->filter && !sydbox->config.use_seccomp)
+		return false;
+	return true;
+}
+
+static unsigned sysentry_flags(const sysentry_t *entry)
+{
+	if (entry->enter == sys_clone ||
+	    entry->enter == sys_fork ||
+	    entry->enter == sys_vfork)
+		return SYSDISPATCH_CLONE;
+	else if (entry->enter == sys_execve)
+		return SYSDISPATCH_EXECVE;
+	return 0;
+}
+
 void sysinit(void)
 {
+	sydbox->sandbox_locked = sandbox_locked();
+
+	/*
+	 * The file descriptor path cache is only correct if all system calls
+	 * replacing file descriptors are trapped.
+	 */
+	for (unsigned i = 0; i < ELEMENTSOF(syscall_entries); i++) {
+		if (sydbox->config.use_fd_cache &&
+		    syscall_entries[i].fd_table &&
+		    pink_lookup_syscall(syscall_entries[i].name,
+					PINK_ABI_DEFAULT) == -1) {
+			say("system call %s() is unknown, disabling fd path cache",
+			    syscall_entries[i].name);
+			sydbox->config.use_fd_cache = false;
+		}
+	}
+
 	for (unsigned i = 0; i < ELEMENTSOF(syscall_entries); i++) {
 		if (sydbox->config.use_seccomp &&
 		    syscall_entries[i].filter &&
 		    syscall_entries[i].ptrace_fallback)
 			continue;
+		if (sysentry_off(&syscall_entries[i]))
+			continue;
 
 		if (syscall_entries[i].name) {
 			systable_add(syscall_entries[i].name,
 				     syscall_entries[i].enter,
-				     syscall_entries[i].exit);
+				     syscall_entries[i].exit,
+				     sysentry_flags(&syscall_entries[i]));
 		} else {
 			for (int abi = 0; abi < PINK_ABIS_SUPPORTED; abi++)
 				systable_add_full(syscall_entries[i].no,
 						  abi, NULL,
 						  syscall_entries[i].enter,
-						  syscall_entries[i].exit);
+						  syscall_entries[i].exit,
+						  sysentry_flags(&syscall_entries[i]));
 		}
 	}
 }
 
 #if SYDBOX_HAVE_SECCOMP
-static int apply_simple_filter(const sysentry_t *entry, int arch, int abi)
+# if SYDBOX_HAVE_SECCOMP_NOTIFY
+/*
+ * Can this system call be served from a seccomp user notification?
+ * The tracee is not stopped at system call exit with notifications, so
+ * entries with an exit handler must use ptrace. So do clone() and execve()
+ * whose enter handlers are paired with the respective ptrace events.
+ */
+static bool sysentry_notify(const sysentry_t *entry)
 {
-	int r = 0;
-	long sysnum;
-
-	assert(entry->filter);
-
-	if (entry->name)
-		sysnum = pink_lookup_syscall(entry->name, abi);
-	else
-		sysnum = entry->no;
-
-	if (sysnum == -1)
-		return 0;
+	if (!sydbox->config.use_notify)
+		return false;
+	if (!entry->enter || entry->exit)
+		return false;
+	if (entry->filter && entry->ptrace_fallback)
+		return false;
+	if (entry->enter == sys_clone ||
+	    entry->enter == sys_fork ||
+	    entry->enter == sys_vfork ||
+	    entry->enter == sys_execve)
+		return false;
+	return true;
+}
+# endif
 
-	if ((r = entry->filter(arch, sysnum)) < 0)
-		return r;
-	return 0;
+static uint32_t sysentry_action(const sysentry_t *entry, long sysnum)
+{
+	if (entry->filter && entry->ptrace_fallback)
+		return SECCOMP_RET_ALLOW;
+	if (sysentry_off(entry))
+		return SECCOMP_RET_ALLOW;
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+	if (sysentry_notify(entry))
+		return SECCOMP_RET_USER_NOTIF;
+#endif
+	return SECCOMP_RET_TRACE|(sysnum & SECCOMP_RET_DATA);
 }
 
-static size_t make_seccomp_filter(int abi, uint32_t **syscalls)
+static size_t make_seccomp_filter(int abi, struct seccomp_rule **rules)
 {
-	size_t i, j;
+	size_t i, j, k;
 	long sysnum;
-	uint32_t *list;
+	struct seccomp_rule *list, *rule;
 
-	list = xmalloc(sizeof(uint32_t) * ELEMENTSOF(syscall_entries));
+	list = xmalloc(sizeof(struct seccomp_rule) * ELEMENTSOF(syscall_entries));
 	for (i = 0, j = 0; i < ELEMENTSOF(syscall_entries); i++) {
 		if (syscall_entries[i].name)
 			sysnum = pink_lookup_syscall(syscall_entries[i].name,
 						    abi);
 		else
 			sysnum = syscall_entries[i].no;
-		if (sysnum != -1)
-			list[j++] = (uint32_t)sysnum;
+		if (sysnum == -1)
+			continue;
+		/* The first entry for a system call number wins. */
+		for (k = 0; k < j; k++) {
+			if (list[k].sysnum == (uint32_t)sysnum)
+				break;
+		}
+		if (k < j)
+			continue;
+
+		rule = &list[j];
+		memset(rule, 0, sizeof(struct seccomp_rule));
+		rule->sysnum = (uint32_t)sysnum;
+		rule->action = sysentry_action(&syscall_entries[i], sysnum);
+		if (syscall_entries[i].filter)
+			rule->filter_len = syscall_entries[i].filter(&rule->filter);
+		if (rule->action == SECCOMP_RET_ALLOW) {
+			/* simple filter only, nothing to trap */
+			if (!rule->filter_len)
+				continue;
+		} else if (syscall_entries[i].prefilter) {
+			rule->prefilter_len = syscall_entries[i].prefilter(&rule->prefilter);
+		}
+		j++;
 	}
 
-	*syscalls = list;
+	*rules = list;
 	return j;
 }
 
+/*
+ * Install a single seccomp filter program with the simple filters and the
+ * trap rules for all supported architectures.
+ * Returns the listener file descriptor if core/trace/use_notify is set.
+ */
 int sysinit_seccomp(void)
 {
-	int r, count;
-	size_t i;
-	uint32_t *syscalls;
+	int r;
+	unsigned i, n, flags;
+	int arch[2], count[2];
+	struct seccomp_rule *rules[2];
 
+	n = 0;
 #if defined(__i386__)
-	for (i = 0; i < ELEMENTSOF(syscall_entries); i++) {
-		if (!syscall_entries[i].filter)
-			continue;
-		if ((r = apply_simple_filter(&syscall_entries[i],
-					     AUDIT_ARCH_I386,
-					     PINK_ABI_DEFAULT)) < 0)
-			return r;
-	}
-	count = make_seccomp_filter(PINK_ABI_DEFAULT, &syscalls);
-	r = seccomp_apply(AUDIT_ARCH_I386, syscalls, count);
-
-	free(syscalls);
+	arch[n] = AUDIT_ARCH_I386;
+	count[n] = make_seccomp_filter(PINK_ABI_DEFAULT, &rules[n]);
+	n++;
 #elif defined(__x86_64__)
-	for (i = 0; i < ELEMENTSOF(syscall_entries); i++) {
-		if (!syscall_entries[i].filter)
-			continue;
-		if ((r = apply_simple_filter(&syscall_entries[i],
-					     AUDIT_ARCH_X86_64,
-					     PINK_ABI_X86_64)) < 0)
-			return r;
-		if ((r = apply_simple_filter(&syscall_entries[i],
-					     AUDIT_ARCH_I386,
-					     PINK_ABI_I386)) < 0)
-			return r;
-	}
-
-	count = make_seccomp_filter(PINK_ABI_X86_64, &syscalls);
-	r = seccomp_apply(AUDIT_ARCH_X86_64, syscalls, count);
-	free(syscalls);
-	if (r < 0)
-		return r;
-
-	count = make_seccomp_filter(PINK_ABI_I386, &syscalls);
-	r = seccomp_apply(AUDIT_ARCH_I386, syscalls, count);
-	free(syscalls);
+	arch[n] = AUDIT_ARCH_X86_64;
+	count[n] = make_seccomp_filter(PINK_ABI_X86_64, &rules[n]);
+	n++;
+	arch[n] = AUDIT_ARCH_I386;
+	count[n] = make_seccomp_filter(PINK_ABI_I386, &rules[n]);
+	n++;
 #else
 #error "Platform does not support seccomp filter yet"
 #endif
 
+	flags = 0;
+#if SYDBOX_HAVE_SECCOMP_NOTIFY
+	if (sydbox->config.use_notify)
+		flags |= SECCOMP_FILTER_FLAG_NEW_LISTENER;
+#endif
+
+	r = seccomp_apply(arch, rules, count, n, flags);
+	for (i = 0; i < n; i++)
+		free(rules[i]);
 	return r;
 }
 #else
@@ -442,16 +648,29 @@ int sysinit_seccomp(void)
 }
 #endif
 
+/*
+ * The clone or exec event comes before the system call returns, if it is
+ * still pending now the system call failed and no children are to come.
+ */
+static void forking_done(syd_process_t *current)
+{
+	if (current->flags & SYD_FORKING) {
+		current->flags &= ~SYD_FORKING;
+		process_update_forking(current);
+	}
+}
+
 int sysenter(syd_process_t *current)
 {
 	int r;
 	long sysnum;
-	const sysentry_t *entry;
+	const sysdispatch_t *entry;
 
 	assert(current);
 
 	if ((r = syd_read_syscall(current, &sysnum)) < 0)
 		return r;
+	forking_done(current);
 
 	r = 0;
 	entry = systable_lookup(sysnum, current->abi);
@@ -461,12 +680,11 @@ int sysenter(syd_process_t *current)
 		current->sysname = entry->name;
 		if (entry->enter) {
 			r = entry->enter(current);
-			if (entry->enter == sys_clone ||
-			    entry->enter == sys_fork ||
-			    entry->enter == sys_vfork)
+			if (entry->flags & SYSDISPATCH_CLONE)
 				current->flags |= SYD_IN_CLONE;
-			else if (entry->enter == sys_execve)
+			else if (entry->flags & SYSDISPATCH_EXECVE)
 				current->flags |= SYD_IN_EXECVE;
+			process_update_forking(current);
 		}
 		if (entry->exit)
 			current->flags |= SYD_STOP_AT_SYSEXIT;
@@ -478,10 +696,11 @@ int sysenter(syd_process_t *current)
 int sysexit(syd_process_t *current)
 {
 	int r;
-	const sysentry_t *entry;
+	const sysdispatch_t *entry;
 
 	assert(current);
 
+	forking_done(current);
 	entry = systable_lookup(current->sysnum, current->abi);
 	r = (entry && entry->exit) ? entry->exit(current) : 0;
 
@@ -8,29 +8,91 @@
 #include "sydbox.h"
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include "pink.h"
-#include "sydhash.h"
 
-struct systable {
+/*
+ * System call dispatch table:
+ * A dense array per ABI indexed by the system call number, so dispatch is a
+ * single indexed load. System call numbers beyond SYSTABLE_DENSE_MAX, such
+ * as virtual system calls, are kept in a small array sorted by number.
+ */
+#define SYSTABLE_DENSE_MAX 1024
+
+struct systable_sparse {
 	long no;
-	sysentry_t entry;
-	UT_hash_handle hh;
+	sysdispatch_t entry;
 };
 
-static struct systable *systable[PINK_ABIS_SUPPORTED];
+static struct systable {
+	sysdispatch_t *dense;
+	size_t dense_size;
+	struct systable_sparse *sparse;
+	size_t sparse_size;
+} systable[PINK_ABIS_SUPPORTED];
+
+static int systable_sparse_cmp(const void *key, const void *elem)
+{
+	long no = *(const long *)key;
+	const struct systable_sparse *s = elem;
+
+	return (no > s->no) - (no < s->no);
+}
+
+static sysdispatch_t *systable_sparse_add(struct systable *t, long no)
+{
+	size_t i;
+
+	for (i = 0; i < t->sparse_size && t->sparse[i].no < no; i++)
+		; /* find the insertion point */
+	if (i < t->sparse_size && t->sparse[i].no == no)
+		return NULL;
+
+	t->sparse = xrealloc(t->sparse, (t->sparse_size + 1) * sizeof(struct systable_sparse));
+	memmove(t->sparse + i + 1, t->sparse + i,
+		(t->sparse_size - i) * sizeof(struct systable_sparse));
+	t->sparse_size++;
 
+	t->sparse[i].no = no;
+	return &t->sparse[i].entry;
+}
+
+static sysdispatch_t *systable_dense_add(struct systable *t, long no)
+{
+	size_t size;
+
+	if ((size_t)no >= t->dense_size) {
+		size = no + 1;
+		t->dense = xrealloc(t->dense, size * sizeof(sysdispatch_t));
+		memset(t->dense + t->dense_size, 0,
+		       (size - t->dense_size) * sizeof(sysdispatch_t));
+		t->dense_size = size;
+	} else if (t->dense[no].enter || t->dense[no].exit) {
+		return NULL;
+	}
+	return &t->dense[no];
+}
+
+/* The first entry added for a system call number wins. */
 void systable_add_full(long no, short abi, const char *name,
-		       sysfunc_t fenter, sysfunc_t fexit)
+		       sysfunc_t fenter, sysfunc_t fexit, unsigned flags)
 {
-	struct systable *s;
+	sysdispatch_t *d;
+	struct systable *t = &systable[abi];
+
+	BUG_ON(no >= 0);
 
-	s = xmalloc(sizeof(struct systable));
-	s->no = no;
-	s->entry.name = name;
-	s->entry.enter = fenter;
-	s->entry.exit = fexit;
+	if (no < SYSTABLE_DENSE_MAX)
+		d = systable_dense_add(t, no);
+	else
+		d = systable_sparse_add(t, no);
+	if (!d)
+		return;
 
-	HASH_ADD_INT(systable[abi], no, s);
+	d->enter = fenter;
+	d->exit = fexit;
+	d->name = name;
+	d->flags = flags;
 }
 
 void systable_init(void)
@@ -41,30 +103,38 @@ void systable_init(void)
 void systable_free(void)
 {
 	for (short abi = 0; abi < PINK_ABIS_SUPPORTED; abi++) {
-		struct systable *s, *tmp;
-		HASH_ITER(hh, systable[abi], s, tmp) {
-			HASH_DEL(systable[abi], s);
-			free(s);
-		}
-		HASH_CLEAR(hh, systable[abi]);
+		free(systable[abi].dense);
+		free(systable[abi].sparse);
+		memset(&systable[abi], 0, sizeof(struct systable));
 	}
 }
 
-void systable_add(const char *name, sysfunc_t fenter, sysfunc_t fexit)
+void systable_add(const char *name, sysfunc_t fenter, sysfunc_t fexit,
+		  unsigned flags)
 {
 	long no;
 
 	for (short abi = 0; abi < PINK_ABIS_SUPPORTED; abi++) {
 		no = pink_lookup_syscall(name, abi);
 		if (no != -1)
-			systable_add_full(no, abi, name, fenter, fexit);
+			systable_add_full(no, abi, name, fenter, fexit, flags);
 	}
 }
 
-const sysentry_t *systable_lookup(long no, short abi)
+const sysdispatch_t *systable_lookup(long no, short abi)
 {
-	struct systable *s;
+	const sysdispatch_t *d;
+	const struct systable_sparse *s;
+	const struct systable *t = &systable[abi];
+
+	if ((unsigned long)no < t->dense_size) {
+		d = &t->dense[no];
+		return (d->enter || d->exit) ? d : NULL;
+	}
+	if (no < SYSTABLE_DENSE_MAX || !t->sparse_size)
+		return NULL;
 
-	HASH_FIND_INT(systable[abi], &no, s);
-	return s ? &(s->entry) : NULL;
+	s = bsearch(&no, t->sparse, t->sparse_size,
+		    sizeof(struct systable_sparse), systable_sparse_cmp);
+	return s ? &s->entry : NULL;
 }
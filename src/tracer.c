@@ -0,0 +1,349 @@
+/*
+ * sydbox/tracer.c
+ *
+ * Sharding the traced processes between tracer threads
+ *
+ * Copyright (c) 2015 Ali Polatel <alip@exherbo.org>
+ * Released under the terms of the 3-clause BSD license
+ */
+
+#include "sydbox.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "xfunc.h"
+
+/*
+ * Every tracer thread waits for its own tracees only, see __WNOTHREAD. A new
+ * process is handed over to an idle thread: the old tracer stops the process
+ * and detaches it leaving it in group-stop, the new tracer seizes it from
+ * there. Processes are only ever handed over to idle threads, which wait on
+ * their doorbell rather than in waitpid(), so there's no thread to wake up
+ * from waitpid(). Tracing is done when all threads are idle.
+ */
+__thread syd_tracer_t *tracer;
+
+static void tracer_ring(syd_tracer_t *t)
+{
+	uint64_t one = 1;
+
+	while (write(t->doorbell, &one, sizeof(one)) < 0 && errno == EINTR)
+		;
+}
+
+static void tracer_free_process(void *ptr)
+{
+	syd_process_t *p = ptr;
+
+	pink_regset_free(p->regset);
+	free(p);
+}
+
+int tracer_init(unsigned count)
+{
+	unsigned i;
+	syd_tracer_t *t;
+
+	if (!count)
+		count = 1;
+
+	sydbox->tracers = xcalloc(count, sizeof(syd_tracer_t));
+	sydbox->tracer_count = count;
+	sydbox->tracer_busy = 1; /* the main thread */
+	sydbox->tracer_done = false;
+	pthread_mutex_init(&sydbox->tracer_lock, NULL);
+	pthread_mutex_init(&sydbox->auto_lock, NULL);
+
+	for (i = 0; i < count; i++) {
+		t = &sydbox->tracers[i];
+		t->id = i;
+		t->idle = (i != 0);
+		t->handoff = NULL;
+		t->doorbell = -1;
+		pthread_mutex_init(&t->lock, NULL);
+		if (count > 1) {
+			t->doorbell = eventfd(0, EFD_CLOEXEC);
+			if (t->doorbell < 0)
+				return -errno;
+		}
+	}
+
+	tracer = &sydbox->tracers[0];
+	scratch_attach(&tracer->scratch);
+	return 0;
+}
+
+/* Starts the tracer threads but the first one, which is the main thread. */
+int tracer_start(void *(*func)(void *))
+{
+	int r = 0;
+	unsigned i;
+	sigset_t all, old;
+
+	/* Signals are for the main thread. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (i = 1; i < sydbox->tracer_count; i++) {
+		syd_tracer_t *t = &sydbox->tracers[i];
+
+		r = pthread_create(&t->thread, NULL, func, t);
+		if (r != 0)
+			break;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (r != 0) {
+		/* Too late to go back, the handed over processes need them. */
+		return -r;
+	}
+	return 0;
+}
+
+void tracer_free(void)
+{
+	unsigned i;
+	syd_tracer_t *t;
+
+	if (!sydbox->tracers)
+		return;
+
+	if (multi_tracer()) {
+		pthread_mutex_lock(&sydbox->tracer_lock);
+		sydbox->tracer_done = true;
+		for (i = 1; i < sydbox->tracer_count; i++)
+			tracer_ring(&sydbox->tracers[i]);
+		pthread_mutex_unlock(&sydbox->tracer_lock);
+	}
+
+	for (i = 0; i < sydbox->tracer_count; i++) {
+		t = &sydbox->tracers[i];
+		if (i > 0)
+			pthread_join(t->thread, NULL);
+		if (t->doorbell >= 0)
+			close(t->doorbell);
+		pthread_mutex_destroy(&t->lock);
+		pidmap_free(&t->proctab);
+		pidmap_free(&t->thread_groups);
+		pidmap_free(&t->early_children);
+		pool_drain(&t->proc_pool, tracer_free_process);
+		pool_drain(&t->clone_thread_pool, free);
+		pool_drain(&t->clone_fs_pool, free);
+		pool_drain(&t->clone_files_pool, free);
+	}
+	pthread_mutex_destroy(&sydbox->tracer_lock);
+	pthread_mutex_destroy(&sydbox->auto_lock);
+
+	scratch_attach(NULL);
+	free(sydbox->tracers);
+	sydbox->tracers = NULL;
+	sydbox->tracer_count = 0;
+	tracer = NULL;
+}
+
+/* Reserves an idle tracer thread for a new process, NULL if none is idle */
+syd_tracer_t *tracer_claim(void)
+{
+	unsigned i;
+	syd_tracer_t *t = NULL;
+
+	pthread_mutex_lock(&sydbox->tracer_lock);
+	for (i = 0; i < sydbox->tracer_count; i++) {
+		if (sydbox->tracers[i].idle) {
+			t = &sydbox->tracers[i];
+			t->idle = false;
+			sydbox->tracer_busy++;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&sydbox->tracer_lock);
+
+	return t;
+}
+
+/* Gives back a claimed tracer thread, the process died before the hand-over */
+void tracer_unclaim(syd_tracer_t *t)
+{
+	pthread_mutex_lock(&sydbox->tracer_lock);
+	tracer_ring(t);
+	pthread_mutex_unlock(&sydbox->tracer_lock);
+}
+
+/* Hands over a detached process to the tracer thread which was claimed. */
+void tracer_push(syd_tracer_t *t, syd_process_t *p)
+{
+	pthread_mutex_lock(&sydbox->tracer_lock);
+	p->handoff_next = t->handoff;
+	t->handoff = p;
+	tracer_ring(t);
+	pthread_mutex_unlock(&sydbox->tracer_lock);
+	tracer->handoff_out++;
+}
+
+/*
+ * Called when the calling thread has no tracees left.
+ * Returns 1 and the list of processes to seize, linked via handoff_next,
+ * 0 if tracing is done and -EINTR if the main thread got a signal.
+ */
+int tracer_idle(syd_process_t **list)
+{
+	int r;
+	uint64_t count;
+	struct pollfd pfd;
+	sigset_t empty;
+
+	*list = NULL;
+	for (;;) {
+		pthread_mutex_lock(&sydbox->tracer_lock);
+		if (sydbox->tracer_done) {
+			pthread_mutex_unlock(&sydbox->tracer_lock);
+			return 0;
+		}
+		if (tracer->handoff) {
+			*list = tracer->handoff;
+			tracer->handoff = NULL;
+			pthread_mutex_unlock(&sydbox->tracer_lock);
+			return 1;
+		}
+		if (!tracer->idle) {
+			tracer->idle = true;
+			if (--sydbox->tracer_busy == 0) {
+				unsigned i;
+
+				sydbox->tracer_done = true;
+				for (i = 0; i < sydbox->tracer_count; i++)
+					tracer_ring(&sydbox->tracers[i]);
+				pthread_mutex_unlock(&sydbox->tracer_lock);
+				return 0;
+			}
+		}
+		pthread_mutex_unlock(&sydbox->tracer_lock);
+
+		pfd.fd = tracer->doorbell;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (tracer->id == 0) {
+			/* the main thread handles the signals */
+			sigemptyset(&empty);
+			r = ppoll(&pfd, 1, NULL, &empty);
+		} else {
+			r = poll(&pfd, 1, -1);
+		}
+		if (r < 0) {
+			if (errno == EINTR && tracer->id == 0)
+				return -EINTR;
+			continue;
+		}
+		while (read(tracer->doorbell, &count, sizeof(count)) < 0 &&
+		       errno == EINTR)
+			;
+	}
+}
+
+static void fork_list_link(syd_tracer_t *t, syd_process_t *p)
+{
+	p->fork_prev = NULL;
+	p->fork_next = t->forking;
+	if (t->forking)
+		t->forking->fork_prev = p;
+	t->forking = p;
+}
+
+static void fork_list_unlink(syd_tracer_t *t, syd_process_t *p)
+{
+	if (p->fork_next)
+		p->fork_next->fork_prev = p->fork_prev;
+	if (p->fork_prev)
+		p->fork_prev->fork_next = p->fork_next;
+	else
+		t->forking = p->fork_next;
+	p->fork_next = p->fork_prev = NULL;
+}
+
+static void thread_group_link(syd_tracer_t *t, syd_process_t *p)
+{
+	syd_process_t *head;
+
+	if (p->tgid == SYD_TGID_NONE)
+		return;
+
+	head = pidmap_find(&t->thread_groups, p->tgid);
+	p->thread_prev = NULL;
+	p->thread_next = head;
+	if (head)
+		head->thread_prev = p;
+	pidmap_set(&t->thread_groups, p->tgid, p);
+}
+
+static void thread_group_unlink(syd_tracer_t *t, syd_process_t *p)
+{
+	if (p->tgid == SYD_TGID_NONE)
+		return;
+
+	if (p->thread_next)
+		p->thread_next->thread_prev = p->thread_prev;
+	if (p->thread_prev)
+		p->thread_prev->thread_next = p->thread_next;
+	else if (p->thread_next)
+		pidmap_set(&t->thread_groups, p->tgid, p->thread_next);
+	else
+		pidmap_del(&t->thread_groups, p->tgid);
+	p->thread_next = p->thread_prev = NULL;
+}
+
+/*
+ * The process table of a tracer is only changed by its own thread, the lock
+ * is for the other threads reading it, see kill_all_tracers().
+ */
+void process_add(syd_process_t *p)
+{
+	tracer_lock(tracer);
+	pidmap_set(&tracer->proctab, p->pid, p);
+	thread_group_link(tracer, p);
+	tracer_unlock(tracer);
+	process_update_forking(p);
+}
+
+void process_remove(syd_process_t *p)
+{
+	tracer_lock(tracer);
+	pidmap_del(&tracer->proctab, p->pid);
+	thread_group_unlink(tracer, p);
+	tracer_unlock(tracer);
+	if (p->fork_prev || tracer->forking == p)
+		fork_list_unlink(tracer, p);
+}
+
+void process_set_tgid(syd_process_t *p, pid_t tgid)
+{
+	if (p->tgid == tgid)
+		return;
+
+	tracer_lock(tracer);
+	thread_group_unlink(tracer, p);
+	p->tgid = tgid;
+	thread_group_link(tracer, p);
+	tracer_unlock(tracer);
+}
+
+/*
+ * To be called after SYD_IN_CLONE or SYD_IN_EXECVE of a traced process has
+ * changed. The list is only used by the tracer thread of the process.
+ */
+void process_update_forking(syd_process_t *p)
+{
+	bool linked = p->fork_prev || tracer->forking == p;
+
+	if (p->flags & SYD_FORKING) {
+		if (!linked)
+			fork_list_link(tracer, p);
+	} else if (linked) {
+		fork_list_unlink(tracer, p);
+	}
+}
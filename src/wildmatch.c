@@ -66,7 +66,7 @@
 int wildmatch_iteration_count;
 #endif
 
-static int force_lower_case = 0;
+static __thread int force_lower_case = 0;
 
 /* Match pattern "p" against the a virtually-joined string consisting
  * of "text" and any strings in array "a". */
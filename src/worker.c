@@ -0,0 +1,214 @@
+/*
+ * sydbox/worker.c
+ *
+ * Thread pool for the blocking parts of system call checks
+ *
+ * Copyright (c) 2015 Ali Polatel <alip@exherbo.org>
+ * Released under the terms of the 3-clause BSD license
+ */
+
+#include "sydconf.h"
+#include "worker.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "xfunc.h"
+
+/*
+ * Jobs are queued by the tracer thread and picked up by the first idle
+ * worker. Finished jobs are put on the done list and the tracer is woken up
+ * through an eventfd which it polls together with waitpid(). The tracer
+ * stays the only thread which calls ptrace(), the tracees whose checks are
+ * running are left in their ptrace-stop until the tracer collects the job.
+ */
+static struct {
+	unsigned count;
+	pthread_t *threads;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool stop;
+
+	struct worker_job *queue;
+	struct worker_job **queue_tail;
+	struct worker_job *done;
+	int fd;
+
+	struct worker_stats stats;
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.fd = -1,
+};
+
+static void worker_wakeup(void)
+{
+	uint64_t one = 1;
+
+	while (write(pool.fd, &one, sizeof(one)) < 0 && errno == EINTR)
+		;
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker_job *job;
+
+	pthread_mutex_lock(&pool.lock);
+	for (;;) {
+		while (!pool.queue && !pool.stop)
+			pthread_cond_wait(&pool.cond, &pool.lock);
+		if (pool.stop)
+			break;
+
+		job = pool.queue;
+		pool.queue = job->next;
+		if (!pool.queue)
+			pool.queue_tail = &pool.queue;
+		pthread_mutex_unlock(&pool.lock);
+
+		job->func(job);
+
+		pthread_mutex_lock(&pool.lock);
+		job->next = pool.done;
+		pool.done = job;
+		pool.stats.finished++;
+		/* The tracer takes the whole list at once. */
+		if (!job->next)
+			worker_wakeup();
+	}
+	pthread_mutex_unlock(&pool.lock);
+
+	return NULL;
+}
+
+int worker_init(unsigned count)
+{
+	int r;
+	unsigned i;
+	sigset_t all, old;
+
+	if (!count)
+		return 0;
+
+	pool.fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+	if (pool.fd < 0)
+		return -errno;
+	pool.queue = NULL;
+	pool.queue_tail = &pool.queue;
+	pool.done = NULL;
+	pool.stop = false;
+	pool.threads = xmalloc(sizeof(pthread_t) * count);
+
+	/* Signals are for the tracer thread. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (i = 0; i < count; i++) {
+		r = pthread_create(&pool.threads[i], NULL, worker_main, NULL);
+		if (r != 0)
+			break;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	pool.count = i;
+	if (i == 0) {
+		free(pool.threads);
+		pool.threads = NULL;
+		close(pool.fd);
+		pool.fd = -1;
+		return -r;
+	}
+	return 0;
+}
+
+/* Stops the workers, returns the jobs which were not collected yet */
+struct worker_job *worker_free(void)
+{
+	unsigned i;
+	struct worker_job *list;
+
+	if (!pool.count)
+		return NULL;
+
+	pthread_mutex_lock(&pool.lock);
+	pool.stop = true;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.lock);
+
+	for (i = 0; i < pool.count; i++)
+		pthread_join(pool.threads[i], NULL);
+	free(pool.threads);
+	pool.threads = NULL;
+	pool.count = 0;
+	close(pool.fd);
+	pool.fd = -1;
+
+	list = pool.done;
+	if (pool.queue) {
+		*pool.queue_tail = list;
+		list = pool.queue;
+	}
+	pool.queue = pool.done = NULL;
+	pool.queue_tail = &pool.queue;
+	return list;
+}
+
+/* File descriptor which is readable when there are jobs to collect */
+int worker_fd(void)
+{
+	return pool.fd;
+}
+
+void worker_submit(struct worker_job *job)
+{
+	unsigned pending;
+
+	pthread_mutex_lock(&pool.lock);
+	job->next = NULL;
+	*pool.queue_tail = job;
+	pool.queue_tail = &job->next;
+	pool.stats.submitted++;
+	pending = pool.stats.submitted - pool.stats.finished;
+	if (pending > pool.stats.max_pending)
+		pool.stats.max_pending = pending;
+	pthread_cond_signal(&pool.cond);
+	pthread_mutex_unlock(&pool.lock);
+}
+
+/*
+ * Returns the list of finished jobs, linked via job->next.
+ * Cheap enough to be called on every event: no system call is made unless
+ * there are jobs to collect. The eventfd is written and reset with the lock
+ * held so it is readable if and only if the done list is not empty.
+ */
+struct worker_job *worker_collect(void)
+{
+	uint64_t count;
+	struct worker_job *list;
+
+	if (pool.fd < 0)
+		return NULL;
+
+	pthread_mutex_lock(&pool.lock);
+	list = pool.done;
+	if (list) {
+		pool.done = NULL;
+		while (read(pool.fd, &count, sizeof(count)) < 0 &&
+		       errno == EINTR)
+			;
+	}
+	pthread_mutex_unlock(&pool.lock);
+
+	return list;
+}
+
+void worker_get_stats(struct worker_stats *stats)
+{
+	pthread_mutex_lock(&pool.lock);
+	*stats = pool.stats;
+	pthread_mutex_unlock(&pool.lock);
+}
@@ -0,0 +1,32 @@
+/*
+ * sydbox/worker.h
+ *
+ * Thread pool for the blocking parts of system call checks
+ *
+ * Copyright (c) 2015 Ali Polatel <alip@exherbo.org>
+ * Released under the terms of the 3-clause BSD license
+ */
+
+#ifndef WORKER_H
+#define WORKER_H 1
+
+struct worker_job {
+	/* Run on a worker thread, must not call ptrace() nor touch tracer state */
+	void (*func)(struct worker_job *job);
+	struct worker_job *next;
+};
+
+struct worker_stats {
+	unsigned long submitted;
+	unsigned long finished;
+	unsigned max_pending;
+};
+
+int worker_init(unsigned count);
+struct worker_job *worker_free(void);
+int worker_fd(void);
+void worker_submit(struct worker_job *job);
+struct worker_job *worker_collect(void);
+void worker_get_stats(struct worker_stats *stats);
+
+#endif
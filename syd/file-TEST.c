@@ -200,7 +200,6 @@ static void test_syd_path_stat_01(void)
 	assert_true(sb.st_mode == 0);
 }
 
-#if 0
 static void test_syd_realpath_at_01(void)
 {
 	int r;
@@ -356,12 +355,67 @@ static void test_syd_realpath_at_03(void)
 	assert_true(r1 != NULL);
 	assert_int_equal(0, ne);
 	assert_string_equal(r1, r2);
-	assert_true(strstr(r1, "/"TMPDIR"/"TMP_FILE) ==
-		    r1 + strlen(r1) - strlen("/"TMPDIR"/"TMP_FILE));
+	assert_string_equal(tmp_file, r2);
 	free(r1);
 	free(r2);
 }
-#endif
+
+static void test_syd_realpath_at_04(void)
+{
+	char *buf;
+
+	assert_int_equal(0, syd_realpath_at(AT_FDCWD, tmp_link, &buf, SYD_REALPATH_EXIST));
+	assert_string_equal(tmp_file, buf);
+	free(buf);
+
+	assert_int_equal(0, syd_realpath_at(AT_FDCWD, tmp_link, &buf, SYD_REALPATH_EXIST|SYD_REALPATH_NOFOLLOW));
+	assert_string_equal(tmp_link, buf);
+	free(buf);
+
+	assert_int_equal(-ENOENT, syd_realpath_at(AT_FDCWD, tmp_void_file, &buf, SYD_REALPATH_EXIST));
+	assert_int_equal(0, syd_realpath_at(AT_FDCWD, tmp_void_file, &buf, SYD_REALPATH_NOLAST));
+	assert_string_equal(tmp_void_file, buf);
+	free(buf);
+
+	assert_int_equal(-ENOENT, syd_realpath_at(AT_FDCWD, tmp_dang_link, &buf, SYD_REALPATH_EXIST));
+	assert_int_equal(0, syd_realpath_at(AT_FDCWD, tmp_dang_link, &buf, SYD_REALPATH_NOLAST));
+	assert_string_equal(tmp_void_file, buf);
+	free(buf);
+
+	assert_int_equal(-ELOOP, syd_realpath_at(AT_FDCWD, tmp_loop_link, &buf, SYD_REALPATH_EXIST));
+	assert_int_equal(-ELOOP, syd_realpath_at(AT_FDCWD, tmp_loop_link, &buf, SYD_REALPATH_NOLAST));
+
+	assert_int_equal(-ENOTDIR, syd_realpath_at(AT_FDCWD, TMPDIR"/"TMP_FILE"/"TMP_FILE, &buf, SYD_REALPATH_NOLAST));
+}
+
+static void test_syd_realpath_at_05(void)
+{
+	int fd;
+	char *buf;
+
+	fd = open(TMPDIR, O_PATH|O_CLOEXEC|O_DIRECTORY);
+	assert_true(fd >= 0);
+
+	assert_int_equal(0, syd_realpath_at(fd, TMP_LINK, &buf, SYD_REALPATH_EXIST));
+	assert_string_equal(tmp_file, buf);
+	free(buf);
+
+	assert_int_equal(0, syd_realpath_at(fd, "./"TMP_LONG"/../"TMP_DANG_LINK, &buf, SYD_REALPATH_NOLAST));
+	assert_string_equal(tmp_void_file, buf);
+	free(buf);
+
+	assert_int_equal(0, syd_realpath_at(fd, TMP_LONG"//", &buf, SYD_REALPATH_EXIST));
+	assert_true(strstr(buf, "/"TMP_LONG) == buf + strlen(buf) - strlen("/"TMP_LONG));
+	free(buf);
+	close(fd);
+
+	/* The kernel does not report paths longer than a page. */
+	assert_int_equal(0, chdir(TMPDIR"/"TMP_LONG));
+	for (unsigned int i = 0; i < TMP_LONG_MAGIC; i++)
+		assert_int_equal(0, chdir("./"TMP_LONG_NAME));
+	assert_int_equal(-ENAMETOOLONG, syd_realpath_at(AT_FDCWD, TMP_VOID_FILE, &buf, SYD_REALPATH_NOLAST));
+	assert_int_equal(0, fchdir(test_cwd_fd));
+}
 
 static void test_fixture_file(void)
 {
@@ -379,11 +433,11 @@ static void test_fixture_file(void)
 	run_test(test_syd_readlink_alloc_02);
 	run_test(test_syd_path_root_check_01);
 	run_test(test_syd_path_stat_01);
-#if 0
 	run_test(test_syd_realpath_at_01);
 	run_test(test_syd_realpath_at_02);
-	//run_test(test_syd_realpath_at_03);
-#endif
+	run_test(test_syd_realpath_at_03);
+	run_test(test_syd_realpath_at_04);
+	run_test(test_syd_realpath_at_05);
 
 	test_fixture_end();
 	close(test_cwd_fd);
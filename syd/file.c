@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/syscall.h>
 
 #ifndef LIBSYD_MAXSYMLINKS
 # if defined(SYMLOOP_MAX)
@@ -35,6 +36,27 @@
 # endif
 #endif
 
+#ifndef O_PATH /* hello glibc, I hate you. */
+#define O_PATH 010000000
+#endif
+
+#if defined(__NR_openat2) || defined(__x86_64__) || defined(__i386__)
+# ifndef __NR_openat2
+#  define __NR_openat2 437
+# endif
+# define SYD_HAVE_OPENAT2 1
+struct syd_open_how {
+	uint64_t flags;
+	uint64_t mode;
+	uint64_t resolve;
+};
+# ifndef RESOLVE_NO_MAGICLINKS
+#  define RESOLVE_NO_MAGICLINKS 0x02
+# endif
+#else
+# define SYD_HAVE_OPENAT2 0
+#endif
+
 static inline int syd_open_path(const char *pathname, int flags)
 {
 	int fd;
@@ -251,43 +273,93 @@ out:
 #undef ignore_last_node
 }
 
-int syd_prepath_at(int fd, const char *path, char **buf, int mode)
+static inline int syd_openat_path(int dirfd, const char *name, int flags)
 {
-	int r, save_fd = -ENOENT;
-	char *left = NULL, *rpath = NULL;
+	int fd;
 
-	/* Handle (very) quick cases */
-	if (path && path[0] == '\0')
-		return -ENOENT;
+	fd = openat(dirfd, name, flags|O_PATH|O_CLOEXEC);
+	return (fd >= 0) ? fd : -errno;
+}
 
-	/* Validate arguments */
-	if (buf == NULL)
-		return -EINVAL;
-	if (fd < 0 && fd != AT_FDCWD)
-		return -EINVAL;
+/*
+ * Return the path of the file the O_PATH file descriptor refers to.
+ */
+static int syd_fd_path(int fd, char **buf)
+{
+	int r;
+	size_t len;
+	char p[sizeof("/proc/self/fd/") + 16];
 
-	/* Handle quick cases */
-	r = syd_path_root_check(path);
-	switch (r) {
-	case -ENOENT:
+	r = snprintf(p, sizeof(p), "/proc/self/fd/%d", fd);
+	if (r < 0 || (size_t)r >= sizeof(p))
+		return -EINVAL;
+	r = syd_readlink_alloc(p, buf);
+	if (r < 0)
+		return r;
+	len = strlen(*buf);
+	if ((*buf)[0] != '/' || /* e.g. pipe:[42] */
+	    (len > sizeof(" (deleted)") - 1 &&
+	     !strcmp(*buf + len - (sizeof(" (deleted)") - 1), " (deleted)"))) {
+		free(*buf);
 		return -ENOENT;
-	case 0: /* This is == '/' */
-		return syd_path_root_alloc(buf);
-	case -EINVAL:
-		r = 0;
-		break;
-	default: /* >0 absolute path */
-		path += r;
-		r = 0;
-		break;
 	}
+	return 0;
 }
 
-#if 0
+#if SYD_HAVE_OPENAT2
+/*
+ * Let the kernel walk the whole path with one openat2() call.
+ * Magic links (e.g. /proc/$pid/fd/$n) are refused as their targets are not
+ * in the file system, the caller has to walk such paths component by
+ * component.
+ */
+static int syd_realpath_openat2(int dirfd, const char *path, char **buf,
+				bool nofollow)
+{
+	static bool unsupported;
+	int fd, r;
+	struct syd_open_how how;
+
+	if (unsupported)
+		return -ENOSYS;
+
+	memset(&how, 0, sizeof(how));
+	how.flags = O_PATH|O_CLOEXEC|(nofollow ? O_NOFOLLOW : 0);
+	how.resolve = RESOLVE_NO_MAGICLINKS;
+
+	fd = syscall(__NR_openat2, dirfd, path, &how, sizeof(how));
+	if (fd < 0) {
+		r = -errno;
+		if (r == -ENOSYS || r == -E2BIG)
+			unsupported = true;
+		return r;
+	}
+
+	r = syd_fd_path(fd, buf);
+	close(fd);
+	return r;
+}
+#endif
+
+/*
+ * Resolve path relative to the directory file descriptor fd (or the current
+ * working directory if fd is AT_FDCWD) like realpath(3) but honour the
+ * SYD_REALPATH_* flags in mode.
+ *
+ * The path is walked one component at a time with openat(O_PATH|O_NOFOLLOW)
+ * from file descriptors rather than from strings, so relative paths cost a
+ * single walk however deep the starting directory is. When openat2() is
+ * available simple paths are resolved by the kernel in one go.
+ */
 int syd_realpath_at(int fd, const char *path, char **buf, int mode)
 {
-	int r, save_fd = -ENOENT;
-	char *left = NULL, *rpath = NULL;
+	int r, dfd, nfd;
+	char *left, *rpath, *m;
+	size_t llen, rlen, rsiz;
+	unsigned nsymlinks;
+	mode_t dmode;
+	bool nofollow;
+	short flags;
 
 	/* Handle (very) quick cases */
 	if (path && path[0] == '\0')
@@ -298,223 +370,205 @@ int syd_realpath_at(int fd, const char *path, char **buf, int mode)
 		return -EINVAL;
 	if (fd < 0 && fd != AT_FDCWD)
 		return -EINVAL;
-
-	/* Handle quick cases */
-	r = syd_path_root_check(path);
-	switch (r) {
-	case -ENOENT:
-		return -ENOENT;
-	case 0: /* This is == '/' */
-		return syd_path_root_alloc(buf);
-	case -EINVAL:
-		r = 0;
-		break;
-	default: /* >0 absolute path */
-		path += r;
-		r = 0;
-		break;
-	}
-
-	bool nofollow;
-	short flags;
-	size_t llen, plen, rlen;
+	if (path == NULL)
+		return -EINVAL;
 
 	flags = mode & ~SYD_REALPATH_MASK;
 	nofollow = !!(flags & SYD_REALPATH_NOFOLLOW);
 	mode &= SYD_REALPATH_MASK;
-	plen = strlen(path);
+	llen = strlen(path);
+
+#if SYD_HAVE_OPENAT2
+	/* Trailing slashes and missing last components need the slow path. */
+	if (path[llen - 1] != '/' &&
+	    syd_realpath_openat2(fd, path, buf, nofollow) == 0)
+		return 0;
+#endif
 
-	left = malloc(sizeof(char) * plen);
+	left = malloc(sizeof(char) * (llen + 1));
 	if (left == NULL)
 		return -errno;
-	rpath = malloc(sizeof(char) * (plen + 1));
-	if (rpath == NULL) {
-		r = -errno;
-		goto out;
-	}
-
+	rpath = NULL;
 	if (path[0] == '/') {
-		rpath[0] = '/';
-		rpath[1] = '\0';
-		if (path[1] == '\0') {
-			r = 0;
-			goto out;
-		}
-		rlen = 1;
-		llen = syd_strlcpy(left, path + 1, plen);
+		llen--;
+		memcpy(left, path + 1, llen + 1);
+		dfd = syd_open_path("/", O_DIRECTORY);
+		r = (dfd < 0) ? dfd : syd_path_root_alloc(&rpath);
 	} else {
-		if (fd == AT_FDCWD) {
-			save_fd = syd_opendir(".");
-			if (r >= 0 || r == -ENOENT) {
-				save_fd = r;
-			} else {
-				r = save_fd; /* negated errno */
-				goto out;
-			}
-		} else if ((r = syd_fchdir(fd)) < 0) {
-			goto out;
-		}
+		memcpy(left, path, llen + 1);
+		dfd = syd_openat_path(fd, ".", O_DIRECTORY);
+		r = (dfd < 0) ? dfd : syd_fd_path(dfd, &rpath);
 	}
-
-	if (llen >= plen) {
-		r = -ENAMETOOLONG; /* Should not happen */
+	if (r < 0)
 		goto out;
-	}
+	rlen = strlen(rpath);
+	rsiz = rlen + 1;
 
 	/*
 	 * Iterate over path components in `left'.
+	 * `dfd' refers to `rpath' as long as it is a directory, `dmode' is
+	 * the file type of `rpath', zero if it does not exist.
 	 */
-	for (char *next_token = NULL; llen != 0;) {
+	nsymlinks = 0;
+	dmode = S_IFDIR;
+	while (llen != 0) {
+		char *p, *name;
+		size_t ntlen;
+		bool last_node;
+		struct stat sb;
+
 		/*
 		 * Extract the next path component and adjust `left'
 		 * and its length.
 		 */
-		char *m, *p, *q, *s;
-		size_t ntlen, nsymlinks = 0;
-		struct stat sb;
-
 		p = strchr(left, '/');
-		s = p ? p : left + llen;
-		if (next_token == NULL) {
-			ntlen = (s - left) + 1;
-			next_token = malloc(sizeof(char) * ntlen);
-			if (next_token == NULL) {
-				r = -errno;
-				free(next_token);
-				goto out;
-			}
-		}
-		memcpy(next_token, left, s - left);
-		next_token[s - left] = '\0';
-		llen -= s - left;
-		if (p != NULL)
-			memmove(left, s + 1, llen + 1);
-		if (rpath[rlen - 1] != '/') {
-			if (rlen >= plen) {
-				plen += (rlen - plen) > 128 ? (rlen - plen) : 128;
-				m = realloc(rpath, sizeof(char) * (plen + 1));
-				if (m == NULL) {
-					r = -errno;
-					free(next_token);
-					goto out;
-				}
-				rpath = m;
-			}
-			rpath[rlen++] = '/';
-			rpath[rlen] = '\0';
-		}
-		if (next_token[0] == '\0') {
+		ntlen = p ? (size_t)(p - left) : llen;
+		if (ntlen == 0) {
 			/*
 			 * Handle consequential slashes.  The path
 			 * before slash shall point to a directory.
-			 *
-			 * Only the trailing slashes are not covered
-			 * by other checks in the loop, but we verify
-			 * the prefix for any (rare) "//" or "/\0"
-			 * occurrence to not implement lookahead.
 			 */
-			if ((r = syd_path_stat(rpath, (mode|flags), true, &sb)) < 0) {
-				free(next_token);
-				goto out;
-			}
-			if (sb.st_mode == 0 && mode == SYD_REALPATH_NOLAST) {
-				r = 0;
+			memmove(left, left + 1, llen--);
+			if (dmode == 0 && mode == SYD_REALPATH_NOLAST)
 				break;
-			}
-			if (!S_ISDIR(sb.st_mode)) {
+			if (!S_ISDIR(dmode)) {
 				r = -ENOTDIR;
-				free(next_token);
 				goto out;
 			}
 			continue;
-		} else if (strcmp(next_token, ".") == 0) {
+		}
+		last_node = (p == NULL || p[strspn(p, "/")] == '\0');
+		name = strndup(left, ntlen);
+		if (name == NULL) {
+			r = -errno;
+			goto out;
+		}
+		llen -= p ? ntlen + 1 : ntlen;
+		memmove(left, left + (p ? ntlen + 1 : ntlen), llen + 1);
+
+		if (!strcmp(name, ".")) {
+			free(name);
 			continue;
-		} else if (strcmp(next_token, "..") == 0) {
+		} else if (!strcmp(name, "..")) {
+			free(name);
 			/*
 			 * Strip the last path component except when we have
 			 * single "/"
 			 */
 			if (rlen > 1) {
-				rpath[rlen - 1] = '\0';
-				q = strrchr(rpath, '/') + 1;
-				*q = '\0';
-				rlen = q - rpath;
+				nfd = syd_openat_path(dfd, "..", O_DIRECTORY);
+				if (nfd < 0) {
+					r = nfd;
+					goto out;
+				}
+				close(dfd);
+				dfd = nfd;
+				rlen = strrchr(rpath, '/') - rpath;
+				if (rlen == 0)
+					rlen = 1;
+				rpath[rlen] = '\0';
 			}
 			continue;
 		}
-		if (plen <= rlen + ntlen) {
-			plen += ntlen;
-			m = realloc(rpath, sizeof(char) * (plen + 1));
-			if (m == NULL) {
-				r = -errno;
-				free(next_token);
+
+		nfd = syd_openat_path(dfd, name, O_NOFOLLOW);
+		if (nfd < 0) {
+			if (nfd != -ENOENT || !last_node ||
+			    mode != SYD_REALPATH_NOLAST) {
+				r = nfd;
+				free(name);
 				goto out;
 			}
-			rpath = m;
-		}
-
-		if (p == NULL || left[strspn(left, "/")] == '\0')
-			r = syd_path_stat(rpath, (mode|flags), true, &sb);
-		else
-			r = syd_path_stat(rpath, (mode|flags), false, &sb);
-		if (r < 0) {
-			free(next_token);
+			sb.st_mode = 0;
+		} else if (fstatat(nfd, "", &sb,
+				   AT_EMPTY_PATH|AT_SYMLINK_NOFOLLOW) < 0) {
+			r = -errno;
+			close(nfd);
+			free(name);
 			goto out;
 		}
-		if (S_ISLNK(sb.st_mode)) {
+
+		if (S_ISLNK(sb.st_mode) && !(nofollow && last_node)) {
 			ssize_t slen;
-			char *symlink;
+			char symlink[PATH_MAX];
 
+			free(name);
 			/* FIXME: MAXSYMLINKS is stupid, handle this properly. */
 			if (++nsymlinks > LIBSYD_MAXSYMLINKS) {
+				close(nfd);
 				r = -ELOOP;
-				free(next_token);
 				goto out;
 			}
-			if (!nofollow) {
-				slen = syd_readlink_alloc(rpath, &symlink);
-				if (slen < 0) {
-					r = slen; /* negated errno */
-					free(next_token);
-					goto out;
-				}
-				if (symlink[0] == '/') {
-					rpath[1] = '\0';
-					rlen = 1;
-				} else if (rlen > 1) {
-					/* Strip the last path component. */
-					rpath[rlen - 1] = '\0';
-					q = strrchr(rpath, '/') + 1;
-					*q = '\0';
-					rlen = q - rpath;
-				}
+			slen = readlinkat(nfd, "", symlink, sizeof(symlink) - 1);
+			close(nfd);
+			if (slen < 0) {
+				r = -errno;
+				goto out;
 			}
+
 			/*
-			 * If there are any path components left, then
-			 * append them to symlink. The result is placed
-			 * in `left'.
+			 * Prepend the target to the components left.
 			 */
-			if (p != NULL) {
-				m = realloc(symlink, (slen + llen + 2) * sizeof(char));
-				if (m == NULL) {
-					r = -errno;
-					free(next_token);
-					free(symlink);
+			m = malloc(sizeof(char) * (slen + llen + 2));
+			if (m == NULL) {
+				r = -errno;
+				goto out;
+			}
+			memcpy(m, symlink, slen);
+			if (llen > 0)
+				m[slen++] = '/';
+			memcpy(m + slen, left, llen + 1);
+			llen += slen;
+			free(left);
+			left = m;
+
+			if (left[0] == '/') {
+				nfd = syd_open_path("/", O_DIRECTORY);
+				if (nfd < 0) {
+					r = nfd;
 					goto out;
 				}
-				symlink = m;
-
-				if (symlink[slen - 1] != '/') {
-					symlink[slen] = '/';
-					symlink[slen + 1] = 0;
-				}
+				close(dfd);
+				dfd = nfd;
+				rpath[1] = '\0';
+				rlen = 1;
+				memmove(left, left + 1, llen--);
 			}
-			llen = syd_strlcpy(left, symlink, sizeof(left));
-			if (nofollow && p == NULL) {
-				r = 0;
-				rlen = syd_strlcat(rpath, left, rlen);
-				break;
+			continue;
+		}
+
+		/*
+		 * Append the next path component.
+		 */
+		if (rlen + ntlen + 2 > rsiz) {
+			rsiz = rlen + ntlen + 128;
+			m = realloc(rpath, sizeof(char) * rsiz);
+			if (m == NULL) {
+				r = -errno;
+				if (nfd >= 0)
+					close(nfd);
+				free(name);
+				goto out;
 			}
+			rpath = m;
+		}
+		if (rpath[rlen - 1] != '/')
+			rpath[rlen++] = '/';
+		memcpy(rpath + rlen, name, ntlen + 1);
+		rlen += ntlen;
+		free(name);
+
+		dmode = sb.st_mode & S_IFMT;
+		if (S_ISDIR(dmode)) {
+			close(dfd);
+			dfd = nfd;
+			continue;
+		}
+		if (nfd >= 0)
+			close(nfd);
+		if (!last_node) {
+			r = -ENOTDIR;
+			goto out;
 		}
 	}
 
@@ -524,20 +578,14 @@ int syd_realpath_at(int fd, const char *path, char **buf, int mode)
 	 */
 	if (rlen > 1 && rpath[rlen - 1] == '/')
 		rpath[rlen - 1] = '\0';
-
+	r = 0;
 out:
-	if (save_fd >= 0) {
-		syd_fchdir(save_fd);
-		close(save_fd);
-	}
-	if (left)
-		free(left);
-	if (r < 0) {
-		if (rpath != NULL)
-			free(rpath);
-	} else {
+	if (dfd >= 0)
+		close(dfd);
+	free(left);
+	if (r < 0)
+		free(rpath);
+	else
 		*buf = rpath;
-	}
 	return r;
 }
-#endif
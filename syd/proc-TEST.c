@@ -315,6 +315,47 @@ out:
 	}
 }
 
+static void test_proc_cwd_open(void)
+{
+	int fd, dfd;
+	char *path, cwd[PATH_MAX];
+
+	if (!getcwd(cwd, PATH_MAX)) {
+		fail_msg("getcwd failed: %d %s", errno, strerror(errno));
+		return;
+	}
+
+	fd = syd_proc_cwd_open(getpid());
+	if (fd < 0) {
+		fail_msg("syd_proc_cwd_open failed: %d %s", -fd, strerror(-fd));
+		return;
+	}
+	if (syd_realpath_at(fd, ".", &path, SYD_REALPATH_EXIST) < 0) {
+		fail_msg("syd_realpath_at failed: %d %s", errno, strerror(errno));
+	} else {
+		if (strcmp(path, cwd))
+			fail_msg("cwd: %s != %s(real)", path, cwd);
+		free(path);
+	}
+	close(fd);
+
+	fd = open(".", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	dfd = syd_proc_dirfd_open(getpid(), fd);
+	if (dfd < 0) {
+		fail_msg("syd_proc_dirfd_open failed: %d %s", -dfd, strerror(-dfd));
+	} else {
+		if (syd_realpath_at(dfd, "tmp", &path, SYD_REALPATH_NOLAST) < 0) {
+			fail_msg("syd_realpath_at failed: %d %s", errno, strerror(errno));
+		} else {
+			if (strncmp(path, cwd, strlen(cwd)) || strcmp(path + strlen(cwd), "/tmp"))
+				fail_msg("dirfd: %s != %s/tmp(real)", path, cwd);
+			free(path);
+		}
+		close(dfd);
+	}
+	close(fd);
+}
+
 static void test_fixture_proc(void)
 {
 	test_fixture_start();
@@ -327,6 +368,7 @@ static void test_fixture_proc(void)
 	run_test(test_proc_comm);
 	run_test(test_proc_cmdline);
 	run_test(test_proc_fd_path);
+	run_test(test_proc_cwd_open);
 
 	test_fixture_end();
 }
@@ -88,6 +88,46 @@ int syd_proc_fd_open(pid_t pid)
 	return (fd < 0) ? -errno : fd;
 }
 
+/*
+ * Open the current working directory of the process as an O_PATH handle
+ * which may be passed to syd_realpath_at().
+ */
+int syd_proc_cwd_open(pid_t pid)
+{
+	int r, fd;
+	char p[SYD_PROC_MAX + sizeof("/cwd")];
+
+	if (pid <= 0)
+		return -EINVAL;
+
+	r = snprintf(p, sizeof(p), "/proc/%u/cwd", pid);
+	if (r < 0 || (size_t)r >= sizeof(p))
+		return -EINVAL;
+
+	fd = open(p, O_PATH|O_DIRECTORY|O_CLOEXEC);
+	return (fd < 0) ? -errno : fd;
+}
+
+/*
+ * Open the directory the file descriptor dirfd of the process refers to
+ * as an O_PATH handle which may be passed to syd_realpath_at().
+ */
+int syd_proc_dirfd_open(pid_t pid, int dirfd)
+{
+	int r, fd;
+	char p[SYD_PROC_FD_MAX + SYD_INT_MAX];
+
+	if (pid <= 0 || dirfd < 0)
+		return -EINVAL;
+
+	r = snprintf(p, sizeof(p), "/proc/%u/fd/%d", pid, dirfd);
+	if (r < 0 || (size_t)r >= sizeof(p))
+		return -EINVAL;
+
+	fd = open(p, O_PATH|O_DIRECTORY|O_CLOEXEC);
+	return (fd < 0) ? -errno : fd;
+}
+
 int syd_proc_ppid(pid_t pid, pid_t *ppid)
 {
 	int pfd, fd, save_errno;
@@ -43,6 +43,8 @@ int syd_proc_state(pid_t pid, char *state);
 int syd_proc_environ(pid_t pid);
 
 int syd_proc_fd_open(pid_t pid);
+int syd_proc_cwd_open(pid_t pid);
+int syd_proc_dirfd_open(pid_t pid, int dirfd);
 int syd_proc_fd_path(pid_t pid, int fd, char **dst);
 
 int syd_proc_task_find(pid_t pid, pid_t task_pid);
@@ -154,6 +154,35 @@ test -e /dev/sydbox/core/sandbox/write"?"
 EOF
 '
 
+test_expect_success_foreach_option 'magic core/trace/sandbox_lock:true locks disabled sandboxing off' '
+    sydbox -m core/trace/sandbox_lock:true -- sh <<-\EOF
+test -e /dev/sydbox/core/sandbox/write:deny && exit 1
+test -e /dev/sydbox/core/sandbox/write"?" && exit 1
+exit 0
+EOF &&
+    sydbox -m core/trace/sandbox_lock:true -m core/sandbox/write:deny -- sh <<-\EOF
+test -e /dev/sydbox/core/sandbox/write:allow &&
+test -e /dev/sydbox/core/sandbox/write:deny
+EOF
+'
+
+test_expect_success_foreach_option 'magic system call sets and queries values' '
+    sydbox -- syd-magic \
+        /dev/sydbox/core/sandbox/write:deny \
+        /dev/sydbox/core/sandbox/write"?" &&
+    test_expect_code 2 sydbox -- syd-magic \
+        /dev/sydbox/core/sandbox/write:off \
+        /dev/sydbox/core/sandbox/write"?" &&
+    test_expect_code 22 sydbox -- syd-magic /dev/sydbox/core/sandbox/read:invalid
+'
+
+test_expect_success_foreach_option 'magic core/trace/magic_stat:false disables stat(2) magic' '
+    sydbox -m core/trace/magic_stat:false -- sh <<-\EOF
+test -e /dev/sydbox && exit 1
+syd-magic /dev/sydbox/core/sandbox/write:deny /dev/sydbox/core/sandbox/write"?"
+EOF
+'
+
 #test_expect_success_foreach_option 'magic core/violation/exit_code:0 works' '
 #    f="no-$(unique_file)" &&
 #    rm -f "$f" &&
@@ -232,4 +261,44 @@ test_expect_success_foreach_option 'chdir() hook with EPERM (mkdir -p) [RAISE_SA
         syd-mkdir-p "$cdir"
 '
 
+test_expect_success_foreach_option 'core/trace/worker_threads allows whitelisted paths (mkdir -p)' '
+    pdir="$(unique_dir)" &&
+    mkdir "$pdir" &&
+    cdir="${pdir}/$(unique_dir)/$(unique_dir)" &&
+    sydbox \
+        -m core/trace/worker_threads:4 \
+        -m core/sandbox/write:deny \
+        -m "whitelist/write+$HOMER/${pdir}/***" \
+        syd-mkdir-p "$cdir" &&
+    test_path_is_dir "$cdir"
+'
+
+test_expect_success_foreach_option 'core/trace/worker_threads denies other paths (mkdir -p)' '
+    pdir="$(unique_dir)" &&
+    mkdir "$pdir" &&
+    cdir="${pdir}/$(unique_dir)" &&
+    test_expect_code 1 sydbox \
+        -m core/trace/worker_threads:4 \
+        -m core/sandbox/write:deny \
+        syd-mkdir-p "$cdir" &&
+    test_path_is_missing "$cdir"
+'
+
+test_expect_success_foreach_option 'core/trace/tracer_threads traces forked processes' '
+    sydbox \
+        -m core/trace/tracer_threads:4 \
+        syd-true-fork 8
+'
+
+test_expect_success_foreach_option 'core/trace/tracer_threads denies paths in forked processes' '
+    pdir="$(unique_dir)" &&
+    mkdir "$pdir" &&
+    cdir="${pdir}/$(unique_dir)" &&
+    test_must_violate sydbox \
+        -m core/trace/tracer_threads:4 \
+        -m core/sandbox/write:deny \
+        -- sh -c "mkdir \"$cdir\" & wait" &&
+    test_path_is_missing "$cdir"
+'
+
 test_done
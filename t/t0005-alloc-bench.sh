@@ -0,0 +1,18 @@
+#!/bin/sh
+# Copyright 2015 Ali Polatel <alip@exherbo.org>
+# Released under the terms of the GNU General Public License v2
+
+test_description='test heap allocations for allowed system calls'
+. ./test-lib.sh
+
+# alloc-bench and malloc-count.so are only built by make check.
+test_lazy_prereq ALLOC_BENCH '
+    test -x "$TEST_DIRECTORY"/test-bin/alloc-bench &&
+    test -f "$TEST_DIRECTORY"/test-bin/.libs/malloc-count.so
+'
+
+test_expect_success_foreach_option ALLOC_BENCH 'allowed open() and connect() do not allocate' '
+    alloc-bench sydbox 2000 "$TEST_DIRECTORY"/test-bin/.libs/malloc-count.so
+'
+
+test_done
@@ -0,0 +1,160 @@
+/*
+ * Count the heap allocations sydbox makes for allowed system calls
+ *
+ * Usage: alloc-bench [sydbox [calls [malloc-count.so]]]
+ * Runs itself under sydbox with malloc-count.so preloaded, doing calls and
+ * twice as many allowed open(2) and connect(2) calls. The allocations
+ * sydbox makes for startup and exit are the same for both runs, the
+ * difference is what the extra calls cost. Fails unless the checks are
+ * done without touching the heap, a few allocations are allowed for the
+ * caches whose entries expire meanwhile.
+ *
+ * Copyright (c) 2015 Ali Polatel <alip@exherbo.org>
+ * Released under the terms of the 3-clause BSD license
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "bench.h"
+
+struct count_env {
+	const char *preload;
+	const char *path;
+};
+
+static int workload(const char *what, unsigned long ncall)
+{
+	int fd;
+	unsigned long i;
+	struct sockaddr_in sin;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(1); /* refused, the check is what counts */
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	for (i = 0; i < ncall; i++) {
+		if (!strcmp(what, "open")) {
+			fd = open("/dev/null", O_RDONLY);
+			if (fd < 0)
+				return 1;
+		} else {
+			fd = socket(AF_INET, SOCK_STREAM, 0);
+			if (fd < 0)
+				return 1;
+			if (connect(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 &&
+			    errno != ECONNREFUSED)
+				return 1;
+		}
+		close(fd);
+	}
+	return 0;
+}
+
+/* Preloads malloc-count.so for sydbox, which is the child. */
+static void count_setup(void *data)
+{
+	char spid[32];
+	const struct count_env *env = data;
+
+	snprintf(spid, sizeof(spid), "%u", getpid());
+	setenv("MALLOC_COUNT_PID", spid, 1);
+	setenv("MALLOC_COUNT_FILE", env->path, 1);
+	setenv("LD_PRELOAD", env->preload, 1);
+}
+
+/* Returns the number of allocations of sydbox, -1 on failure. */
+static long run(const char *sydbox, const char *self, const char *preload,
+		const char *what, unsigned long ncall)
+{
+	int fd;
+	long count;
+	FILE *f = NULL;
+	char calls[32];
+	char path[] = "/tmp/alloc-bench-XXXXXX";
+	struct count_env env = { preload, path };
+	const char *magics[] = {
+		"core/sandbox/read:deny",
+		"whitelist/read+/***",
+		"core/sandbox/network:deny",
+		"whitelist/network/connect+LOOPBACK@0-65535",
+		NULL,
+	};
+	const char *args[] = { what, calls, NULL };
+
+	if ((fd = mkstemp(path)) < 0) {
+		perror("mkstemp");
+		return -1;
+	}
+	close(fd);
+	snprintf(calls, sizeof(calls), "%lu", ncall);
+
+	count = -1;
+	if (bench_run(sydbox, self, magics, args, count_setup, &env, NULL) < 0) {
+		fprintf(stderr, "with %s\n", what);
+	} else if (!(f = fopen(path, "r")) || fscanf(f, "%ld", &count) != 1) {
+		fprintf(stderr, "%s: no allocation count, is %s preloaded?\n",
+			path, preload);
+		count = -1;
+	}
+	if (f)
+		fclose(f);
+	unlink(path);
+	return count;
+}
+
+int main(int argc, char *argv[])
+{
+	int i, r = 0;
+	long c1, c2;
+	unsigned long ncall;
+	char self[PATH_MAX], dir[PATH_MAX], preload[PATH_MAX];
+	const char *sydbox;
+	static const char *list[] = { "open", "connect", NULL };
+
+	if (argc == 4 && !strcmp(argv[1], BENCH_WORKLOAD))
+		return workload(argv[2], strtoul(argv[3], NULL, 10));
+
+	if (bench_self(self, sizeof(self)) < 0)
+		return 1;
+	memcpy(dir, self, sizeof(dir));
+
+	sydbox = argc > 1 ? argv[1] : "sydbox";
+	ncall = strtoul(argc > 2 ? argv[2] : "10000", NULL, 10);
+	if (argc > 3)
+		snprintf(preload, sizeof(preload), "%s", argv[3]);
+	else
+		snprintf(preload, sizeof(preload), "%s/.libs/malloc-count.so",
+			 dirname(dir));
+
+	printf("# %lu and %lu allowed calls\n", ncall, 2 * ncall);
+	printf("# %8s %12s %12s %14s\n", "call", "allocs", "allocs(x2)", "allocs/call");
+	for (i = 0; list[i]; i++) {
+		c1 = run(sydbox, self, preload, list[i], ncall);
+		if (c1 < 0)
+			return 1;
+		c2 = run(sydbox, self, preload, list[i], 2 * ncall);
+		if (c2 < 0)
+			return 1;
+		printf("  %8s %12ld %12ld %14.4f\n", list[i], c1, c2,
+		       (double)(c2 - c1) / ncall);
+		if (c2 - c1 > (long)(ncall / 1000)) {
+			fprintf(stderr, "%s: %ld heap allocations for %lu allowed calls\n",
+				list[i], c2 - c1, ncall);
+			r = 1;
+		}
+	}
+
+	return r;
+}
@@ -0,0 +1,89 @@
+/*
+ * Driver shared by the benchmarks which run themselves under sydbox
+ * Copyright (c) 2015 Ali Polatel <alip@exherbo.org>
+ * Released under the terms of the 3-clause BSD license
+ */
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+unsigned long bench_ns(const struct timespec *ts, const struct timespec *te)
+{
+	return (te->tv_sec - ts->tv_sec) * 1000000000UL + te->tv_nsec - ts->tv_nsec;
+}
+
+int bench_self(char *self, size_t size)
+{
+	ssize_t len;
+
+	len = readlink("/proc/self/exe", self, size - 1);
+	if (len < 0) {
+		perror("readlink");
+		return -1;
+	}
+	self[len] = '\0';
+	return 0;
+}
+
+int bench_run(const char *sydbox, const char *self,
+	      const char *const *magic, const char *const *args,
+	      void (*setup)(void *data), void *data, struct rusage *ru)
+{
+	int status;
+	size_t i, n, nmagic, nargs;
+	pid_t pid;
+	const char **argv;
+
+	for (nmagic = 0; magic[nmagic]; nmagic++)
+		;
+	for (nargs = 0; args[nargs]; nargs++)
+		;
+
+	/* sydbox -m magic... -- self --workload args... */
+	argv = malloc((2 * nmagic + nargs + 5) * sizeof(char *));
+	if (!argv) {
+		perror("malloc");
+		return -1;
+	}
+	n = 0;
+	argv[n++] = sydbox;
+	for (i = 0; i < nmagic; i++) {
+		argv[n++] = "-m";
+		argv[n++] = magic[i];
+	}
+	argv[n++] = "--";
+	argv[n++] = self;
+	argv[n++] = BENCH_WORKLOAD;
+	for (i = 0; i < nargs; i++)
+		argv[n++] = args[i];
+	argv[n] = NULL;
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		free(argv);
+		return -1;
+	} else if (pid == 0) {
+		if (setup)
+			setup(data);
+		execvp(sydbox, (char *const *)argv);
+		perror(sydbox);
+		_exit(127);
+	}
+	free(argv);
+
+	if (wait4(pid, &status, 0, ru) < 0) {
+		perror("wait4");
+		return -1;
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "sydbox failed (status:%#x)\n", status);
+		return -1;
+	}
+	return 0;
+}
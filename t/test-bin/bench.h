@@ -0,0 +1,32 @@
+/*
+ * Driver shared by the benchmarks which run themselves under sydbox
+ * Copyright (c) 2015 Ali Polatel <alip@exherbo.org>
+ * Released under the terms of the 3-clause BSD license
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/resource.h>
+
+/* First argument of the program when it runs as the workload */
+#define BENCH_WORKLOAD "--workload"
+
+unsigned long bench_ns(const struct timespec *ts, const struct timespec *te);
+
+/* Path of the running program, returns -1 on failure. */
+int bench_self(char *self, size_t size);
+
+/*
+ * Runs "self --workload args..." under sydbox with the magic commands, both
+ * lists are NULL terminated. setup, if not NULL, is called in the child
+ * before sydbox is executed. ru, if not NULL, gets the resource usage of
+ * sydbox. Returns 0 if sydbox exited with zero, -1 otherwise.
+ */
+int bench_run(const char *sydbox, const char *self,
+	      const char *const *magic, const char *const *args,
+	      void (*setup)(void *data), void *data, struct rusage *ru);
+
+#endif
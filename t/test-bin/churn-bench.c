@@ -0,0 +1,117 @@
+/*
+ * Benchmark process churn under sydbox
+ *
+ * Usage: churn-bench [sydbox [processes [width]]]
+ * Runs itself under sydbox which forks processes children, at most width of
+ * them alive at a time. The children either exit right away or are killed
+ * with SIGKILL before they get to exit. Prints the wall clock time, the
+ * latency per process and the maximum resident set size of sydbox.
+ *
+ * Copyright (c) 2015 Ali Polatel <alip@exherbo.org>
+ * Released under the terms of the 3-clause BSD license
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+
+static int workload(const char *how, unsigned long nproc, unsigned long width)
+{
+	int status, kill_them;
+	unsigned long i, alive = 0;
+	pid_t pid;
+
+	kill_them = !strcmp(how, "kill");
+	for (i = 0; i < nproc; i++) {
+		if (alive == width) {
+			if (wait(&status) < 0) {
+				perror("wait");
+				return 1;
+			}
+			alive--;
+		}
+		pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			return 1;
+		} else if (pid == 0) {
+			if (kill_them)
+				pause();
+			_exit(0);
+		}
+		if (kill_them)
+			kill(pid, SIGKILL);
+		alive++;
+	}
+
+	while (wait(&status) > 0)
+		;
+	return 0;
+}
+
+static int run(const char *sydbox, const char *self, const char *how,
+	       const char *nproc, const char *width, long *maxrss)
+{
+	struct rusage ru;
+	const char *magics[] = {
+		"core/sandbox/read:deny",
+		"whitelist/read+/***",
+		NULL,
+	};
+	const char *args[] = { how, nproc, width, NULL };
+
+	if (bench_run(sydbox, self, magics, args, NULL, NULL, &ru) < 0) {
+		fprintf(stderr, "with %s\n", how);
+		return -1;
+	}
+	*maxrss = ru.ru_maxrss;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+	long maxrss;
+	unsigned long ns, count;
+	char self[PATH_MAX];
+	const char *sydbox, *nproc, *width;
+	struct timespec ts, te;
+	static const char *list[] = { "exit", "kill", NULL };
+
+	if (argc == 5 && !strcmp(argv[1], BENCH_WORKLOAD))
+		return workload(argv[2], strtoul(argv[3], NULL, 10),
+				strtoul(argv[4], NULL, 10));
+
+	sydbox = argc > 1 ? argv[1] : "sydbox";
+	nproc = argc > 2 ? argv[2] : "100000";
+	width = argc > 3 ? argv[3] : "64";
+	count = strtoul(nproc, NULL, 10);
+
+	if (bench_self(self, sizeof(self)) < 0)
+		return 1;
+
+	printf("# %s processes, %s alive at most\n", nproc, width);
+	printf("# %8s %12s %14s %12s\n", "children", "msec", "usec/process", "maxrss(KB)");
+	for (i = 0; list[i]; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		if (run(sydbox, self, list[i], nproc, width, &maxrss) < 0)
+			return 1;
+		clock_gettime(CLOCK_MONOTONIC, &te);
+		ns = bench_ns(&ts, &te);
+		printf("  %8s %12lu %14.2f %12ld\n", list[i], ns / 1000000UL,
+		       count ? ns / 1e3 / count : 0.0, maxrss);
+	}
+
+	return 0;
+}
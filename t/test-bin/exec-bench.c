@@ -0,0 +1,147 @@
+/*
+ * Benchmark concurrent execve(2) calls under sydbox
+ *
+ * Usage: exec-bench [sydbox [processes]]
+ * Runs itself under sydbox which forks processes children and lets them all
+ * execute at once when the last one is born, so every exec happens with up
+ * to processes other tracees around. The children execute this program
+ * again, which exits right away. Prints the wall clock time of the forks,
+ * of the execs and the latency per exec.
+ *
+ * Copyright (c) 2015 Ali Polatel <alip@exherbo.org>
+ * Released under the terms of the 3-clause BSD license
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+
+#define EXECUTED "--executed"
+
+static int workload(const char *self, unsigned long nproc, int out)
+{
+	int fd[2], status, r = 0;
+	char c;
+	unsigned long i, forked;
+	pid_t pid;
+	struct timespec ts, tf, te;
+
+	if (pipe(fd) < 0) {
+		perror("pipe");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	for (i = 0; i < nproc; i++) {
+		pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			r = 1;
+			break;
+		} else if (pid == 0) {
+			close(out);
+			close(fd[1]);
+			/* wait for the siblings, EOF when the parent is done */
+			if (read(fd[0], &c, 1) < 0)
+				_exit(1);
+			execl(self, self, EXECUTED, (char *)NULL);
+			_exit(127);
+		}
+	}
+	forked = i;
+	clock_gettime(CLOCK_MONOTONIC, &tf);
+	close(fd[0]);
+	close(fd[1]);
+
+	while (wait(&status) > 0) {
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			r = 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &te);
+
+	/* the driver prints it */
+	dprintf(out, "%lu %lu %lu\n", forked,
+		bench_ns(&ts, &tf), bench_ns(&tf, &te));
+	return r;
+}
+
+/* The workload writes its timings to the pipe, see workload(). */
+static void pipe_setup(void *data)
+{
+	int *fd = data;
+
+	close(fd[0]);
+}
+
+static int run(const char *sydbox, const char *self, const char *nproc,
+	       unsigned long *forked, unsigned long *fork_ns,
+	       unsigned long *exec_ns)
+{
+	int fd[2], r;
+	FILE *f;
+	char out[16];
+	const char *magics[] = {
+		"core/sandbox/exec:deny",
+		"whitelist/exec+/***",
+		NULL,
+	};
+	const char *args[] = { nproc, out, NULL };
+
+	if (pipe(fd) < 0) {
+		perror("pipe");
+		return -1;
+	}
+	snprintf(out, sizeof(out), "%d", fd[1]);
+
+	r = bench_run(sydbox, self, magics, args, pipe_setup, fd, NULL);
+	close(fd[1]);
+
+	f = fdopen(fd[0], "r");
+	if (!f || fscanf(f, "%lu %lu %lu", forked, fork_ns, exec_ns) != 3) {
+		fprintf(stderr, "no timings from the workload\n");
+		*forked = 0;
+	}
+	if (f)
+		fclose(f);
+	else
+		close(fd[0]);
+
+	return (r < 0 || !*forked) ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long forked, fork_ns, exec_ns;
+	char self[PATH_MAX];
+	const char *sydbox, *nproc;
+
+	if (argc == 2 && !strcmp(argv[1], EXECUTED))
+		return 0;
+
+	if (bench_self(self, sizeof(self)) < 0)
+		return 1;
+
+	if (argc == 4 && !strcmp(argv[1], BENCH_WORKLOAD))
+		return workload(self, strtoul(argv[2], NULL, 10), atoi(argv[3]));
+
+	sydbox = argc > 1 ? argv[1] : "sydbox";
+	nproc = argc > 2 ? argv[2] : "5000";
+
+	if (run(sydbox, self, nproc, &forked, &fork_ns, &exec_ns) < 0)
+		return 1;
+
+	printf("# %s processes executing at once\n", nproc);
+	printf("# %8s %12s %12s %12s\n", "children", "fork(msec)", "exec(msec)", "usec/exec");
+	printf("  %8lu %12lu %12lu %12.2f\n", forked, fork_ns / 1000000UL,
+	       exec_ns / 1000000UL, exec_ns / 1e3 / forked);
+
+	return forked == strtoul(nproc, NULL, 10) ? 0 : 1;
+}
@@ -0,0 +1,58 @@
+/*
+ * Preloaded by alloc-bench to count the heap allocations of sydbox
+ *
+ * Counts malloc(), calloc() and realloc() calls of all threads and writes
+ * the count to $MALLOC_COUNT_FILE on exit if the process id is
+ * $MALLOC_COUNT_PID, the tracees inherit the library too.
+ *
+ * Copyright (c) 2015 Ali Polatel <alip@exherbo.org>
+ * Released under the terms of the 3-clause BSD license
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long count;
+
+void *malloc(size_t size)
+{
+	__atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	__atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	__atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+
+__attribute__((destructor))
+static void malloc_count_report(void)
+{
+	unsigned long n;
+	const char *path, *pid;
+	FILE *f;
+
+	n = __atomic_load_n(&count, __ATOMIC_RELAXED);
+	path = getenv("MALLOC_COUNT_FILE");
+	pid = getenv("MALLOC_COUNT_PID");
+	if (!path || !pid || atoi(pid) != getpid())
+		return;
+
+	f = fopen(path, "w");
+	if (!f)
+		return;
+	fprintf(f, "%lu\n", n);
+	fclose(f);
+}
@@ -0,0 +1,92 @@
+/*
+ * Benchmark procmatch() against matching a pattern per traced process
+ *
+ * Copyright (c) 2014 Ali Polatel <alip@exherbo.org>
+ * Released under the terms of the 3-clause BSD license
+ */
+
+#include "sydconf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "procmatch.h"
+#include "pathmatch.h"
+
+#define NEEDLES 64
+
+static unsigned long bench_ns(const struct timespec *ts, const struct timespec *te)
+{
+	return (te->tv_sec - ts->tv_sec) * 1000000000UL + te->tv_nsec - ts->tv_nsec;
+}
+
+/* The old way: run pathmatch() for every traced process. */
+static int procmatch_linear(proc_pid_t **pp, const char *path)
+{
+	char pattern[sizeof("/proc/%u/***") + sizeof(int)*3];
+	proc_pid_t *node, *tmp;
+
+	HASH_ITER(hh, *pp, node, tmp) {
+		sprintf(pattern, "/proc/%u/***", node->pid);
+		if (pathmatch(pattern, path))
+			return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned npid, loop, i, j, hits[2];
+	unsigned long ns[2];
+	char needle[NEEDLES][64];
+	struct timespec ts, te;
+	proc_pid_t *pp = NULL;
+
+	npid = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000;
+	loop = argc > 2 ? strtoul(argv[2], NULL, 10) : 10;
+
+	for (i = 0; i < npid; i++)
+		procadd(&pp, 1000 + i * 3);
+	for (i = 0; i < NEEDLES; i++) {
+		switch (i % 4) {
+		case 0: /* a traced process */
+			sprintf(needle[i], "/proc/%u/status", 1000 + (i * 7919 % npid) * 3);
+			break;
+		case 1: /* a process which is not traced */
+			sprintf(needle[i], "/proc/%u/fd/3", 1001 + i * 3);
+			break;
+		case 2: /* not a process */
+			sprintf(needle[i], "/proc/sys/kernel/pid_max");
+			break;
+		default: /* not /proc at all */
+			sprintf(needle[i], "/usr/lib/libc.so.%u", i);
+			break;
+		}
+	}
+
+	for (j = 0; j < 2; j++) {
+		hits[j] = 0;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		for (unsigned l = 0; l < loop; l++) {
+			for (i = 0; i < NEEDLES; i++) {
+				if (j == 0)
+					hits[j] += procmatch_linear(&pp, needle[i]);
+				else
+					hits[j] += procmatch(&pp, needle[i]);
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &te);
+		ns[j] = bench_ns(&ts, &te);
+	}
+
+	printf("%u processes, %u lookups\n", npid, loop * NEEDLES);
+	printf("pathmatch() per process: %lu ns/lookup\n", ns[0] / (loop * NEEDLES));
+	printf("procmatch(): %lu ns/lookup\n", ns[1] / (loop * NEEDLES));
+
+	if (hits[0] != hits[1]) {
+		printf("MISMATCH: %u != %u\n", hits[0], hits[1]);
+		return 1;
+	}
+	return 0;
+}
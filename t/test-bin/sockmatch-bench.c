@@ -0,0 +1,148 @@
+/*
+ * Benchmark acl_sockmatch() against matching every network pattern
+ *
+ * Copyright (c) 2014 Ali Polatel <alip@exherbo.org>
+ * Released under the terms of the 3-clause BSD license
+ */
+
+#include "sydconf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "acl-queue.h"
+#include "sockmatch.h"
+
+#define NEEDLES 256
+
+static unsigned long bench_ns(const struct timespec *ts, const struct timespec *te)
+{
+	return (te->tv_sec - ts->tv_sec) * 1000000000UL + te->tv_nsec - ts->tv_nsec;
+}
+
+/* The old way: try every pattern, the last match decides. */
+static struct acl_node *sockmatch_linear(const aclq_t *aclq,
+					 const struct pink_sockaddr *psa)
+{
+	struct acl_node *node, *match = NULL;
+
+	ACLQ_FOREACH(node, aclq) {
+		if (sockmatch(node->match, psa))
+			match = node;
+	}
+	return match;
+}
+
+static void make_needle(struct pink_sockaddr *psa, unsigned i, unsigned nport)
+{
+	memset(psa, 0, sizeof(struct pink_sockaddr));
+	switch (i % 4) {
+	case 0: /* a bound port on loopback */
+	case 1: /* anywhere on loopback */
+		psa->family = AF_INET;
+		psa->u.sa_in.sin_addr.s_addr = htonl(0x7f000001 + (i % 3));
+		psa->u.sa_in.sin_port = htons(i % 4 ? i * 7919 % 65536
+						  : 1024 + i * 7919 % nport);
+		break;
+	case 2: /* somewhere else */
+		psa->family = AF_INET;
+		psa->u.sa_in.sin_addr.s_addr = htonl(0x0a000000 + i * 104729);
+		psa->u.sa_in.sin_port = htons(i * 31 % 65536);
+		break;
+	default:
+#if SYDBOX_HAVE_IPV6
+		psa->family = AF_INET6;
+		psa->u.sa6.sin6_addr = in6addr_loopback;
+		psa->u.sa6.sin6_port = htons(1024 + i * 7919 % nport);
+#else
+		psa->family = AF_INET;
+		psa->u.sa_in.sin_port = htons(i);
+#endif
+		break;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned nport, loop, i, j, hits[2];
+	unsigned long ns[2];
+	char pattern[64];
+	struct timespec ts, te;
+	struct pink_sockaddr needle[NEEDLES];
+	struct sockmatch *m;
+	struct acl_node *node[2];
+	aclq_t aclq;
+
+	nport = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000;
+	loop = argc > 2 ? strtoul(argv[2], NULL, 10) : 10;
+
+	/* Some user patterns followed by the ports of successful binds */
+	ACLQ_INIT(&aclq);
+	acl_append_sockmatch(ACL_ACTION_WHITELIST, "LOOPBACK@0", &aclq);
+	acl_append_sockmatch(ACL_ACTION_BLACKLIST, "inet:10.0.0.0/8@0-1023", &aclq);
+	acl_append_sockmatch(ACL_ACTION_WHITELIST, "LOOPBACK6@1024-65535", &aclq);
+	acl_append_sockmatch(ACL_ACTION_BLACKLIST, "inet:127.0.0.0/8@6000-6063", &aclq);
+	for (i = 0; i < nport; i++) {
+		sprintf(pattern, "inet:127.0.0.1@%u", 1024 + i);
+		acl_append_sockmatch(ACL_ACTION_WHITELIST, pattern, &aclq);
+	}
+	acl_append_sockmatch(ACL_ACTION_BLACKLIST, "inet:0.0.0.0/0@22", &aclq);
+
+	for (i = 0; i < NEEDLES; i++)
+		make_needle(&needle[i], i, nport);
+
+	for (j = 0; j < 2; j++) {
+		hits[j] = 0;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		for (unsigned l = 0; l < loop; l++) {
+			for (i = 0; i < NEEDLES; i++) {
+				if (j == 0)
+					hits[j] += !!sockmatch_linear(&aclq, &needle[i]);
+				else
+					hits[j] += acl_sockmatch(ACL_ACTION_NONE, &aclq,
+								 &needle[i], NULL) & ACL_MATCH;
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &te);
+		ns[j] = bench_ns(&ts, &te);
+	}
+
+	printf("%u bound ports, %u lookups\n", nport, loop * NEEDLES);
+	printf("sockmatch() per pattern: %lu ns/lookup\n", ns[0] / (loop * NEEDLES));
+	printf("acl_sockmatch(): %lu ns/lookup\n", ns[1] / (loop * NEEDLES));
+
+	if (hits[0] != hits[1]) {
+		printf("MISMATCH: %u != %u\n", hits[0], hits[1]);
+		return 1;
+	}
+	for (i = 0; i < NEEDLES; i++) {
+		node[0] = sockmatch_linear(&aclq, &needle[i]);
+		acl_sockmatch(ACL_ACTION_NONE, &aclq, &needle[i], &node[1]);
+		if (node[0] != node[1]) {
+			printf("MISMATCH: needle %u\n", i);
+			return 1;
+		}
+	}
+
+	/* Automatic entries are shared and dropped with the last user */
+	sockmatch_parse("inet:192.168.1.1@8080", &m);
+	node[0] = acl_retain_sockmatch(ACL_ACTION_WHITELIST, m, &aclq);
+	sockmatch_parse("inet:192.168.1.1@8080", &m);
+	node[1] = acl_retain_sockmatch(ACL_ACTION_WHITELIST, m, &aclq);
+	make_needle(&needle[0], 0, nport);
+	needle[0].u.sa_in.sin_addr.s_addr = inet_addr("192.168.1.1");
+	needle[0].u.sa_in.sin_port = htons(8080);
+	if (node[0] != node[1] || node[0]->refcnt != 2 ||
+	    acl_release_sockmatch(node[0], &aclq) ||
+	    !acl_match_sock(ACL_ACTION_NONE, &aclq, &needle[0], NULL) ||
+	    !acl_release_sockmatch(node[1], &aclq) ||
+	    acl_match_sock(ACL_ACTION_NONE, &aclq, &needle[0], NULL)) {
+		printf("MISMATCH: automatic entry\n");
+		return 1;
+	}
+
+	ACLQ_FREE(node[0], &aclq, free_sockmatch);
+	return 0;
+}
@@ -0,0 +1,13 @@
+#include "headers.h"
+#include "sydconf.h"
+
+int main(int argc, char *argv[])
+{
+	for (int i = 1; i < argc; i++) {
+		errno = 0;
+		if (syscall(SYDBOX_MAGIC_SYSCALL, argv[i]) < 0)
+			return errno;
+	}
+
+	return 0;
+}
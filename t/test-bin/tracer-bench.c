@@ -0,0 +1,114 @@
+/*
+ * Benchmark core/trace/tracer_threads with many processes doing path lookups
+ *
+ * Usage: tracer-bench [sydbox [processes [calls [threads...]]]]
+ * Runs itself under sydbox for each number of tracer threads, default 1 2 4 8,
+ * each of the processes opens a file calls times, the time is wall clock.
+ *
+ * Copyright (c) 2015 Ali Polatel <alip@exherbo.org>
+ * Released under the terms of the 3-clause BSD license
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+
+static int workload(unsigned nproc, unsigned ncall)
+{
+	int fd, status, r = 0;
+	unsigned i, j;
+	pid_t pid;
+
+	for (i = 0; i < nproc; i++) {
+		pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			return 1;
+		} else if (pid == 0) {
+			for (j = 0; j < ncall; j++) {
+				fd = open("/dev/null", O_RDONLY);
+				if (fd < 0)
+					_exit(1);
+				close(fd);
+			}
+			_exit(0);
+		}
+	}
+
+	while (wait(&status) > 0) {
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			r = 1;
+	}
+	return r;
+}
+
+static int run(const char *sydbox, const char *self, unsigned threads,
+	       const char *nproc, const char *ncall)
+{
+	char magic[64];
+	const char *magics[] = {
+		"core/trace/use_seize:1",
+		"core/trace/use_seccomp:1",
+		magic,
+		"core/sandbox/read:deny",
+		"whitelist/read+/***",
+		NULL,
+	};
+	const char *args[] = { nproc, ncall, NULL };
+
+	snprintf(magic, sizeof(magic), "core/trace/tracer_threads:%u", threads);
+	if (bench_run(sydbox, self, magics, args, NULL, NULL, NULL) < 0) {
+		fprintf(stderr, "with %u tracer threads\n", threads);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+	char self[PATH_MAX];
+	unsigned long ns, calls;
+	unsigned threads;
+	const char *sydbox, *nproc, *ncall;
+	struct timespec ts, te;
+	static const char *deflist[] = { "1", "2", "4", "8", NULL };
+	const char **list;
+
+	if (argc == 4 && !strcmp(argv[1], BENCH_WORKLOAD))
+		return workload(strtoul(argv[2], NULL, 10),
+				strtoul(argv[3], NULL, 10));
+
+	sydbox = argc > 1 ? argv[1] : "sydbox";
+	nproc = argc > 2 ? argv[2] : "64";
+	ncall = argc > 3 ? argv[3] : "2000";
+	list = argc > 4 ? (const char **)&argv[4] : deflist;
+	calls = strtoul(nproc, NULL, 10) * strtoul(ncall, NULL, 10);
+
+	if (bench_self(self, sizeof(self)) < 0)
+		return 1;
+
+	printf("# %s processes, %s open(2) calls each\n", nproc, ncall);
+	printf("# %8s %12s %14s\n", "tracers", "msec", "calls/sec");
+	for (i = 0; list[i]; i++) {
+		threads = strtoul(list[i], NULL, 10);
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		if (run(sydbox, self, threads, nproc, ncall) < 0)
+			return 1;
+		clock_gettime(CLOCK_MONOTONIC, &te);
+		ns = bench_ns(&ts, &te);
+		printf("  %8u %12lu %14.0f\n", threads, ns / 1000000UL,
+		       calls / (ns / 1e9));
+	}
+
+	return 0;
+}
@@ -158,9 +158,9 @@ test_expect_success_foreach_option() {
 	error "bug in the test script: not 2 or 3 parameters to test-expect-success-foreach-option"
 
 	argc="$#" ; arg1="$1" ; arg2="$2" ; arg3="$3"
-	for choice in "0 0" "0 1" "1 0" "1 1"
+	for choice in "0 0 0" "0 1 0" "1 0 0" "1 1 0" "0 1 1" "1 1 1"
 	do
-		IFS=' ' read -r use_seize use_seccomp <<EOF
+		IFS=' ' read -r use_seize use_seccomp use_notify <<EOF
 $choice
 EOF
 		prereq=""
@@ -178,8 +178,13 @@ EOF
 			test -z "$prereq" || prereq="${prereq},"
 			prereq="${prereq}PTRACE_SECCOMP"
 		fi
+		if test "$use_notify" = 1
+		then
+			test -z "$prereq" || prereq="${prereq},"
+			prereq="${prereq}SECCOMP_NOTIFY"
+		fi
 
-		suffix="[seize=$use_seize seccomp:$use_seccomp]"
+		suffix="[seize=$use_seize seccomp:$use_seccomp notify:$use_notify]"
 		if test "$argc" = 3
 		then
 			set -- "$prereq" "$arg2 $suffix" "$arg3"
@@ -198,12 +203,12 @@ test_expect_failure_foreach_option() {
 	error "bug in the test script: not 2 or 3 parameters to test-expect-failure-foreach-option"
 
 	argc="$#" ; arg1="$1" ; arg2="$2" ; arg3="$3"
-	for choice in "0 0" "0 1" "1 0" "1 1"
+	for choice in "0 0 0" "0 1 0" "1 0 0" "1 1 0" "0 1 1" "1 1 1"
 	do
-		IFS=' ' read -r use_seize use_seccomp <<EOF
+		IFS=' ' read -r use_seize use_seccomp use_notify <<EOF
 $choice
 EOF
-		suffix="[seize=$use_seize seccomp:$use_seccomp]"
+		suffix="[seize=$use_seize seccomp:$use_seccomp notify:$use_notify]"
 		if test "$argc" = 3
 		then
 			set -- "$arg1" "$arg2 $suffix" "$arg3"